@@ -3,9 +3,15 @@
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include "client.h"
 
 
+static int send_batch(int fd, int op, dict_pair *pairs, size_t num_pairs, int *status, uint32_t ttl_ms);
+static int send_update(int fd, dict_update *request, void *key, size_t key_size, int key_type);
+
+
 /** @brief Send IOCTL request to copy from provided data structure and conduct set in driver
  *  @param pd  Pointer to a shared dictionary object
  *  @param key  Pointer to key location in memory
@@ -17,8 +23,26 @@
  *  @return 0 on success
  */
 int set_pair(int fd, void *key, size_t key_size, int key_type, void* value, size_t value_size, int value_type)
+{
+    return set_pair_ttl(fd, key, key_size, key_type, value, value_size, value_type, 0);
+}
+
+/** @brief Set pair that expires after given time; expired pair is absent for
+ *  every call, and driver reclaims its memory on its own
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param value  Pointer to value location in memory
+ *  @param value_size Size of value, follows sizeof() format with size_t
+ *  @param value_type Number that charachterizes key for casting in userspace
+ *  @param ttl_ms Time to live in milliseconds, 0 - pair never expires
+ *  @return 0 on success
+ */
+int set_pair_ttl(int fd, void *key, size_t key_size, int key_type, void* value, size_t value_size, int value_type, uint32_t ttl_ms)
 {
     int retval;
+    dict_pair_ttl *request;
     dict_pair *message;
     
     if (fd < 0) {
@@ -26,9 +50,10 @@ int set_pair(int fd, void *key, size_t key_size, int key_type, void* value, size
         return fd;
     }
     
-    message = calloc(1, sizeof(dict_pair));
+    request = calloc(1, sizeof(dict_pair_ttl));
+    message = &request->pair;
 
-    if (message == NULL) {
+    if (request == NULL) {
         fprintf(stderr, "SET_PAIR: message calloc failed\n");
         return ENOMEM;
     }
@@ -39,18 +64,22 @@ int set_pair(int fd, void *key, size_t key_size, int key_type, void* value, size
     message->value              = value;
     message->value_size         = value_size;
     message->value_type         = value_type;
+    request->ttl_ms             = ttl_ms;
 
-    retval = ioctl(fd, SET_PAIR, message);
+    /* pair without TTL goes as plain SET_PAIR message, pair is first member */
+    retval = ioctl(fd, ttl_ms != 0 ? SET_PAIR_TTL : SET_PAIR, request);
     
     if (retval != 0) {
         fprintf(stderr, "SET_PAIR: %s\n", strerror(retval));
     }
     
-    free(message);
+    free(request);
     return retval;
 }
 
-/** @brief 
+/** @brief Send single GET_PAIR request that returns value together with its size
+ *  and type; if value does not fit into buffer, grow it to size reported by
+ *  driver and repeat
  *  @param pd  Pointer to a shared dictionary object
  *  @param key  Pointer to key location in memory
  *  @param key_size  Size of key, follows sizeof() format with size_t
@@ -60,7 +89,7 @@ int set_pair(int fd, void *key, size_t key_size, int key_type, void* value, size
 dict_pair *get_value(int fd, void *key, size_t key_size, int key_type)
 {
     int retval;
-    int value_type;
+    void *value;
     dict_pair *message;
     
     if (fd < 0) {
@@ -79,44 +108,39 @@ dict_pair *get_value(int fd, void *key, size_t key_size, int key_type)
     message->key                = key;
     message->key_size           = key_size;
     message->key_type           = key_type;
-    message->value_size_adress  = &message->value_size;
-
-    retval = ioctl(fd, GET_VALUE_SIZE, message);
-
-    if (retval != 0) {
-        if (retval == NO_PAIR) {
-            fprintf(stderr, "GET_VALUE_SIZE: no such pair\n");
-        } else {
-            fprintf(stderr, "GET_VALUE_SIZE: %s\n", strerror(retval));
-        }
-        goto get_error;
-    }
-        
-    value_type = ioctl(fd, GET_VALUE_TYPE, message);
-
-    if (value_type < 0) {
-        fprintf(stderr, "GET_VALUE_TYPE: %s\n", strerror(value_type));
-        goto get_error;
-    }
-    
-    message->value_type         = value_type;
-    message->value              = malloc(message->value_size);
+    message->value_size         = GET_VALUE_CAPACITY;
+    message->value              = malloc(GET_VALUE_CAPACITY);
 
     if (message->value == NULL) {
         fprintf(stderr, "GET_VALUE: value malloc failed\n");
         goto get_error;
     }
 
+    /* value may grow again between the calls, so repeat until it fits */
+    while ((retval = ioctl(fd, GET_PAIR, message)) == ERANGE) {
+        value = realloc(message->value, message->value_size);
+
+        if (value == NULL) {
+            fprintf(stderr, "GET_VALUE: value realloc failed\n");
+            goto get_error;
+        }
+
+        message->value = value;
+    }
 
-    retval = ioctl(fd, GET_VALUE, message);
-    
     if (retval != 0) {
-        fprintf(stderr, "GET_VALUE: %s\n", strerror(retval));
+        if (retval == ENOENT) {
+            fprintf(stderr, "GET_PAIR: no such pair\n");
+        } else {
+            fprintf(stderr, "GET_PAIR: %s\n", strerror(retval));
+        }
+        goto get_error;
     }
     
     return message;
 
 get_error:
+    free(message->value);
     free(message);
     return NULL;
 
@@ -160,4 +184,620 @@ int del_pair(int fd, void *key, size_t key_size, int key_type)
     
     free(message);
     return retval;
-}
\ No newline at end of file
+}
+
+/** @brief Send all pairs with the same operation in one BATCH request and
+ *  collect per-pair results
+ *  @param fd File descriptor of the device
+ *  @param op Operation for every pair, DICT_OP_SET, DICT_OP_GET or DICT_OP_DEL
+ *  @param pairs Array of pairs laid out as for single-pair call
+ *  @param num_pairs Number of pairs in array
+ *  @param status Array of num_pairs results, 0 or error code of each operation
+ *  @param ttl_ms Time to live of SET pairs, 0 - plain BATCH, pairs never expire
+ *  @return 0 if request was processed (check status for each pair), else error code
+ */
+static int send_batch(int fd, int op, dict_pair *pairs, size_t num_pairs, int *status, uint32_t ttl_ms)
+{
+    int retval;
+    dict_batch_ttl request = { .ttl_ms = ttl_ms };
+    dict_batch *batch = &request.batch;
+
+    if (fd < 0) {
+        fprintf(stderr, "BATCH: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    batch->num_ops = num_pairs;
+    batch->ops     = calloc(num_pairs, sizeof(dict_batch_op));
+
+    if (batch->ops == NULL) {
+        fprintf(stderr, "BATCH: calloc failed\n");
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < num_pairs; i++) {
+        batch->ops[i].op     = op;
+        batch->ops[i].pair   = pairs[i];
+    }
+
+    retval = ioctl(fd, ttl_ms != 0 ? BATCH_TTL : BATCH, &request);
+
+    if (retval != 0) {
+        fprintf(stderr, "BATCH: %s\n", strerror(retval));
+    }
+
+    for (size_t i = 0; i < num_pairs; i++) {
+        status[i] = batch->ops[i].status;
+        pairs[i].value_size = batch->ops[i].pair.value_size;
+        pairs[i].value_type = batch->ops[i].pair.value_type;
+    }
+
+    free(batch->ops);
+    return retval;
+}
+
+/** @brief Set many pairs with one syscall
+ *  @param fd File descriptor of the device
+ *  @param pairs Array of pairs, each with key, value, their sizes and types
+ *  @param num_pairs Number of pairs in array
+ *  @param status Array of num_pairs results, as set_pair() would return
+ *  @return 0 if request was processed (check status for each pair), else error code
+ */
+int set_pairs(int fd, dict_pair *pairs, size_t num_pairs, int *status)
+{
+    return send_batch(fd, DICT_OP_SET, pairs, num_pairs, status, 0);
+}
+
+/** @brief Set many pairs with one syscall, all of them expiring after given time
+ *  @param fd File descriptor of the device
+ *  @param pairs Array of pairs, each with key, value, their sizes and types
+ *  @param num_pairs Number of pairs in array
+ *  @param status Array of num_pairs results, as set_pair_ttl() would return
+ *  @param ttl_ms Time to live in milliseconds, 0 - pairs never expire
+ *  @return 0 if request was processed (check status for each pair), else error code
+ */
+int set_pairs_ttl(int fd, dict_pair *pairs, size_t num_pairs, int *status, uint32_t ttl_ms)
+{
+    return send_batch(fd, DICT_OP_SET, pairs, num_pairs, status, ttl_ms);
+}
+
+/** @brief Get values of many keys with one syscall; every pair provides buffer
+ *  for value with its capacity in value_size, which is replaced with actual
+ *  value size along with value_type; pair with too small buffer gets ERANGE
+ *  status, and missing one gets ENOENT
+ *  @param fd File descriptor of the device
+ *  @param pairs Array of pairs, each with key, its size and type, and value buffer
+ *  @param num_pairs Number of pairs in array
+ *  @param status Array of num_pairs results
+ *  @return 0 if request was processed (check status for each pair), else error code
+ */
+int get_values(int fd, dict_pair *pairs, size_t num_pairs, int *status)
+{
+    return send_batch(fd, DICT_OP_GET, pairs, num_pairs, status, 0);
+}
+
+/** @brief Delete many pairs with one syscall
+ *  @param fd File descriptor of the device
+ *  @param pairs Array of pairs, each with key, its size and type
+ *  @param num_pairs Number of pairs in array
+ *  @param status Array of num_pairs results, as del_pair() would return
+ *  @return 0 if request was processed (check status for each pair), else error code
+ */
+int del_pairs(int fd, dict_pair *pairs, size_t num_pairs, int *status)
+{
+    return send_batch(fd, DICT_OP_DEL, pairs, num_pairs, status, 0);
+}
+
+/** @brief Set up submission and completion rings on device file descriptor and
+ *  map them; one file descriptor can have only one ring
+ *  @param fd File descriptor of the device
+ *  @param sq_entries Number of submission entries, power of two
+ *  @param data_size Size of area for keys and values, offsets of SQE point into it
+ *  @param flags 0 to run submissions on ring_submit(), or DICT_RING_SQPOLL to
+ *  let driver worker poll for them
+ *  @return Ring handle, NULL on error
+ */
+dict_ring *ring_setup(int fd, uint32_t sq_entries, uint32_t data_size, uint32_t flags)
+{
+    int retval;
+    dict_ring *ring;
+    dict_ring_params params = {0};
+
+    if (fd < 0) {
+        fprintf(stderr, "RING_SETUP: invalid file descriptor %d\n", fd);
+        return NULL;
+    }
+
+    params.sq_entries   = sq_entries;
+    params.data_size    = data_size;
+    params.flags        = flags;
+
+    retval = ioctl(fd, RING_SETUP, &params);
+
+    if (retval != 0) {
+        fprintf(stderr, "RING_SETUP: %s\n", strerror(retval));
+        return NULL;
+    }
+
+    ring = calloc(1, sizeof(dict_ring));
+
+    if (ring == NULL) {
+        fprintf(stderr, "RING_SETUP: calloc failed\n");
+        return NULL;
+    }
+
+    ring->mem = mmap(NULL, params.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (ring->mem == MAP_FAILED) {
+        fprintf(stderr, "RING_SETUP: mmap failed\n");
+        free(ring);
+        return NULL;
+    }
+
+    ring->fd            = fd;
+    ring->size          = params.ring_size;
+    ring->hdr           = ring->mem;
+    ring->sqes          = (dict_sqe *)((char *)ring->mem + params.sq_off);
+    ring->cqes          = (dict_cqe *)((char *)ring->mem + params.cq_off);
+    ring->data          = (unsigned char *)ring->mem + params.data_off;
+    ring->sq_entries    = params.sq_entries;
+    ring->cq_entries    = params.cq_entries;
+    ring->data_size     = params.data_size;
+    ring->flags         = params.flags;
+    ring->sq_tail       = ring->hdr->sq_tail;
+
+    return ring;
+}
+
+/** @brief Get next free submission entry; it is sent on next ring_submit()
+ *  @param ring Ring handle
+ *  @return Entry to fill, NULL if submission ring is full
+ */
+dict_sqe *ring_get_sqe(dict_ring *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->hdr->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    return &ring->sqes[ring->sq_tail++ & (ring->sq_entries - 1)];
+}
+
+/** @brief Publish filled submission entries; enters driver to run them, or, with
+ *  DICT_RING_SQPOLL, only if polling worker went to sleep
+ *  @param ring Ring handle
+ *  @return 0 on success, else error code
+ */
+int ring_submit(dict_ring *ring)
+{
+    int retval;
+
+    __atomic_store_n(&ring->hdr->sq_tail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    /* pairs with barrier in driver between setting NEED_WAKEUP and reading sq_tail */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if ((ring->flags & DICT_RING_SQPOLL)
+        && !(__atomic_load_n(&ring->hdr->flags, __ATOMIC_RELAXED) & DICT_RING_NEED_WAKEUP)) {
+        return 0;
+    }
+
+    retval = ioctl(ring->fd, RING_ENTER, 0);
+
+    if (retval != 0) {
+        fprintf(stderr, "RING_ENTER: %s\n", strerror(retval));
+    }
+
+    return retval;
+}
+
+/** @brief Get oldest completion without consuming it
+ *  @param ring Ring handle
+ *  @return Completion entry, NULL if there is none yet
+ */
+dict_cqe *ring_peek_cqe(dict_ring *ring)
+{
+    uint32_t head = ring->hdr->cq_head;
+
+    if (head == __atomic_load_n(&ring->hdr->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &ring->cqes[head & (ring->cq_entries - 1)];
+}
+
+/** @brief Consume completion returned by ring_peek_cqe(), so driver can reuse it
+ *  @param ring Ring handle
+ */
+void ring_cqe_seen(dict_ring *ring)
+{
+    __atomic_store_n(&ring->hdr->cq_head, ring->hdr->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/** @brief Sleep until there is at least one completion
+ *  @param ring Ring handle
+ *  @return 0 on success, else errno of poll()
+ */
+int ring_wait_cqe(dict_ring *ring)
+{
+    struct pollfd pfd = { .fd = ring->fd, .events = POLLIN };
+
+    while (ring_peek_cqe(ring) == NULL) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            fprintf(stderr, "RING_WAIT: %s\n", strerror(errno));
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+/** @brief Unmap ring and free its handle; ring itself is freed by driver when
+ *  file descriptor is closed
+ *  @param ring Ring handle
+ */
+void ring_destroy(dict_ring *ring)
+{
+    munmap(ring->mem, ring->size);
+    free(ring);
+}
+
+/** @brief Send one SCAN request; start with zeroed request, then call again
+ *  with the same request until cursor comes back as 0, every key present
+ *  during the whole scan is returned at least once
+ *  @param fd File descriptor of the device
+ *  @param request Cursor, buffer with its size, record budget and flags; on
+ *  return holds next cursor, number of records and bytes of buffer they took
+ *  @return 0 on success, ERANGE if buffer cannot hold even one bucket of
+ *  records (used then holds size needed), else error code
+ */
+int scan_pairs(int fd, dict_scan *request)
+{
+    int retval;
+
+    if (fd < 0) {
+        fprintf(stderr, "SCAN: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    retval = ioctl(fd, SCAN, request);
+
+    if (retval != 0 && retval != ERANGE) {
+        fprintf(stderr, "SCAN: %s\n", strerror(retval));
+    }
+
+    return retval;
+}
+
+/** @brief Walk records returned by scan_pairs(); key follows record header,
+ *  value follows key if request had DICT_SCAN_VALUES
+ *  @param request Request scan_pairs() filled
+ *  @param record Previous record, NULL for the first one
+ *  @return Next record, NULL after the last one
+ */
+dict_scan_record *scan_next_record(dict_scan *request, dict_scan_record *record)
+{
+    size_t data_size;
+
+    if (record == NULL) {
+        return request->num_records > 0 ? request->buf : NULL;
+    }
+
+    data_size = record->key_size;
+
+    if (request->flags & DICT_SCAN_VALUES) {
+        data_size += record->value_size;
+    }
+
+    record = (dict_scan_record *)((char *)record + DICT_SCAN_RECORD_SIZE(data_size));
+
+    return (char *)record < (char *)request->buf + request->used ? record : NULL;
+}
+
+/** @brief Write snapshot of the whole dictionary to another file descriptor,
+ *  starting at its current position
+ *  @param fd File descriptor of the device
+ *  @param out_fd File descriptor open for writing - file, pipe or socket
+ *  @param num_entries Set to number of pairs written, may be NULL
+ *  @return 0 on success, else error code
+ */
+int save_snapshot(int fd, int out_fd, uint64_t *num_entries)
+{
+    int retval;
+    dict_snapshot request = { .fd = out_fd };
+
+    if (fd < 0) {
+        fprintf(stderr, "SNAPSHOT_SAVE: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    retval = ioctl(fd, SNAPSHOT_SAVE, &request);
+
+    if (retval != 0) {
+        fprintf(stderr, "SNAPSHOT_SAVE: %s\n", strerror(retval));
+    }
+
+    if (num_entries != NULL) {
+        *num_entries = request.num_entries;
+    }
+
+    return retval;
+}
+
+/** @brief Set all pairs of snapshot read from another file descriptor, from
+ *  its current position; pairs already in dictionary are kept or overwritten
+ *  @param fd File descriptor of the device
+ *  @param in_fd File descriptor open for reading
+ *  @param num_entries Set to number of pairs read, may be NULL
+ *  @return 0 on success, EINVAL if stream is not a snapshot of this version,
+ *  EIO if it is truncated, else error code
+ */
+int load_snapshot(int fd, int in_fd, uint64_t *num_entries)
+{
+    int retval;
+    dict_snapshot request = { .fd = in_fd };
+
+    if (fd < 0) {
+        fprintf(stderr, "SNAPSHOT_LOAD: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    retval = ioctl(fd, SNAPSHOT_LOAD, &request);
+
+    if (retval != 0) {
+        fprintf(stderr, "SNAPSHOT_LOAD: %s\n", strerror(retval));
+    }
+
+    if (num_entries != NULL) {
+        *num_entries = request.num_entries;
+    }
+
+    return retval;
+}
+
+/** @brief Send UPDATE request for one key; outcomes caller checks for - missing
+ *  pair, pair that exists, CAS mismatch - are not printed
+ *  @param fd File descriptor of the device
+ *  @param request Request with op and its arguments, results are written back
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @return 0 on success, else error code
+ */
+static int send_update(int fd, dict_update *request, void *key, size_t key_size, int key_type)
+{
+    int retval;
+
+    if (fd < 0) {
+        fprintf(stderr, "UPDATE: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    request->pair.key           = key;
+    request->pair.key_size      = key_size;
+    request->pair.key_type      = key_type;
+
+    retval = ioctl(fd, UPDATE, request);
+
+    if (retval != 0 && retval != ENOENT && retval != EEXIST && retval != ECANCELED) {
+        fprintf(stderr, "UPDATE: %s\n", strerror(retval));
+    }
+
+    return retval;
+}
+
+/** @brief Add delta to INT value of 4 or 8 bytes in one request; missing pair
+ *  is created as 8 byte INT equal to delta; COUNTER pair takes delta into
+ *  slot of current CPU without lock, and its sum is not computed
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param delta Value to add
+ *  @param result Set to value after addition, left as is for COUNTER, may be NULL
+ *  @return 0 on success, EINVAL if value is not such INT, ERANGE on overflow
+ */
+int incr_value(int fd, void *key, size_t key_size, int key_type, int64_t delta, int64_t *result)
+{
+    int retval;
+    dict_update request = { .op = DICT_UPDATE_INCR, .delta = delta };
+
+    retval = send_update(fd, &request, key, key_size, key_type);
+
+    if (retval == 0 && result != NULL && request.pair.value_type != COUNTER) {
+        *result = request.delta;
+    }
+
+    return retval;
+}
+
+/** @brief Subtract delta from INT value, see incr_value()
+ */
+int decr_value(int fd, void *key, size_t key_size, int key_type, int64_t delta, int64_t *result)
+{
+    return incr_value(fd, key, key_size, key_type, -delta, result);
+}
+
+/** @brief Replace value only if current one has expected bytes
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param expected Bytes current value must have
+ *  @param expected_size Size of expected value
+ *  @param value  Pointer to new value location in memory
+ *  @param value_size Size of new value
+ *  @param value_type Type of new value
+ *  @return 0 on success, ECANCELED if value differs, ENOENT if no such pair
+ */
+int cas_value(int fd, void *key, size_t key_size, int key_type, void *expected, size_t expected_size, void *value, size_t value_size, int value_type)
+{
+    dict_update request = { .op = DICT_UPDATE_CAS };
+
+    request.expected            = expected;
+    request.expected_size       = expected_size;
+    request.pair.value          = value;
+    request.pair.value_size     = value_size;
+    request.pair.value_type     = value_type;
+
+    return send_update(fd, &request, key, key_size, key_type);
+}
+
+/** @brief Replace value only if pair was not written since get_version()
+ *  or previous cas_version() returned version
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param version Expected version; set to new one on success, to current
+ *  one on ECANCELED, so caller can retry without reading it again
+ *  @param value  Pointer to new value location in memory
+ *  @param value_size Size of new value
+ *  @param value_type Type of new value
+ *  @return 0 on success, ECANCELED if version differs, ENOENT if no such pair
+ */
+int cas_version(int fd, void *key, size_t key_size, int key_type, uint64_t *version, void *value, size_t value_size, int value_type)
+{
+    int retval;
+    dict_update request = { .op = DICT_UPDATE_CAS, .version = *version };
+
+    request.pair.value          = value;
+    request.pair.value_size     = value_size;
+    request.pair.value_type     = value_type;
+
+    retval = send_update(fd, &request, key, key_size, key_type);
+
+    if (retval == 0 || retval == ECANCELED) {
+        *version = request.version;
+    }
+
+    return retval;
+}
+
+/** @brief Get version of pair, it changes on every write of the pair
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param version Set to version of the pair
+ *  @return 0 on success, ENOENT if no such pair
+ */
+int get_version(int fd, void *key, size_t key_size, int key_type, uint64_t *version)
+{
+    int retval;
+    dict_update request = { .op = DICT_UPDATE_GET };
+
+    retval = send_update(fd, &request, key, key_size, key_type);
+
+    if (retval == 0) {
+        *version = request.version;
+    }
+
+    return retval;
+}
+
+/** @brief Set pair only if key is not in dictionary yet
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param value  Pointer to value location in memory
+ *  @param value_size Size of value
+ *  @param value_type Type of value
+ *  @return 0 on success, EEXIST if pair exists
+ */
+int set_if_absent(int fd, void *key, size_t key_size, int key_type, void *value, size_t value_size, int value_type)
+{
+    dict_update request = { .op = DICT_UPDATE_SET_IF_ABSENT };
+
+    request.pair.value          = value;
+    request.pair.value_size     = value_size;
+    request.pair.value_type     = value_type;
+
+    return send_update(fd, &request, key, key_size, key_type);
+}
+
+/** @brief Append bytes to value, keeping its type; missing pair is created
+ *  with them as value of value_type
+ *  @param fd File descriptor of the device
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  Size of key, follows sizeof() format with size_t
+ *  @param key_type Number that charachterizes key for casting in userspace
+ *  @param value  Pointer to bytes to append
+ *  @param value_size Number of bytes to append
+ *  @param value_type Type of value if pair is created
+ *  @param new_size Set to size of value after append, may be NULL
+ *  @return 0 on success, else error code
+ */
+int append_value(int fd, void *key, size_t key_size, int key_type, void *value, size_t value_size, int value_type, size_t *new_size)
+{
+    int retval;
+    dict_update request = { .op = DICT_UPDATE_APPEND };
+
+    request.pair.value          = value;
+    request.pair.value_size     = value_size;
+    request.pair.value_type     = value_type;
+
+    retval = send_update(fd, &request, key, key_size, key_type);
+
+    if (retval == 0 && new_size != NULL) {
+        *new_size = request.pair.value_size;
+    }
+
+    return retval;
+}
+
+/** @brief Delete all pairs at once; old tables are released by the driver in
+ *  background, so the call is as fast for a full dictionary as for an empty one
+ *  @param fd File descriptor of the device
+ *  @param num_entries Set to number of pairs deleted, may be NULL
+ *  @return 0 on success, else error code
+ */
+int flush_dict(int fd, uint64_t *num_entries)
+{
+    int retval;
+
+    if (fd < 0) {
+        fprintf(stderr, "FLUSH: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    retval = ioctl(fd, FLUSH, num_entries);
+
+    if (retval != 0) {
+        fprintf(stderr, "FLUSH: %s\n", strerror(retval));
+    }
+
+    return retval;
+}
+
+/** @brief Delete all pairs whose key and value have given types
+ *  @param fd File descriptor of the device
+ *  @param key_type Type of keys to delete, 0 for any
+ *  @param value_type Type of values to delete, 0 for any
+ *  @param deleted Set to number of pairs deleted, may be NULL
+ *  @return 0 on success, EINVAL if both types are 0, else error code
+ */
+int del_by_type(int fd, int key_type, int value_type, uint64_t *deleted)
+{
+    int retval;
+    dict_del_by_type request = { .key_type = key_type, .value_type = value_type };
+
+    if (fd < 0) {
+        fprintf(stderr, "DEL_BY_TYPE: invalid file descriptor %d\n", fd);
+        return fd;
+    }
+
+    retval = ioctl(fd, DEL_BY_TYPE, &request);
+
+    if (retval != 0) {
+        fprintf(stderr, "DEL_BY_TYPE: %s\n", strerror(retval));
+    }
+
+    if (deleted != NULL) {
+        *deleted = request.deleted;
+    }
+
+    return retval;
+}
@@ -1,17 +1,83 @@
 #include <sys/ioctl.h>
+#include <stdint.h>
 
 
 #define NO_PAIR 420
-#define DEVICE_PATH "/dev/dict_device"
+#define DEVICE_PATH "/dev/dict_device0"
+#define DEVICE_PATH_FMT "/dev/dict_device%d"
 
 #define SET_PAIR _IOWR('a', 'a', dict_pair *)
+#define SET_PAIR_TTL _IOWR('a', 'c', dict_pair_ttl *)
 #define DEL_PAIR _IOWR('a', 'b', dict_pair *)
 #define GET_VALUE _IOWR('b', 'b', dict_pair *)
 #define GET_VALUE_SIZE _IOWR('b', 'c', dict_pair *)
 #define GET_VALUE_TYPE _IOR('c', 'c', dict_pair *)
+#define GET_PAIR _IOWR('b', 'd', dict_pair *)
+#define BATCH _IOWR('d', 'a', dict_batch *)
+#define BATCH_TTL _IOWR('d', 'b', dict_batch_ttl *)
+#define RING_SETUP _IOWR('e', 'a', dict_ring_params *)
+#define RING_ENTER _IO('e', 'b')
+#define SCAN _IOWR('f', 'a', dict_scan *)
+#define SNAPSHOT_SAVE _IOWR('g', 'a', dict_snapshot *)
+#define SNAPSHOT_LOAD _IOWR('g', 'b', dict_snapshot *)
+#define UPDATE _IOWR('h', 'a', dict_update *)
+#define FLUSH _IOWR('i', 'a', uint64_t *)
+#define DEL_BY_TYPE _IOWR('i', 'b', dict_del_by_type *)
+
+/* Value buffer get_value starts with, grown to exact size if value is bigger */
+
+#define GET_VALUE_CAPACITY 64
+
+/* Operations of BATCH request */
+
+#define DICT_OP_SET 1
+#define DICT_OP_GET 2
+#define DICT_OP_DEL 3
+
+/* Ring setup flags, and header flags set by driver */
+
+#define DICT_RING_SQPOLL 1
+#define DICT_RING_NEED_WAKEUP 1
+
+/* SCAN request flags */
+
+#define DICT_SCAN_VALUES 1
+
+/* Snapshot stream identification */
+
+#define DICT_SNAPSHOT_MAGIC 0x54434944
+#define DICT_SNAPSHOT_VERSION 2
+
+/* Operations of UPDATE request */
+
+#define DICT_UPDATE_GET 1
+#define DICT_UPDATE_INCR 2
+#define DICT_UPDATE_CAS 3
+#define DICT_UPDATE_SET_IF_ABSENT 4
+#define DICT_UPDATE_APPEND 5
+
+/* Size of SCAN record, header and data rounded up to 8 bytes */
+
+#define DICT_SCAN_RECORD_SIZE(data_size) ((sizeof(dict_scan_record) + (data_size) + 7) & ~(size_t)7)
 
 typedef struct dict_pair dict_pair;
+typedef struct dict_pair_ttl dict_pair_ttl;
 typedef struct dict_value_data dict_value_data;
+typedef struct dict_batch_op dict_batch_op;
+typedef struct dict_batch dict_batch;
+typedef struct dict_batch_ttl dict_batch_ttl;
+typedef struct dict_uring_cmd_payload dict_uring_cmd_payload;
+typedef struct dict_ring_params dict_ring_params;
+typedef struct dict_ring_header dict_ring_header;
+typedef struct dict_sqe dict_sqe;
+typedef struct dict_cqe dict_cqe;
+typedef struct dict_ring dict_ring;
+typedef struct dict_scan dict_scan;
+typedef struct dict_scan_record dict_scan_record;
+typedef struct dict_snapshot dict_snapshot;
+typedef struct dict_snapshot_header dict_snapshot_header;
+typedef struct dict_update dict_update;
+typedef struct dict_del_by_type dict_del_by_type;
 
 struct dict_pair
 {
@@ -30,11 +96,228 @@ struct dict_pair
     dict_pair *next;
 };
 
+/*
+ * SET_PAIR_TTL request - pair and time it lives, pair expires this many ms
+ * after it was set, 0 - never; SET_PAIR message stays as it was
+ */
+
+struct dict_pair_ttl
+{
+    dict_pair pair;
+
+    uint32_t ttl_ms;
+    uint32_t pad;
+};
+
+struct dict_batch_op
+{
+    int op;
+    int status;
+
+    dict_pair pair;
+};
+
+struct dict_batch
+{
+    size_t num_ops;
+    dict_batch_op *ops;
+};
+
+/* BATCH_TTL request - BATCH whose SET operations all get the same time to live */
+
+struct dict_batch_ttl
+{
+    dict_batch batch;
+
+    uint32_t ttl_ms;
+    uint32_t pad;
+};
+
+/* Payload of IORING_OP_URING_CMD SQE, cmd_op is one of IOCTL commands */
+
+struct dict_uring_cmd_payload
+{
+    uint64_t pair;
+};
+
+struct dict_ring_params
+{
+    uint32_t sq_entries;
+    uint32_t data_size;
+    uint32_t flags;
+
+    uint32_t cq_entries;
+    uint32_t sq_off;
+    uint32_t cq_off;
+    uint32_t data_off;
+    uint32_t ring_size;
+};
+
+struct dict_ring_header
+{
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t sq_mask;
+    uint32_t flags;
+    uint32_t sq_pad[12];
+
+    uint32_t cq_head;
+    uint32_t cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_pad[13];
+};
+
+struct dict_sqe
+{
+    uint32_t op;
+    int key_type;
+    int value_type;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t pad;
+
+    uint64_t key_off;
+    uint64_t value_off;
+    uint64_t user_data;
+};
+
+struct dict_cqe
+{
+    uint64_t user_data;
+    int status;
+    int value_type;
+    uint32_t value_size;
+    uint32_t pad;
+};
+
+struct dict_scan
+{
+    uint64_t cursor;
+
+    void *buf;
+    size_t buf_size;
+
+    uint32_t max_records;
+    uint32_t flags;
+
+    uint32_t num_records;
+    size_t used;
+};
+
+/* Record of SCAN buffer, followed by key and, with DICT_SCAN_VALUES, value bytes */
+
+struct dict_scan_record
+{
+    uint32_t key_size;
+    uint32_t value_size;
+
+    int key_type;
+    int value_type;
+
+    /* wall clock ms (CLOCK_REALTIME) when pair expires, 0 - never */
+    uint64_t expires_ms;
+};
+
+struct dict_snapshot
+{
+    int fd;
+    uint32_t pad;
+
+    uint64_t num_entries;
+    uint64_t size;
+};
+
+/* Start of snapshot stream, records follow as dict_scan_record with key and value, unpadded */
+
+struct dict_snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_entries;
+};
+
+/* Read-modify-write of one pair, done by driver under the pair's lock */
+
+struct dict_update
+{
+    int op;
+    uint32_t pad;
+
+    dict_pair pair;
+
+    int64_t delta;
+
+    void *expected;
+    size_t expected_size;
+
+    uint64_t version;
+};
+
+/* Deletion of all pairs of given types, 0 matches any */
+
+struct dict_del_by_type
+{
+    int key_type;
+    int value_type;
+
+    uint64_t deleted;
+};
+
+/* Mapped rings of one device file descriptor, data points to area for keys and values */
+
+struct dict_ring
+{
+    int fd;
+    void *mem;
+    size_t size;
+
+    dict_ring_header *hdr;
+    dict_sqe *sqes;
+    dict_cqe *cqes;
+    unsigned char *data;
+
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t data_size;
+    uint32_t flags;
+
+    /* submissions filled but not published yet */
+    uint32_t sq_tail;
+};
+
+/* COUNTER is 8 byte integer driver keeps in per-CPU slots, for hot incr_value() */
+
 enum data_types {
     INT = 1,
-    CHAR = 2
+    CHAR = 2,
+    COUNTER = 3
 };
 
 int set_pair(int fd, void *key, size_t key_size, int key_type, void* value, size_t value_size, int value_type);
+int set_pair_ttl(int fd, void *key, size_t key_size, int key_type, void* value, size_t value_size, int value_type, uint32_t ttl_ms);
 int del_pair(int fd, void *key, size_t key_size, int key_type);
-dict_pair *get_value(int fd, void *key, size_t key_size, int key_type);
\ No newline at end of file
+dict_pair *get_value(int fd, void *key, size_t key_size, int key_type);
+int set_pairs(int fd, dict_pair *pairs, size_t num_pairs, int *status);
+int set_pairs_ttl(int fd, dict_pair *pairs, size_t num_pairs, int *status, uint32_t ttl_ms);
+int get_values(int fd, dict_pair *pairs, size_t num_pairs, int *status);
+int del_pairs(int fd, dict_pair *pairs, size_t num_pairs, int *status);
+dict_ring *ring_setup(int fd, uint32_t sq_entries, uint32_t data_size, uint32_t flags);
+dict_sqe *ring_get_sqe(dict_ring *ring);
+int ring_submit(dict_ring *ring);
+dict_cqe *ring_peek_cqe(dict_ring *ring);
+void ring_cqe_seen(dict_ring *ring);
+int ring_wait_cqe(dict_ring *ring);
+void ring_destroy(dict_ring *ring);
+int scan_pairs(int fd, dict_scan *request);
+dict_scan_record *scan_next_record(dict_scan *request, dict_scan_record *record);
+int save_snapshot(int fd, int out_fd, uint64_t *num_entries);
+int load_snapshot(int fd, int in_fd, uint64_t *num_entries);
+int incr_value(int fd, void *key, size_t key_size, int key_type, int64_t delta, int64_t *result);
+int decr_value(int fd, void *key, size_t key_size, int key_type, int64_t delta, int64_t *result);
+int cas_value(int fd, void *key, size_t key_size, int key_type, void *expected, size_t expected_size, void *value, size_t value_size, int value_type);
+int cas_version(int fd, void *key, size_t key_size, int key_type, uint64_t *version, void *value, size_t value_size, int value_type);
+int get_version(int fd, void *key, size_t key_size, int key_type, uint64_t *version);
+int set_if_absent(int fd, void *key, size_t key_size, int key_type, void *value, size_t value_size, int value_type);
+int append_value(int fd, void *key, size_t key_size, int key_type, void *value, size_t value_size, int value_type, size_t *new_size);
+int flush_dict(int fd, uint64_t *num_entries);
+int del_by_type(int fd, int key_type, int value_type, uint64_t *deleted);
\ No newline at end of file
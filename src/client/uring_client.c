@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "uring_client.h"
+
+
+static int prep_dict_cmd(struct io_uring *ring, int fd, unsigned int cmd_op, dict_pair *message);
+
+
+/** @brief Prepare URING_CMD SQE that runs one of the IOCTL commands on message
+ *  @param ring io_uring instance
+ *  @param fd File descriptor of the device
+ *  @param cmd_op IOCTL command number
+ *  @param message Message laid out as for the IOCTL, must outlive the request
+ *  @return 0 on success, EBUSY if submission queue is full
+ */
+static int prep_dict_cmd(struct io_uring *ring, int fd, unsigned int cmd_op, dict_pair *message)
+{
+    struct io_uring_sqe *sqe;
+    dict_uring_cmd_payload *payload;
+
+    sqe = io_uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return EBUSY;
+    }
+
+    /* cmd_op and payload share space with fields prep_rw() clears, so go after it */
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    sqe->cmd_op = cmd_op;
+
+    payload = (dict_uring_cmd_payload *)sqe->cmd;
+    payload->pair = (uint64_t)(uintptr_t)message;
+
+    io_uring_sqe_set_data(sqe, message);
+    return 0;
+}
+
+/** @brief Prepare SET_PAIR of message's key and value
+ *  @param ring io_uring instance
+ *  @param fd File descriptor of the device
+ *  @param message Pair as for set_pair(), must outlive the request
+ *  @return 0 on success, EBUSY if submission queue is full
+ */
+int uring_prep_set_pair(struct io_uring *ring, int fd, dict_pair *message)
+{
+    return prep_dict_cmd(ring, fd, SET_PAIR, message);
+}
+
+/** @brief Prepare GET_PAIR; on completion message holds value, its size and type
+ *  @param ring io_uring instance
+ *  @param fd File descriptor of the device
+ *  @param message Key and value buffer with capacity in value_size, must
+ *  outlive the request; -ERANGE result leaves required size in value_size
+ *  @return 0 on success, EBUSY if submission queue is full
+ */
+int uring_prep_get_pair(struct io_uring *ring, int fd, dict_pair *message)
+{
+    return prep_dict_cmd(ring, fd, GET_PAIR, message);
+}
+
+/** @brief Prepare DEL_PAIR of message's key
+ *  @param ring io_uring instance
+ *  @param fd File descriptor of the device
+ *  @param message Key as for del_pair(), must outlive the request
+ *  @return 0 on success, EBUSY if submission queue is full
+ */
+int uring_prep_del_pair(struct io_uring *ring, int fd, dict_pair *message)
+{
+    return prep_dict_cmd(ring, fd, DEL_PAIR, message);
+}
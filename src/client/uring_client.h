@@ -0,0 +1,13 @@
+#include <liburing.h>
+
+#include "client.h"
+
+/*
+ * io_uring passthrough client - each call only prepares IORING_OP_URING_CMD
+ * SQE for the message, which must stay valid until its completion arrives;
+ * CQE user_data points to the message, result is 0 or negative error code
+ */
+
+int uring_prep_set_pair(struct io_uring *ring, int fd, dict_pair *message);
+int uring_prep_get_pair(struct io_uring *ring, int fd, dict_pair *message);
+int uring_prep_del_pair(struct io_uring *ring, int fd, dict_pair *message);
@@ -10,16 +10,57 @@
 #include <linux/ioctl.h>
 #include <linux/err.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/refcount.h>
+#include <linux/cpumask.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/bitops.h>
+#include <linux/siphash.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+#include <linux/llist.h>
+#include <linux/bitrev.h>
+#include <linux/file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#include <linux/io_uring.h>
+#endif
 
 #include "dict_driver.h"
 
 /* IOCTL's commands definition */
 
 #define SET_PAIR _IOWR('a', 'a', dict_pair *)
+#define SET_PAIR_TTL _IOWR('a', 'c', dict_pair_ttl *)
 #define DEL_PAIR _IOWR('a', 'b', dict_pair *)
 #define GET_VALUE _IOWR('b', 'b', dict_pair *)
 #define GET_VALUE_SIZE _IOWR('b', 'c', dict_pair *)
 #define GET_VALUE_TYPE _IOR('c', 'c', dict_pair *)
+#define GET_PAIR _IOWR('b', 'd', dict_pair *)
+#define BATCH _IOWR('d', 'a', dict_batch *)
+#define BATCH_TTL _IOWR('d', 'b', dict_batch_ttl *)
+#define RING_SETUP _IOWR('e', 'a', dict_ring_params *)
+#define RING_ENTER _IO('e', 'b')
+#define SCAN _IOWR('f', 'a', dict_scan *)
+#define SNAPSHOT_SAVE _IOWR('g', 'a', dict_snapshot *)
+#define SNAPSHOT_LOAD _IOWR('g', 'b', dict_snapshot *)
+#define UPDATE _IOWR('h', 'a', dict_update *)
+#define FLUSH _IOWR('i', 'a', u64 *)
+#define DEL_BY_TYPE _IOWR('i', 'b', dict_del_by_type *)
 
 /*  Dict constants */
 
@@ -27,6 +68,101 @@
 #define DICTSIZE_MULTIPLIER 2
 #define DICT_GROW_DENSITY 1
 
+/*
+ * Upper bound of table size in slots, keeps bucket and group arrays below
+ * INT_MAX bytes kvmalloc takes; reserve sizes shard for DICT_RESERVE_MAX
+ * pairs at most, whatever the hint is
+ */
+
+#define DICT_MAX_TABLE_SLOTS (1UL << 27)
+#define DICT_RESERVE_MAX (1UL << 24)
+
+/* Table shrinks once it is less than 1/DICT_SHRINK_DENSITY full, to about half full */
+
+#define DICT_SHRINK_DENSITY 8
+
+/* Entry size classes, each backed by its own kmem_cache: 64, 128, ... 4096 bytes */
+
+#define DICT_MIN_CLASS_SIZE 64
+#define DICT_NUM_SIZE_CLASSES 7
+
+/* Sizes are stored as u32 in dict_entry */
+
+#define DICT_MAX_SIZE U32_MAX
+
+/* Key and value together, entry with its header must stay below kvmalloc() limit of INT_MAX */
+
+#define DICT_MAX_PAIR_SIZE ((u64)INT_MAX - sizeof(dict_entry))
+
+/* Open addressing engine - control bytes, max load in eighths, SWAR masks */
+
+#define DICT_CTRL_EMPTY 0x80
+#define DICT_CTRL_DELETED 0xfe
+#define DICT_OA_MAX_LOAD 7
+#define DICT_BYTES_LSB 0x0101010101010101ULL
+#define DICT_BYTES_MSB 0x8080808080808080ULL
+
+/* Buckets moved to the new table per write during resize, and per batch in background */
+
+#define DICT_REHASH_STEP 16
+#define DICT_REHASH_BATCH 1024
+
+/* Batch descriptors copied from and back to user per round */
+
+#define DICT_BATCH_CHUNK 64
+
+/* Keys up to this size are copied from user onto the stack instead of heap */
+
+#define DICT_STACK_KEY_SIZE 64
+
+/* Upper limit of num_devices */
+
+#define DICT_MAX_DEVICES 256
+
+/* Ring limits, and how long polling worker spins without submissions before sleeping */
+
+#define DICT_RING_MAX_ENTRIES 32768
+#define DICT_RING_MAX_DATA (64 << 20)
+#define DICT_RING_IDLE_MS 10
+
+/*
+ * SCAN cursor keeps shard index above DICT_SCAN_SHARD_SHIFT and bit-reversed
+ * bucket (or home group) index below; one call visits at most
+ * DICT_SCAN_MAX_STEPS cursor positions, so sparse table cannot keep it going
+ */
+
+#define DICT_SCAN_SHARD_SHIFT 48
+#define DICT_SCAN_MAX_STEPS 1024
+#define DICT_SCAN_BATCH 64
+
+/* Snapshots are written and read in chunks of this size */
+
+#define DICT_SNAPSHOT_CHUNK (1 << 20)
+
+/*
+ * Expiry wheel - slot per tick of one second, entries expiring further than
+ * DICT_EXPIRE_SLOTS ticks ahead wait in their slot for more laps; sweep drops
+ * shard_mutex after every DICT_EXPIRE_BATCH reclaimed or DICT_EXPIRE_VISIT
+ * visited entries, whichever comes first
+ */
+
+#define DICT_EXPIRE_TICK HZ
+#define DICT_EXPIRE_SLOTS 512
+#define DICT_EXPIRE_BATCH 32
+#define DICT_EXPIRE_VISIT 256
+
+/*
+ * CLOCK eviction - hand visits at most DICT_EVICT_STEPS scan positions and
+ * evicts at most DICT_EVICT_BATCH entries per shard_mutex hold
+ */
+
+#define DICT_EVICT_STEPS 16
+#define DICT_EVICT_BATCH 32
+
+/* DEL_BY_TYPE visits at most DICT_DEL_STEPS scan positions per shard_mutex hold */
+
+#define DICT_DEL_STEPS 16
+
 /* Character device strutc declaration and function prototypes */
 
 dev_t dev = 0;
@@ -36,32 +172,481 @@ static struct cdev dict_cdev;
 static int __init dict_driver_init(void);
 static void __exit dict_driver_exit(void);
 static long dict_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static long dict_get_pair(dict *, const void *, dict_pair *, u64 *);
+static void *dict_key_from_user(dict_pair *, void *);
+static void dict_key_free(void *, void *);
+static int dict_entry_from_user(dict_pair *, u32, dict_entry **);
+static long dict_batch_run(dict *, dict_batch_ttl *, unsigned int);
+static long dict_batch_exec(dict *, dict_batch_op *, u32);
+static long dict_update_run(dict *, dict_update *);
+static int dict_update_build(dict_update_ctx *, dict_entry **);
+static int dict_update_prepare(dict_entry *, dict_entry *, void *);
+static long dict_scan_run(dict *, dict_scan *);
+static long dict_scan_copy(dict_scan_batch *, dict_scan *);
+static void dict_scan_release(dict_scan_batch *);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+static int dict_uring_cmd(struct io_uring_cmd *, unsigned int);
+static long dict_uring_get_nowait(dict *, dict_pair __user *, dict_pair *, unsigned int);
+#endif
+
+/* Submission rings function prototypes */
+
+static int dict_mmap(struct file *, struct vm_area_struct *);
+static __poll_t dict_poll(struct file *, poll_table *);
+static long dict_ring_setup(dict_file *, dict *, dict_ring_params *);
+static long dict_ring_enter(dict_ring *);
+static void dict_ring_destroy(dict_ring *);
+static unsigned int dict_ring_process(dict_ring *);
+static int dict_ring_exec(dict_ring *, const dict_sqe *, dict_cqe *);
+static void dict_ring_work(struct work_struct *);
+
+/* Open file function prototypes */
+
+static int dict_open(struct inode *, struct file *);
+static int dict_release(struct inode *, struct file *);
+static ssize_t dict_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t dict_write_iter(struct kiocb *, struct iov_iter *);
+static long dict_read_fill(dict_file *);
+
+/* Snapshot function prototypes */
+
+static long dict_snapshot_save(dict *, dict_snapshot *);
+static long dict_snapshot_load(dict *, dict_snapshot *);
+static long dict_stream_open(dict_stream *, int);
+static void dict_stream_close(dict_stream *);
+static long dict_stream_write(dict_stream *, const void *, size_t);
+static long dict_stream_flush(dict_stream *);
+static long dict_stream_kernel_write(dict_stream *, const void *, size_t);
+static long dict_stream_read(dict_stream *, void *, size_t);
 
 /* Dictionary function prototypes */
 
-static dict *dict_create(void);
+static dict *dict_create(unsigned int, const dict_engine *);
 static void dict_destroy(dict *);
 static int dict_set(dict *, void *, void *, dict_pair *);
-static dict_pair *dict_get(dict *, const void *, size_t);
-static void dict_grow(dict *);
+static int dict_set_entry(dict *, dict_entry *);
+static int dict_update_entry(dict *, dict_entry *, int (*)(dict_entry *, dict_entry *, void *), void *);
+static dict_entry *dict_get(dict *, const void *, size_t);
 static void dict_del(dict *, void *, size_t);
-static unsigned long hash_mem(const unsigned char *, size_t);
+static void dict_reserve(dict *, unsigned long);
+static dict_shard *dict_shard_of(dict *, unsigned long);
+static const dict_engine *dict_engine_find(const char *);
+static dict_entry *dict_entry_alloc(size_t, size_t);
+static inline bool dict_pair_size_ok(u64, u64);
+static inline void *dict_entry_key(dict_entry *);
+static inline void *dict_entry_value(dict_entry *);
+static const void *dict_entry_value_out(dict_entry *, s64 *);
+static int dict_counter_init(dict_entry *);
+static void dict_counter_retire(dict_entry *);
+static inline bool dict_entry_matches(dict_entry *, unsigned long, const void *, size_t);
+static void dict_entry_free(dict_entry *);
+static void dict_entry_free_rcu(struct rcu_head *);
+static void dict_free_work_fn(struct work_struct *);
+static void dict_entry_put(dict_entry *);
+static void dict_entry_put_unlinked(dict_entry *);
+static unsigned long dict_hash(const void *, size_t);
+static int dict_scan_batch_init(dict_scan_batch *);
+static u64 dict_scan_step(dict *, u64, dict_scan_batch *);
+static void dict_scan_collect(dict_scan_batch *, dict_entry *);
+static inline unsigned long dict_scan_rev(unsigned long);
+static inline unsigned long dict_scan_next(unsigned long, unsigned long);
+
+/* Chaining engine function prototypes */
+
+static int dict_chain_init(dict_shard *);
+static void dict_chain_destroy(dict_shard *);
+static int dict_chain_detach(dict_shard *, void **);
+static void dict_chain_retire(void *);
+static void dict_chain_release(void *);
+static dict_entry *dict_chain_insert(dict_shard *, dict_entry *);
+static dict_entry *dict_chain_lookup(dict_shard *, unsigned long, const void *, size_t);
+static dict_entry *dict_chain_remove(dict_shard *, unsigned long, const void *, size_t);
+static void dict_chain_shrink(dict_shard *);
+static unsigned long dict_chain_scan(dict_shard *, unsigned long, dict_scan_batch *);
+static void dict_chain_scan_bucket(dict_shard *, dict_table *, unsigned long, dict_scan_batch *);
+static int dict_chain_reserve(dict_shard *, unsigned long);
+static int dict_resize(dict_shard *, unsigned long);
+static bool dict_rehash_step(dict_shard *, int);
+static void dict_rehash_work(struct work_struct *);
+static dict_table *dict_table_alloc(unsigned long);
+static void dict_table_destroy(dict_table *);
+static dict_entry __rcu **dict_find_link(dict_shard *, dict_table *, unsigned long, const void *, size_t);
+static dict_entry *dict_table_lookup(dict_table *, unsigned long, const void *, size_t);
+
+/* Open addressing engine function prototypes */
+
+static int dict_oa_init(dict_shard *);
+static void dict_oa_destroy(dict_shard *);
+static int dict_oa_detach(dict_shard *, void **);
+static void dict_oa_retire(void *);
+static void dict_oa_release(void *);
+static dict_entry *dict_oa_insert(dict_shard *, dict_entry *);
+static dict_entry *dict_oa_lookup(dict_shard *, unsigned long, const void *, size_t);
+static dict_entry *dict_oa_remove(dict_shard *, unsigned long, const void *, size_t);
+static dict_oa_table *dict_oa_table_alloc(unsigned long);
+static void dict_oa_table_destroy(dict_oa_table *);
+static dict_entry *dict_oa_table_lookup(dict_oa_table *, unsigned long, const void *, size_t);
+static bool dict_oa_find(dict_oa_table *, unsigned long, const void *, size_t, dict_group **, int *);
+static void dict_oa_place(dict_oa_table *, dict_entry *);
+static int dict_oa_rebuild(dict_shard *, unsigned long);
+static bool dict_oa_rehash_step(dict_shard *, int);
+static void dict_oa_rehash_work(struct work_struct *);
+static int dict_oa_reserve(dict_shard *, unsigned long);
+static void dict_oa_shrink(dict_shard *);
+static unsigned long dict_oa_scan(dict_shard *, unsigned long, dict_scan_batch *);
+static void dict_oa_scan_group(dict_shard *, dict_oa_table *, unsigned long, dict_scan_batch *);
+
+/* Expiry function prototypes */
+
+static inline bool dict_entry_expired(dict_entry *);
+static u64 dict_expiry_to_real(dict_entry *);
+static bool dict_expiry_from_real(dict_entry *, u64);
+static void dict_expire_link(dict_shard *, dict_entry *);
+static void dict_expire_unlink(dict_shard *, dict_entry *);
+static bool dict_expire_shard(dict *, dict_shard *);
+static void dict_expire_work_fn(struct work_struct *);
+
+/* Accounting function prototypes */
+
+static size_t dict_entry_bytes(dict_entry *);
+static void dict_account_add(dict *, dict_shard *, dict_entry *);
+static void dict_account_sub(dict *, dict_shard *, dict_entry *);
+static int dict_quota_charge(dict *, dict_shard *, dict_entry *, dict_entry *);
+static ssize_t quota_bytes_show(struct device *, struct device_attribute *, char *);
+static ssize_t quota_bytes_store(struct device *, struct device_attribute *, const char *, size_t);
+static ssize_t quota_entries_show(struct device *, struct device_attribute *, char *);
+static ssize_t quota_entries_store(struct device *, struct device_attribute *, const char *, size_t);
+static ssize_t bytes_show(struct device *, struct device_attribute *, char *);
+static ssize_t entries_show(struct device *, struct device_attribute *, char *);
+
+/* Eviction function prototypes */
+
+static unsigned long dict_evict_shard(dict *, dict_shard *, unsigned long, bool);
+static void dict_evict(dict *, long);
+static unsigned long dict_shrink_count(struct shrinker *, struct shrink_control *);
+static unsigned long dict_shrink_scan(struct shrinker *, struct shrink_control *);
+static int dict_shrinker_register(void);
+static void dict_shrinker_unregister(void);
+
+/* Flush function prototypes */
+
+static long dict_flush_run(dict *, u64 *);
+static int dict_flush_shard(dict *, dict_shard *, dict_flush *, unsigned long *);
+static void dict_flush_work_fn(struct work_struct *);
+static long dict_del_by_type_run(dict *, dict_del_by_type *);
+static unsigned long dict_del_by_type_shard(dict *, dict_shard *, const dict_del_by_type *, dict_scan_batch *);
+
+/* Entry caches function prototypes */
+
+static int dict_caches_create(void);
+static void dict_caches_destroy(void);
+static int dict_size_class_of(size_t);
+static int dict_slabs_show(struct seq_file *, void *);
+static int dict_expiry_show(struct seq_file *, void *);
+static int dict_cache_show(struct seq_file *, void *);
 
 /* Callback registration, others should default to NULL */
 
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
+	.open = dict_open,
+	.read_iter = dict_read_iter,
+	.write_iter = dict_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
 	.unlocked_ioctl = dict_ioctl,
+	.mmap = dict_mmap,
+	.poll = dict_poll,
+	.release = dict_release,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	.uring_cmd = dict_uring_cmd,
+#endif
+};
+
+
+/* Dictionaries, one per device minor, picked by open() */
+
+static dict **dicts;
+
+/* Entry size classes and accounting of entries that did not fit any of them */
+
+static dict_size_class dict_size_classes[DICT_NUM_SIZE_CLASSES];
+static atomic_long_t dict_large_entries;
+static atomic_long_t dict_large_bytes;
+
+/* Entries reclaimed by expiry work, and time it spent sweeping */
+
+static atomic_long_t dict_expired_entries;
+static atomic64_t dict_expire_ns;
+
+/* Gives pairs back under memory pressure, only while max_bytes is set */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *dict_shrinker;
+#else
+static struct shrinker dict_shrinker_s = {
+	.count_objects = dict_shrink_count,
+	.scan_objects = dict_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+
+/* Dictionary shrinker starts from next time, so all devices give pairs back */
+
+static atomic_t dict_shrink_next;
+
+/*
+ * Entries too large for size classes, waiting to be freed by dict_free_work
+ * in process context instead of RCU callback
+ */
+
+static LLIST_HEAD(dict_free_list);
+static DECLARE_WORK(dict_free_work, dict_free_work_fn);
+
+/* Releases tables detached by FLUSH, drained on exit */
+
+static struct workqueue_struct *dict_flush_wq;
+
+/* Secret key of dict_hash, generated at module load */
+
+static siphash_key_t dict_hash_key;
+
+/* Root of debugfs statistics */
+
+static struct dentry *dict_debugfs;
+
+/* Table engines, picked by name at load time */
+
+static const dict_engine dict_chain_engine = {
+	.name = "chain",
+	.init = dict_chain_init,
+	.destroy = dict_chain_destroy,
+	.insert = dict_chain_insert,
+	.lookup = dict_chain_lookup,
+	.remove = dict_chain_remove,
+	.shrink = dict_chain_shrink,
+	.scan = dict_chain_scan,
+	.reserve = dict_chain_reserve,
+	.detach = dict_chain_detach,
+	.retire = dict_chain_retire,
+	.release = dict_chain_release,
+};
+
+static const dict_engine dict_oa_engine = {
+	.name = "open",
+	.init = dict_oa_init,
+	.destroy = dict_oa_destroy,
+	.insert = dict_oa_insert,
+	.lookup = dict_oa_lookup,
+	.remove = dict_oa_remove,
+	.shrink = dict_oa_shrink,
+	.scan = dict_oa_scan,
+	.reserve = dict_oa_reserve,
+	.detach = dict_oa_detach,
+	.retire = dict_oa_retire,
+	.release = dict_oa_release,
+};
+
+static const dict_engine *dict_engines[] = {
+	&dict_chain_engine,
+	&dict_oa_engine,
+};
+
+static char *engine = "chain";
+module_param(engine, charp, 0444);
+MODULE_PARM_DESC(engine, "Table engine: chain (separate chaining, default) or open (open addressing)");
+
+/* Number of shards, each has its own lock and table; 0 means one per online CPU */
+
+static unsigned int num_shards;
+module_param(num_shards, uint, 0444);
+MODULE_PARM_DESC(num_shards, "Number of independently locked sub-tables (default: number of online CPUs)");
+
+/* Number of device nodes, dict_device0 and up, each has its own dictionary */
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of /dev/dict_deviceN nodes, each with isolated dictionary (default: 1)");
+
+/* sysfs attributes of every device node - quotas and what its pairs take */
+
+static DEVICE_ATTR_RW(quota_bytes);
+static DEVICE_ATTR_RW(quota_entries);
+static DEVICE_ATTR_RO(bytes);
+static DEVICE_ATTR_RO(entries);
+
+static struct attribute *dict_dev_attrs[] = {
+	&dev_attr_quota_bytes.attr,
+	&dev_attr_quota_entries.attr,
+	&dev_attr_bytes.attr,
+	&dev_attr_entries.attr,
+	NULL,
 };
 
+ATTRIBUTE_GROUPS(dict_dev);
+
+/* Budget for bytes of pairs, SET evicts by CLOCK above it; 0 - no budget, no eviction */
+
+static unsigned long max_bytes;
+module_param(max_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_bytes, "Bytes of keys, values and entry headers kept before evicting (default: 0, unlimited)");
+
+/*
+ *
+ *                                  ENTRY CACHES
+ *
+ */
+
+
+/** @brief Create one kmem_cache per entry size class, DICT_MIN_CLASS_SIZE and up
+ *  doubling; entries larger than biggest class go to kvmalloc
+ *  @return 0 on success, -ENOMEM if any cache was not created
+ */
+static int dict_caches_create(void)
+{
+	int i;
+	dict_size_class *sc;
+
+	for (i = 0; i < DICT_NUM_SIZE_CLASSES; i++) {
+		sc = &dict_size_classes[i];
+		sc->size = DICT_MIN_CLASS_SIZE << i;
+		snprintf(sc->name, sizeof(sc->name), "dict_entry_%u", sc->size);
+		sc->cache = kmem_cache_create(sc->name, sc->size, 0, SLAB_HWCACHE_ALIGN | SLAB_ACCOUNT, NULL);
+
+		if (sc->cache == NULL) {
+			dict_caches_destroy();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @brief Destroy all entry caches; all entries must be freed by then
+ */
+static void dict_caches_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < DICT_NUM_SIZE_CLASSES; i++) {
+		kmem_cache_destroy(dict_size_classes[i].cache);
+		dict_size_classes[i].cache = NULL;
+	}
+}
+
+
+/** @brief Pick size class for entry of given total size
+ *  @param size Entry header plus key and value size
+ *  @return Index in dict_size_classes, DICT_NUM_SIZE_CLASSES if it does not fit any
+ */
+static int dict_size_class_of(size_t size)
+{
+	int i;
+
+	if (size <= DICT_MIN_CLASS_SIZE) {
+		return 0;
+	}
+
+	i = fls64(size - 1) - ilog2(DICT_MIN_CLASS_SIZE);
+
+	return min(i, DICT_NUM_SIZE_CLASSES);
+}
+
+
+/** @brief debugfs "slabs" file - objects in use and memory held per size class
+ *  @param m seq_file to print into
+ *  @return 0
+ */
+static int dict_slabs_show(struct seq_file *m, void *unused)
+{
+	int i;
+	long in_use;
+	dict_size_class *sc;
+
+	seq_printf(m, "%-20s %12s %14s\n", "class", "objects", "bytes");
+
+	for (i = 0; i < DICT_NUM_SIZE_CLASSES; i++) {
+		sc = &dict_size_classes[i];
+		in_use = atomic_long_read(&sc->in_use);
+		seq_printf(m, "%-20s %12ld %14ld\n", sc->name, in_use, in_use * sc->size);
+	}
+
+	seq_printf(m, "%-20s %12ld %14ld\n", "kvmalloc",
+		   atomic_long_read(&dict_large_entries), atomic_long_read(&dict_large_bytes));
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(dict_slabs);
 
-/* Pointer for dict shared object for whole driver */
 
-dict *pd_ptr;
+/** @brief debugfs "expiry" file - entries waiting to expire, entries reclaimed
+ *  by expiry work and time it spent
+ *  @param m seq_file to print into
+ *  @return 0
+ */
+static int dict_expiry_show(struct seq_file *m, void *unused)
+{
+	unsigned int s;
+	unsigned long expiring = 0;
+	dict *pd = m->private;
+
+	for (s = 0; s < pd->num_shards; s++) {
+		expiring += READ_ONCE(pd->shards[s].num_expiring);
+	}
+
+	seq_printf(m, "%-12s %lu\n", "expiring", expiring);
+	seq_printf(m, "%-12s %ld\n", "expired", atomic_long_read(&dict_expired_entries));
+	seq_printf(m, "%-12s %lld\n", "sweep_ns", (long long)atomic64_read(&dict_expire_ns));
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(dict_expiry);
+
+
+/** @brief debugfs "cache" file - bytes held against the budget, lookup hit
+ *  ratio and pairs evicted by SET and given back to the shrinker
+ *  @param m seq_file to print into
+ *  @return 0
+ */
+static int dict_cache_show(struct seq_file *m, void *unused)
+{
+	int cpu;
+	unsigned long hits = 0;
+	unsigned long misses = 0;
+	unsigned long ratio;
+	dict_cache_stats *stats;
+	dict *pd = m->private;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(pd->stats, cpu);
+		hits += READ_ONCE(stats->hits);
+		misses += READ_ONCE(stats->misses);
+	}
+
+	/* hundredths of a percent */
+	ratio = hits + misses != 0 ? div64_u64((u64)hits * 10000, hits + misses) : 0;
+
+	seq_printf(m, "%-12s %ld\n", "bytes", atomic_long_read(&pd->bytes));
+	seq_printf(m, "%-12s %lu\n", "max_bytes", READ_ONCE(max_bytes));
+	seq_printf(m, "%-12s %lu\n", "hits", hits);
+	seq_printf(m, "%-12s %lu\n", "misses", misses);
+	seq_printf(m, "%-12s %lu.%02lu\n", "hit_ratio", ratio / 100, ratio % 100);
+	seq_printf(m, "%-12s %ld\n", "evicted", atomic_long_read(&pd->evicted));
+	seq_printf(m, "%-12s %ld\n", "reclaimed", atomic_long_read(&pd->reclaimed));
 
-/* Mutex struct */
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(dict_cache);
 
-struct mutex dict_mutex;
 
 /*
  *
@@ -79,14 +664,18 @@ struct mutex dict_mutex;
 static long dict_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	void *key;
-	void *value;
 	long retval;
-	dict_pair *msg_dict;
-	dict_pair *found_pair;
-
-	msg_dict = kzalloc(sizeof(dict_pair), GFP_KERNEL);
-
-	mutex_lock(&dict_mutex);
+	s64 counter;
+	size_t value_size;
+	dict_pair_ttl msg = { };
+	dict_pair *msg_dict = &msg.pair;
+	dict_entry *found_pair;
+	dict_entry *new_entry;
+	dict_ring *ring;
+	dict *pd = ((dict_file *)file->private_data)->pd;
+	unsigned char key_buf[DICT_STACK_KEY_SIZE];
+
+	/* message header and short keys stay on stack, nothing to allocate and free */
 
 	switch (cmd) {
 	/*
@@ -95,13 +684,18 @@ static long dict_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	 * copy from user, then set values to dict via dict_set; types and sizes
 	 * should be sanitized in userspace part of IOCTL;
 	 *
-	 * Returns 0 if nothing failed, otherwise -EFAULT;
+	 * SET_PAIR_TTL ioctl call - the same with pair followed by its time to
+	 * live, so SET_PAIR message keeps its layout;
+	 *
+	 * Returns 0 if nothing failed, EDQUOT if pair does not fit quotas of
+	 * the device, otherwise -EFAULT;
 	 */
+	case SET_PAIR_TTL:
 	case SET_PAIR:
 
 		pr_debug("SET_PAIR: start");
 
-		if (copy_from_user(msg_dict, (dict_pair *)arg, sizeof(dict_pair))) {
+		if (copy_from_user(&msg, (dict_pair_ttl *)arg, cmd == SET_PAIR_TTL ? sizeof(dict_pair_ttl) : sizeof(dict_pair))) {
 			pr_err("SET_PAIR: cannot get msg from user");
 			retval = EFAULT;
 			goto set_exit;
@@ -114,41 +708,25 @@ static long dict_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 
 		if (msg_dict->key_size == 0 || msg_dict->value_size == 0
+			|| !dict_pair_size_ok(msg_dict->key_size, msg_dict->value_size)
 			|| msg_dict->key_type < 0 || msg_dict->value_type < 0) {
 			pr_err("SET_PAIR: illegal size");
 			retval = EINVAL;
 			goto set_exit;
 		}
 
-		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
-		value = kmalloc(msg_dict->value_size, GFP_KERNEL);
-
-		if (key == NULL || value == NULL) {
-			pr_err("SET_PAIR: kmalloc failed");
-			retval = ENOMEM;
-			goto set_exit;
-		}
+		/* user data is copied straight into the entry that goes into the table */
 
-		if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
-			pr_err("SET_PAIR: cannot get key from user");
-			retval = EFAULT;
-			goto set_exit_full;
-		}
+		retval = dict_entry_from_user(msg_dict, msg.ttl_ms, &new_entry);
 
-		if (copy_from_user(value, msg_dict->value, msg_dict->value_size)) {
-			pr_err("SET_PAIR: cannot value key from user");
-			retval = EFAULT;
-			goto set_exit_full;
+		if (retval != 0) {
+			pr_err("SET_PAIR: cannot get pair from user");
+			goto set_exit;
 		}
 
-		retval = dict_set(pd_ptr, key, value, msg_dict);
+		retval = dict_set_entry(pd, new_entry);
 
-set_exit_full:
-		kfree(key);
-		kfree(value);
 set_exit:
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
 		return retval;
 
 	/*
@@ -176,21 +754,25 @@ set_exit:
 			goto get_exit;
 		}
 
-		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
+		key = dict_key_from_user(msg_dict, key_buf);
 
-		if (key == NULL) {
-			pr_err("GET_VALUE: kmalloc failed");
-			retval = ENOMEM;
+		if (IS_ERR(key)) {
+			pr_err("GET_VALUE: cannot get key from user");
+			retval = -PTR_ERR(key);
 			goto get_exit;
 		}
 
-		if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
-			pr_err("GET_VALUE: cannot get key");
-			retval = EFAULT;
-			goto get_exit_full;
+		/*
+		 * copy_to_user() may sleep, so pin the entry before leaving
+		 * the RCU read-side section; a failed pin means it is being
+		 * deleted right now
+		 */
+		rcu_read_lock();
+		found_pair = dict_get(pd, key, msg_dict->key_size);
+		if (found_pair != NULL && !refcount_inc_not_zero(&found_pair->refs)) {
+			found_pair = NULL;
 		}
-
-		found_pair = dict_get(pd_ptr, key, msg_dict->key_size);
+		rcu_read_unlock();
 
 		if (found_pair == NULL) {
 			pr_info("GET_VALUE: no such pair");
@@ -198,19 +780,67 @@ set_exit:
 			goto get_exit_full;
 		}
 
-		if (copy_to_user(msg_dict->value, found_pair->value, found_pair->value_size)) {
+		if (copy_to_user(msg_dict->value, dict_entry_value_out(found_pair, &counter), found_pair->value_size)) {
 			pr_err("GET_VALUE: cannot sent value to user");
 			retval = EFAULT;
-			goto get_exit_full;
+			goto get_exit_put;
 		}
 
 		retval = 0;
 
+get_exit_put:
+		dict_entry_put(found_pair);
 get_exit_full:
-		kfree(key);
+		dict_key_free(key, key_buf);
 get_exit:
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
+		return retval;
+
+	/*
+	 * GET_PAIR ioctl call - get structure from user that contains key's
+	 * type and size, and value buffer with its capacity in value_size;
+	 * search for pair, write its value size and type back into user's
+	 * structure and copy value to the buffer, all from the same entry, so
+	 * they always match even if pair is overwritten concurrently;
+	 *
+	 * Returns 0 if nothing failed, ENOENT if pair does not exist, ERANGE
+	 * if buffer is too small (value_size then holds required size), and
+	 * EFAULT if memory errors
+	 */
+	case GET_PAIR:
+
+		pr_debug("GET_PAIR: start");
+
+		if (copy_from_user(msg_dict, (dict_pair *)arg, sizeof(dict_pair))) {
+			pr_err("GET_PAIR: cannot get from user");
+			retval = EFAULT;
+			goto get_pair_exit;
+		}
+
+		if (msg_dict->key == NULL || msg_dict->key_size == 0) {
+			pr_err("GET_PAIR: NULL as key or zero key size");
+			retval = EINVAL;
+			goto get_pair_exit;
+		}
+
+		key = dict_key_from_user(msg_dict, key_buf);
+
+		if (IS_ERR(key)) {
+			pr_err("GET_PAIR: cannot get key from user");
+			retval = -PTR_ERR(key);
+			goto get_pair_exit;
+		}
+
+		retval = dict_get_pair(pd, key, msg_dict, NULL);
+
+		if ((retval == 0 || retval == ERANGE)
+			&& (put_user(msg_dict->value_size, &((dict_pair *)arg)->value_size)
+			|| put_user(msg_dict->value_type, &((dict_pair *)arg)->value_type))) {
+			pr_err("GET_PAIR: cannot sent size and type to user");
+			retval = EFAULT;
+		}
+
+		dict_key_free(key, key_buf);
+get_pair_exit:
 		return retval;
 
    /* GET_VALUE_SIZE ioctl call - get structure from user that contains key's
@@ -240,21 +870,20 @@ get_exit:
 			goto get_size_exit;
 		}
 
-		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
+		key = dict_key_from_user(msg_dict, key_buf);
 
-		if (key == NULL) {
-			pr_err("GET_VALUE_SIZE: kmalloc failed");
-			retval = ENOMEM;
+		if (IS_ERR(key)) {
+			pr_err("GET_VALUE_SIZE: cannot get key from user");
+			retval = -PTR_ERR(key);
 			goto get_size_exit;
 		}
 
-		if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
-			pr_err("GET_VALUE_SIZE: cannot get key from user");
-			retval = EFAULT;
-			goto get_size_exit_full;
+		rcu_read_lock();
+		found_pair = dict_get(pd, key, msg_dict->key_size);
+		if (found_pair != NULL) {
+			value_size = found_pair->value_size;
 		}
-
-		found_pair = dict_get(pd_ptr, key, msg_dict->key_size);
+		rcu_read_unlock();
 
 		if (found_pair == NULL) {
 			pr_err("GET_VALUE_SIZE: no such pair");
@@ -262,7 +891,7 @@ get_exit:
 			goto get_size_exit_full;
 		}
 		
-		if (copy_to_user(msg_dict->value_size_adress, &found_pair->value_size, sizeof(size_t))) {
+		if (copy_to_user(msg_dict->value_size_adress, &value_size, sizeof(size_t))) {
 			pr_err("GET_VALUE_SIZE: cannot get key from user");
 			retval = EFAULT;
 			goto get_size_exit_full;
@@ -271,10 +900,8 @@ get_exit:
 		retval = 0;
 
 get_size_exit_full:
-		kfree(key);
+		dict_key_free(key, key_buf);
 get_size_exit:
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
 		return retval;
 
    /*
@@ -300,35 +927,25 @@ get_size_exit:
 			goto get_type_exit;
 		}
 
-		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
-
-		if (key == NULL) {
-			pr_err("GET_VALUE_TYPE: kmalloc failed");
-			retval = ENOMEM;
-			goto get_type_exit;
-		}
+		key = dict_key_from_user(msg_dict, key_buf);
 
-		if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
+		if (IS_ERR(key)) {
 			pr_err("GET_VALUE_TYPE: cannot get key from user");
-			retval = EFAULT;
-			goto get_type_exit_full;
+			retval = -PTR_ERR(key);
+			goto get_type_exit;
 		}
 
-		found_pair = dict_get(pd_ptr, key, msg_dict->key_size);
+		rcu_read_lock();
+		found_pair = dict_get(pd, key, msg_dict->key_size);
+		retval = found_pair ? found_pair->value_type : ENOENT;
+		rcu_read_unlock();
 
 		if (found_pair == NULL) {
 			pr_err("GET_VALUE_TYPE: no such pair");
-			retval = ENOENT;
-			goto get_type_exit_full;
 		}
 
-		retval = found_pair->value_type;
-
-get_type_exit_full:
-		kfree(key);
+		dict_key_free(key, key_buf);
 get_type_exit:
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
 		return retval;
 
    /*
@@ -354,394 +971,5157 @@ get_type_exit:
 			goto del_pair_exit;
 		}
 
-		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
+		key = dict_key_from_user(msg_dict, key_buf);
 
-		if (key == NULL) {
-			pr_err("GET_VALUE_TYPE: kmalloc failed");
-			retval = ENOMEM;
+		if (IS_ERR(key)) {
+			pr_err("DEL_PAIR: cannot get key from user");
+			retval = -PTR_ERR(key);
 			goto del_pair_exit;
 		}
 
-		if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
-			pr_err("DEL_PAIR : cannot get key from user");
-			retval = EFAULT;
-			goto del_pair_exit_full;
-		}
-
-		dict_del(pd_ptr, key, msg_dict->key_size);
+		dict_del(pd, key, msg_dict->key_size);
 
 		retval = 0;
 
-del_pair_exit_full:
-		kfree(key);
+		dict_key_free(key, key_buf);
 del_pair_exit:
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
 		return retval;
 
-	default:
-		pr_err("Bad IOCTL command\n");
-		kfree(msg_dict);
-		mutex_unlock(&dict_mutex);
-		return EINVAL;
-	}
-
-	return 0;
-}
-
-/** @brief  Init driver function - get major/minor numbers, create device class,
- *  mount it and initilize dict shared structure that will be used for storage,
- *  called on using insmod
- *  @return 0 on success, -1 on others
- */
-static int __init dict_driver_init(void)
-{
+	/*
+	 * BATCH ioctl call - get structure from user that points to array of
+	 * operation descriptors, each SET, GET or DEL with pair laid out as for
+	 * SET_PAIR, GET_PAIR and DEL_PAIR; descriptors are copied in and back
+	 * DICT_BATCH_CHUNK at a time, each operation result is written to its
+	 * status field, and GET results to its pair as GET_PAIR does;
+	 *
+	 * BATCH_TTL ioctl call - the same with time to live of all its SETs
+	 * following the structure;
+	 *
+	 * Returns 0 if descriptors were processed (failed operations are
+	 * reported by status only), otherwise -EFAULT if memory errors
+	 */
+	case BATCH_TTL:
+	case BATCH:
 
-	if ((alloc_chrdev_region(&dev, 0, 1, "dict_Dev")) < 0) {
-		pr_err("DICT_INIT: cannot allocate major number\n");
-		return -1;
-	}
+		pr_debug("BATCH: start");
+		return dict_batch_run(pd, (dict_batch_ttl *)arg, cmd);
 
-	/* Dynamic major and minor number allocation */
+	/*
+	 * RING_SETUP ioctl call - get ring parameters from user, allocate
+	 * submission and completion rings with data area for this open file,
+	 * and copy their layout back, so user can mmap() it;
+	 *
+	 * RING_ENTER ioctl call - run submissions posted so far, or wake up
+	 * polling worker if ring was set up with DICT_RING_SQPOLL;
+	 *
+	 * Returns 0 if nothing failed, EBUSY if file already has a ring,
+	 * ENXIO if it has none for RING_ENTER, EINVAL if parameters are
+	 * out of range, otherwise -EFAULT if memory errors
+	 */
+	case RING_SETUP:
 
-	pr_info("DICT_INIT: Major = %d Minor = %d \n", MAJOR(dev), MINOR(dev));
-	cdev_init(&dict_cdev, &fops);
+		pr_debug("RING_SETUP: start");
+		return dict_ring_setup(file->private_data, pd, (dict_ring_params *)arg);
 
-	/* Adding device as character device */
+	case RING_ENTER:
 
-	if ((cdev_add(&dict_cdev, dev, 1)) < 0) {
-		pr_err("DICT_INIT: cannot add the device to the system\n");
-		goto r_class;
-	}
 
-	/* Creating device class */
+		ring = READ_ONCE(((dict_file *)file->private_data)->ring);
 
-	if (IS_ERR(dev_class = class_create(THIS_MODULE, "dict_class"))) {
-		pr_err("DICT_INIT: cannot create the struct class\n");
-		goto r_class;
-	}
+		if (ring == NULL) {
+			return ENXIO;
+		}
 
-	/* Creating device */
+		return dict_ring_enter(ring);
 
-	if (IS_ERR(device_create(dev_class, NULL, dev, NULL, "dict_device"))) {
-		pr_err("DICT_INIT: cannot create the device\n");
-		goto r_device;
-	}
+	/*
+	 * SCAN ioctl call - get cursor, buffer and budgets from user, visit
+	 * table from the cursor on, one bucket at a time under shard lock,
+	 * and write (key, type, size, optional value) records of every
+	 * visited bucket into the buffer; next cursor, number of records and
+	 * bytes used are copied back, cursor 0 means scan is complete;
+	 *
+	 * Returns 0 if nothing failed, ERANGE if buffer cannot hold even one
+	 * bucket, EINVAL if cursor is invalid, otherwise -EFAULT or ENOMEM
+	 */
+	case SCAN:
 
-	pr_info("DICT_INIT: device driver inserted\n");
+		pr_debug("SCAN: start");
+		return dict_scan_run(pd, (dict_scan *)arg);
 
-	/* Initilizing dict */
+	/*
+	 * SNAPSHOT_SAVE ioctl call - get file descriptor from user and write
+	 * snapshot of all pairs to it from its current position;
+	 *
+	 * SNAPSHOT_LOAD ioctl call - get file descriptor from user, read
+	 * snapshot from it and set all pairs, sizing tables for them first;
+	 *
+	 * Number of pairs and bytes of stream are copied back. Returns 0 if
+	 * nothing failed, EINVAL if stream is not a valid snapshot, EIO if it
+	 * is truncated, EBADF for bad descriptor, otherwise -EFAULT or ENOMEM
+	 */
+	case SNAPSHOT_SAVE:
+
+		pr_debug("SNAPSHOT_SAVE: start");
+		return dict_snapshot_save(pd, (dict_snapshot *)arg);
+
+	case SNAPSHOT_LOAD:
+
+		pr_debug("SNAPSHOT_LOAD: start");
+		return dict_snapshot_load(pd, (dict_snapshot *)arg);
+
+	/*
+	 * UPDATE ioctl call - get structure from user with operation and pair,
+	 * read current pair and write the new one under the same shard lock,
+	 * so INCR, CAS, SET_IF_ABSENT and APPEND need no retry loop around
+	 * GET and SET in userspace; INCR result, value size and type and
+	 * version of the pair are copied back;
+	 *
+	 * Returns 0 if nothing failed, ENOENT if pair does not exist, EEXIST
+	 * if SET_IF_ABSENT found it, ECANCELED if CAS did not match, EINVAL if
+	 * request is bad or value is not INT of 4 or 8 bytes for INCR, ERANGE
+	 * if INCR overflows, otherwise -EFAULT or ENOMEM
+	 */
+	case UPDATE:
+
+		pr_debug("UPDATE: start");
+		return dict_update_run(pd, (dict_update *)arg);
+
+	/*
+	 * FLUSH ioctl call - swap empty table into every shard and release old
+	 * ones with their pairs in background, so the call takes about as long
+	 * for a million pairs as for ten; number of pairs flushed is copied
+	 * back unless pointer is NULL;
+	 *
+	 * Returns 0 if nothing failed, otherwise EFAULT or ENOMEM (shards
+	 * flushed before the failure stay empty)
+	 */
+	case FLUSH:
+
+		pr_debug("FLUSH: start");
+		return dict_flush_run(pd, (u64 *)arg);
+
+	/*
+	 * DEL_BY_TYPE ioctl call - get key and value type from user, 0 for
+	 * any, and delete every pair that matches both, walking each shard a
+	 * few positions per lock hold; number of pairs deleted is copied back;
+	 *
+	 * Returns 0 if nothing failed, EINVAL if both types are 0, otherwise
+	 * EFAULT or ENOMEM
+	 */
+	case DEL_BY_TYPE:
+
+		pr_debug("DEL_BY_TYPE: start");
+		return dict_del_by_type_run(pd, (dict_del_by_type *)arg);
+
+	default:
+		pr_err("Bad IOCTL command\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
+/** @brief Find pair and copy its value to user buffer, taking size, type,
+ *  version and value from the same entry
+ *  @param pd Pointer to a shared dictionary object
+ *  @param key Key copied from user
+ *  @param msg_dict Message with key size, user buffer and its capacity in
+ *  value_size; value_size and value_type are overwritten with the pair's ones
+ *  @param version Set to version of the pair if not NULL
+ *  @return 0 on success, ENOENT if there is no such pair, ERANGE if buffer is
+ *  too small, EFAULT if value cannot be copied
+ */
+static long dict_get_pair(dict *pd, const void *key, dict_pair *msg_dict, u64 *version)
+{
+	long retval;
+	s64 counter;
+	size_t capacity = msg_dict->value_size;
+	dict_entry *found_pair;
+
+	/*
+	 * copy_to_user() may sleep, so pin the entry before leaving the RCU
+	 * read-side section; a failed pin means it is being deleted right now
+	 */
+	rcu_read_lock();
+	found_pair = dict_get(pd, key, msg_dict->key_size);
+	if (found_pair != NULL && !refcount_inc_not_zero(&found_pair->refs)) {
+		found_pair = NULL;
+	}
+	rcu_read_unlock();
+
+	if (found_pair == NULL) {
+		return ENOENT;
+	}
+
+	msg_dict->value_size = found_pair->value_size;
+	msg_dict->value_type = found_pair->value_type;
+
+	if (version != NULL) {
+		*version = found_pair->version;
+	}
+
+	if (msg_dict->value_size > capacity) {
+		retval = ERANGE;
+	} else if (copy_to_user(msg_dict->value, dict_entry_value_out(found_pair, &counter), msg_dict->value_size)) {
+		retval = EFAULT;
+	} else {
+		retval = 0;
+	}
+
+	dict_entry_put(found_pair);
+	return retval;
+}
+
+
+/** @brief Copy key of the message from user, onto caller's stack buffer if it
+ *  fits DICT_STACK_KEY_SIZE, else into heap
+ *  @param msg_dict Message with key and its size
+ *  @param stack_buf Caller's buffer of DICT_STACK_KEY_SIZE bytes
+ *  @return Key copy, release with dict_key_free(); ERR_PTR on failure
+ */
+static void *dict_key_from_user(dict_pair *msg_dict, void *stack_buf)
+{
+	void *key = stack_buf;
+
+	if (msg_dict->key_size > DICT_STACK_KEY_SIZE) {
+		key = kmalloc(msg_dict->key_size, GFP_KERNEL);
+
+		if (key == NULL) {
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+
+	if (copy_from_user(key, msg_dict->key, msg_dict->key_size)) {
+		dict_key_free(key, stack_buf);
+		return ERR_PTR(-EFAULT);
+	}
+
+	return key;
+}
+
+
+/** @brief Release key copy made by dict_key_from_user()
+ *  @param key Key copy
+ *  @param stack_buf Caller's buffer the copy was made with
+ */
+static void dict_key_free(void *key, void *stack_buf)
+{
+	if (key != stack_buf) {
+		kfree(key);
+	}
+}
+
+
+/** @brief Build table entry from SET message, copying key and value from user
+ *  straight into entry storage, so there are no intermediate buffers; key is
+ *  hashed from its copy, user cannot change it after that
+ *  @param msg_dict Checked message with key, value, their sizes and types
+ *  @param ttl_ms Pair expires this many ms from now, 0 - never
+ *  @param entry Set to new entry, that is not linked anywhere yet, on success
+ *  @return 0 on success, ENOMEM or EFAULT otherwise
+ */
+static int dict_entry_from_user(dict_pair *msg_dict, u32 ttl_ms, dict_entry **entry)
+{
+	dict_entry *new_entry;
+
+	new_entry = dict_entry_alloc(msg_dict->key_size, msg_dict->value_size);
+
+	if (new_entry == NULL) {
+		return ENOMEM;
+	}
+
+	if (copy_from_user(dict_entry_key(new_entry), msg_dict->key, msg_dict->key_size)
+		|| copy_from_user(dict_entry_value(new_entry), msg_dict->value, msg_dict->value_size)) {
+		dict_entry_free(new_entry);
+		return EFAULT;
+	}
+
+	new_entry->key_hash     = dict_hash(dict_entry_key(new_entry), new_entry->key_size);
+	new_entry->key_type     = msg_dict->key_type;
+	new_entry->value_type   = msg_dict->value_type;
+
+	if (ttl_ms != 0) {
+		new_entry->expires = get_jiffies_64() + msecs_to_jiffies(ttl_ms);
+	}
+
+	*entry = new_entry;
+	return 0;
+}
+
+
+/** @brief Run BATCH request, copying descriptors in and results back
+ *  DICT_BATCH_CHUNK at a time, so any number of operations needs bounded memory
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_batch User structure pointing to array of descriptors, with
+ *  time to live of SETs after it for BATCH_TTL
+ *  @param cmd BATCH or BATCH_TTL
+ *  @return 0 if all descriptors were processed, ENOMEM or EFAULT otherwise
+ */
+static long dict_batch_run(dict *pd, dict_batch_ttl *user_batch, unsigned int cmd)
+{
+	long retval = 0;
+	size_t i;
+	size_t done;
+	size_t chunk;
+	dict_batch_ttl req = { };
+	dict_batch *batch = &req.batch;
+	dict_batch_op *ops;
+
+	if (copy_from_user(&req, user_batch, cmd == BATCH_TTL ? sizeof(dict_batch_ttl) : sizeof(dict_batch))) {
+		pr_err("BATCH: cannot get msg from user");
+		return EFAULT;
+	}
+
+	ops = kmalloc_array(DICT_BATCH_CHUNK, sizeof(dict_batch_op), GFP_KERNEL);
+
+	if (ops == NULL) {
+		pr_err("BATCH: kmalloc failed");
+		return ENOMEM;
+	}
+
+	for (done = 0; done < batch->num_ops; done += chunk) {
+		chunk = min_t(size_t, batch->num_ops - done, DICT_BATCH_CHUNK);
+
+		if (copy_from_user(ops, batch->ops + done, chunk * sizeof(dict_batch_op))) {
+			pr_err("BATCH: cannot get descriptors from user");
+			retval = EFAULT;
+			break;
+		}
+
+		for (i = 0; i < chunk; i++) {
+			ops[i].status = dict_batch_exec(pd, &ops[i], req.ttl_ms);
+		}
+
+		if (copy_to_user(batch->ops + done, ops, chunk * sizeof(dict_batch_op))) {
+			pr_err("BATCH: cannot sent results to user");
+			retval = EFAULT;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	kfree(ops);
+	return retval;
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+
+/** @brief io_uring passthrough - run IORING_OP_URING_CMD with cmd_op set to
+ *  SET_PAIR, SET_PAIR_TTL, GET_VALUE, GET_PAIR or DEL_PAIR and SQE payload
+ *  holding pointer to user message, exactly as dict_ioctl() would run the same
+ *  command; writers take shard mutex and allocate, so on non-blocking issue
+ *  they are handed to io_uring worker with -EAGAIN; lookups complete inline
+ *  unless key is too long for the stack buffer or user memory is not resident,
+ *  as they must neither allocate nor fault pages in on that issue
+ *  @param ioucmd Command, cmd_op and payload come from user SQE
+ *  @param issue_flags IO_URING_F_* flags of this issue attempt
+ *  @return 0 or negative error code, posted as CQE result
+ */
+static int dict_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	u64 user_pair;
+	dict_pair msg;
+	const dict_uring_cmd_payload *payload;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	payload = io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	payload = ioucmd->cmd;
+#endif
+	user_pair = READ_ONCE(payload->pair);
+
+	switch (ioucmd->cmd_op) {
+	case SET_PAIR:
+	case SET_PAIR_TTL:
+	case DEL_PAIR:
+		if (issue_flags & IO_URING_F_NONBLOCK) {
+			return -EAGAIN;
+		}
+		break;
+
+	case GET_VALUE:
+	case GET_PAIR:
+		if (!(issue_flags & IO_URING_F_NONBLOCK)) {
+			break;
+		}
+
+		/* key that does not fit the stack would be copied into heap */
+		if (copy_from_user_nofault(&msg, u64_to_user_ptr(user_pair), sizeof(dict_pair))
+			|| msg.key_size > DICT_STACK_KEY_SIZE) {
+			return -EAGAIN;
+		}
+
+		/* lookup goes on the copy checked here, user cannot grow key_size under it */
+		return -dict_uring_get_nowait(((dict_file *)ioucmd->file->private_data)->pd,
+					      u64_to_user_ptr(user_pair), &msg, ioucmd->cmd_op);
+
+	default:
+		return -EINVAL;
+	}
+
+	return -dict_ioctl(ioucmd->file, ioucmd->cmd_op, (unsigned long)user_pair);
+}
+
+
+/** @brief Run GET_VALUE or GET_PAIR on non-blocking issue, as dict_ioctl()
+ *  would, but on message already copied and checked by the caller, with key
+ *  on stack and page faults disabled, so nothing allocates or sleeps
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_pair User message, GET_PAIR writes value size and type back
+ *  @param msg_dict Copy of user message, key_size at most DICT_STACK_KEY_SIZE
+ *  @param cmd GET_VALUE or GET_PAIR
+ *  @return 0 on success, positive error code as dict_ioctl() would return, or
+ *  EAGAIN if user memory is not resident and worker has to retry
+ */
+static long dict_uring_get_nowait(dict *pd, dict_pair __user *user_pair, dict_pair *msg_dict, unsigned int cmd)
+{
+	long retval;
+	unsigned char key_buf[DICT_STACK_KEY_SIZE];
+
+	if (msg_dict->key == NULL || msg_dict->key_size == 0) {
+		return EINVAL;
+	}
+
+	if (copy_from_user_nofault(key_buf, msg_dict->key, msg_dict->key_size)) {
+		return EAGAIN;
+	}
+
+	/* GET_VALUE copies whole value, whatever capacity user passed */
+	if (cmd == GET_VALUE) {
+		msg_dict->value_size = SIZE_MAX;
+	}
+
+	/* fault fails the copy instead, worker retries lookup with faults allowed */
+	pagefault_disable();
+
+	retval = dict_get_pair(pd, key_buf, msg_dict, NULL);
+
+	if (cmd == GET_PAIR && (retval == 0 || retval == ERANGE)
+		&& (put_user(msg_dict->value_size, &user_pair->value_size)
+		|| put_user(msg_dict->value_type, &user_pair->value_type))) {
+		retval = EFAULT;
+	}
+
+	pagefault_enable();
+
+	return retval == EFAULT ? EAGAIN : retval;
+}
+
+#endif
+
+
+/** @brief Execute one operation of BATCH request, with same checks as its
+ *  single-pair IOCTL
+ *  @param pd Pointer to a shared dictionary object
+ *  @param op Descriptor copied from user, GET results are written to op->pair
+ *  @param ttl_ms Time to live of SET, 0 - never expires
+ *  @return 0 on success, otherwise positive error code as single IOCTL would return
+ */
+static long dict_batch_exec(dict *pd, dict_batch_op *op, u32 ttl_ms)
+{
+	long retval;
+	void *key;
+	dict_pair *msg_dict = &op->pair;
+	dict_entry *new_entry;
+	unsigned char key_buf[DICT_STACK_KEY_SIZE];
+
+	if (op->op != DICT_OP_SET && op->op != DICT_OP_GET && op->op != DICT_OP_DEL) {
+		return EINVAL;
+	}
+
+	if (msg_dict->key == NULL || msg_dict->key_size == 0 || msg_dict->key_size > DICT_MAX_SIZE) {
+		return EINVAL;
+	}
+
+	if (op->op == DICT_OP_SET && (msg_dict->value == NULL || msg_dict->value_size == 0
+		|| !dict_pair_size_ok(msg_dict->key_size, msg_dict->value_size)
+		|| msg_dict->key_type < 0 || msg_dict->value_type < 0)) {
+		return EINVAL;
+	}
+
+	if (op->op == DICT_OP_SET) {
+		retval = dict_entry_from_user(msg_dict, ttl_ms, &new_entry);
+		return retval != 0 ? retval : dict_set_entry(pd, new_entry);
+	}
+
+	key = dict_key_from_user(msg_dict, key_buf);
+
+	if (IS_ERR(key)) {
+		return -PTR_ERR(key);
+	}
+
+	if (op->op == DICT_OP_GET) {
+		retval = dict_get_pair(pd, key, msg_dict, NULL);
+	} else {
+		dict_del(pd, key, msg_dict->key_size);
+		retval = 0;
+	}
+
+	dict_key_free(key, key_buf);
+	return retval;
+}
+
+
+/** @brief Run UPDATE request; GET reads value with version, other ops build
+ *  new entry outside of lock and commit it with dict_update_entry(), which
+ *  lets dict_update_prepare() check current pair under shard lock; entry
+ *  built for value size that changed meanwhile is built again
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_update User request, result fields are copied back to it
+ *  @return 0 on success, ENOENT, EEXIST, ECANCELED, ERANGE as described for
+ *  UPDATE, EINVAL if request is bad, ENOMEM or EFAULT otherwise
+ */
+static long dict_update_run(dict *pd, dict_update *user_update)
+{
+	long retval;
+	dict_update_ctx ctx = { };
+	dict_pair *msg_dict = &ctx.req.pair;
+	dict_entry *found_pair;
+	dict_entry *new_entry;
+	unsigned char key_buf[DICT_STACK_KEY_SIZE];
+
+	if (copy_from_user(&ctx.req, user_update, sizeof(dict_update))) {
+		pr_err("UPDATE: cannot get msg from user");
+		return EFAULT;
+	}
+
+	if (ctx.req.op < DICT_UPDATE_GET || ctx.req.op > DICT_UPDATE_APPEND) {
+		return EINVAL;
+	}
+
+	if (msg_dict->key == NULL || msg_dict->key_size == 0 || msg_dict->key_size > DICT_MAX_SIZE
+		|| msg_dict->key_type < 0) {
+		return EINVAL;
+	}
+
+	/* GET and INCR take key only, the rest writes value from user */
+	if (ctx.req.op != DICT_UPDATE_GET && ctx.req.op != DICT_UPDATE_INCR
+		&& (msg_dict->value == NULL || msg_dict->value_size == 0
+		|| !dict_pair_size_ok(msg_dict->key_size, msg_dict->value_size) || msg_dict->value_type < 0)) {
+		return EINVAL;
+	}
+
+	/* counter slots cannot be appended to */
+	if (ctx.req.op == DICT_UPDATE_APPEND && msg_dict->value_type == DICT_TYPE_COUNTER) {
+		return EINVAL;
+	}
+
+	/* INCR creates INT pair whatever type was passed, entry is never built as COUNTER */
+	if (ctx.req.op == DICT_UPDATE_INCR) {
+		msg_dict->value_type = DICT_TYPE_INT;
+	}
+
+	if (ctx.req.op == DICT_UPDATE_CAS && ctx.req.expected != NULL
+		&& (ctx.req.expected_size == 0 || ctx.req.expected_size > DICT_MAX_SIZE)) {
+		return EINVAL;
+	}
+
+	ctx.key = dict_key_from_user(msg_dict, key_buf);
+
+	if (IS_ERR(ctx.key)) {
+		return -PTR_ERR(ctx.key);
+	}
+
+	ctx.key_hash = dict_hash(ctx.key, msg_dict->key_size);
+
+	switch (ctx.req.op) {
+	case DICT_UPDATE_GET:
+		retval = dict_get_pair(pd, ctx.key, msg_dict, &ctx.req.version);
+
+		/* no buffer asks for size, type and version only */
+		if (retval == ERANGE && msg_dict->value == NULL) {
+			retval = 0;
+		}
+
+		break;
+
+	case DICT_UPDATE_CAS:
+		if (ctx.req.expected != NULL) {
+			ctx.expected = kvmalloc(ctx.req.expected_size, GFP_KERNEL);
+
+			if (ctx.expected == NULL) {
+				retval = ENOMEM;
+				break;
+			}
+
+			if (copy_from_user(ctx.expected, ctx.req.expected, ctx.req.expected_size)) {
+				retval = EFAULT;
+				break;
+			}
+		}
+
+		fallthrough;
+
+	case DICT_UPDATE_SET_IF_ABSENT:
+		retval = dict_entry_from_user(msg_dict, 0, &new_entry);
+
+		if (retval == 0) {
+			retval = dict_update_entry(pd, new_entry, dict_update_prepare, &ctx);
+		}
+
+		break;
+
+	default:
+		do {
+			rcu_read_lock();
+			found_pair = dict_get(pd, ctx.key, msg_dict->key_size);
+
+			/*
+			 * counter takes increment into slot of this CPU, without lock and
+			 * without folding slots for the result, so delta is left as is
+			 */
+			if (ctx.req.op == DICT_UPDATE_INCR && found_pair != NULL && found_pair->counter != NULL) {
+				this_cpu_add(*found_pair->counter, ctx.req.delta);
+
+				/*
+				 * add either came before SET or DEL took the entry out, and
+				 * is overwritten as any earlier one, or is taken back and
+				 * done again on current pair, see dict_counter_retire()
+				 */
+				smp_mb();
+
+				if (READ_ONCE(found_pair->retired)) {
+					this_cpu_sub(*found_pair->counter, ctx.req.delta);
+					rcu_read_unlock();
+					retval = EAGAIN;
+					continue;
+				}
+
+				msg_dict->value_size = found_pair->value_size;
+				msg_dict->value_type = found_pair->value_type;
+				ctx.req.version = found_pair->version;
+				rcu_read_unlock();
+				retval = 0;
+				break;
+			}
+
+			/* size of current value is a guess, prepare tells if it changed */
+			ctx.old_size = found_pair ? found_pair->value_size : 0;
+			rcu_read_unlock();
+
+			retval = dict_update_build(&ctx, &new_entry);
+
+			if (retval == 0) {
+				retval = dict_update_entry(pd, new_entry, dict_update_prepare, &ctx);
+			}
+		} while (retval == EAGAIN);
+
+		break;
+	}
+
+	kvfree(ctx.expected);
+	dict_key_free(ctx.key, key_buf);
+
+	if (copy_to_user(user_update, &ctx.req, sizeof(dict_update))) {
+		pr_err("UPDATE: cannot sent results to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Build entry for INCR or APPEND from key copy, sized for pair whose
+ *  value has old_size bytes; APPEND bytes are copied from user to its end,
+ *  the rest is filled under lock by dict_update_prepare()
+ *  @param ctx Request context
+ *  @param entry Set to new entry, that is not linked anywhere yet, on success
+ *  @return 0 on success, EINVAL if value would be too long, ENOMEM or EFAULT
+ */
+static int dict_update_build(dict_update_ctx *ctx, dict_entry **entry)
+{
+	u64 value_size;
+	dict_pair *msg_dict = &ctx->req.pair;
+	dict_entry *new_entry;
+
+	if (ctx->req.op == DICT_UPDATE_INCR) {
+		value_size = ctx->old_size == sizeof(s32) ? sizeof(s32) : sizeof(s64);
+	} else {
+		value_size = (u64)ctx->old_size + msg_dict->value_size;
+	}
+
+	if (value_size > DICT_MAX_SIZE || !dict_pair_size_ok(msg_dict->key_size, value_size)) {
+		return EINVAL;
+	}
+
+	new_entry = dict_entry_alloc(msg_dict->key_size, value_size);
+
+	if (new_entry == NULL) {
+		return ENOMEM;
+	}
+
+	memcpy(dict_entry_key(new_entry), ctx->key, msg_dict->key_size);
+
+	if (ctx->req.op == DICT_UPDATE_APPEND
+		&& copy_from_user(dict_entry_value(new_entry) + ctx->old_size, msg_dict->value, msg_dict->value_size)) {
+		dict_entry_free(new_entry);
+		return EFAULT;
+	}
+
+	new_entry->key_hash     = ctx->key_hash;
+	new_entry->key_type     = msg_dict->key_type;
+	new_entry->value_type   = msg_dict->value_type;
+
+	*entry = new_entry;
+	return 0;
+}
+
+
+/** @brief Check current pair for UPDATE request and finish new entry from it;
+ *  called by dict_update_entry() under shard lock, new entry already has its
+ *  version; nothing here may sleep or touch user memory
+ *  @param old_entry Current entry of the key, NULL if pair does not exist
+ *  @param new_entry Entry that replaces it if 0 is returned
+ *  @param arg Request context, its results are filled in
+ *  @return 0 to commit, EAGAIN if new entry was built for other value size
+ *  (old_size is updated then), else error of the request
+ */
+static int dict_update_prepare(dict_entry *old_entry, dict_entry *new_entry, void *arg)
+{
+	s32 value32;
+	s64 value = 0;
+	s64 counter;
+	dict_update_ctx *ctx = arg;
+	u32 old_size = old_entry ? old_entry->value_size : 0;
+
+	switch (ctx->req.op) {
+	case DICT_UPDATE_SET_IF_ABSENT:
+		if (old_entry != NULL) {
+			ctx->req.version = old_entry->version;
+			return EEXIST;
+		}
+
+		break;
+
+	case DICT_UPDATE_CAS:
+		if (old_entry == NULL) {
+			return ENOENT;
+		}
+
+		if (ctx->expected != NULL ? old_size != ctx->req.expected_size
+			|| memcmp(dict_entry_value_out(old_entry, &counter), ctx->expected, old_size) != 0
+			: old_entry->version != ctx->req.version) {
+			ctx->req.version = old_entry->version;
+			return ECANCELED;
+		}
+
+		break;
+
+	case DICT_UPDATE_INCR:
+		/* counter appeared after lookup, retry takes lockless path */
+		if (old_entry != NULL && old_entry->counter != NULL) {
+			return EAGAIN;
+		}
+
+		if (old_entry != NULL && (old_entry->value_type != DICT_TYPE_INT
+			|| (old_size != sizeof(s32) && old_size != sizeof(s64)))) {
+			return EINVAL;
+		}
+
+		fallthrough;
+
+	case DICT_UPDATE_APPEND:
+		if (old_entry != NULL && old_entry->counter != NULL) {
+			return EINVAL;
+		}
+
+		if (old_size != ctx->old_size) {
+			ctx->old_size = old_size;
+			return EAGAIN;
+		}
+
+		/* value changes, pair keeps its expiry */
+		new_entry->expires = old_entry ? old_entry->expires : 0;
+
+		if (ctx->req.op == DICT_UPDATE_APPEND) {
+			if (old_entry != NULL) {
+				memcpy(dict_entry_value(new_entry), dict_entry_value(old_entry), old_size);
+				new_entry->value_type = old_entry->value_type;
+			}
+
+			break;
+		}
+
+		if (old_size == sizeof(s32)) {
+			memcpy(&value32, dict_entry_value(old_entry), sizeof(s32));
+			value = value32;
+		} else if (old_size == sizeof(s64)) {
+			memcpy(&value, dict_entry_value(old_entry), sizeof(s64));
+		}
+
+		if (check_add_overflow(value, ctx->req.delta, &value)
+			|| (new_entry->value_size == sizeof(s32) && (value < S32_MIN || value > S32_MAX))) {
+			return ERANGE;
+		}
+
+		if (new_entry->value_size == sizeof(s32)) {
+			value32 = value;
+			memcpy(dict_entry_value(new_entry), &value32, sizeof(s32));
+		} else {
+			memcpy(dict_entry_value(new_entry), &value, sizeof(s64));
+		}
+
+		new_entry->value_type = DICT_TYPE_INT;
+		ctx->req.delta = value;
+		break;
+	}
+
+	ctx->req.pair.value_size = new_entry->value_size;
+	ctx->req.pair.value_type = new_entry->value_type;
+	ctx->req.version = new_entry->version;
+	return 0;
+}
+
+
+/** @brief Run SCAN request - visit cursor positions shard by shard until
+ *  record or byte budget, or DICT_SCAN_MAX_STEPS, is used up; shard lock is
+ *  held only while one position is collected, records are copied to user
+ *  after it is dropped; position that does not fit is left for the next call
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_scan User request with cursor, buffer and budgets
+ *  @return 0 on success, ERANGE if not even one position fits into buffer
+ *  (used is then set to size it needs), EINVAL, ENOMEM or EFAULT otherwise
+ */
+static long dict_scan_run(dict *pd, dict_scan *user_scan)
+{
+	long retval = 0;
+	size_t size;
+	size_t data_size;
+	unsigned int i;
+	unsigned int steps;
+	u64 next;
+	dict_scan scan;
+	dict_scan_batch batch;
+
+	if (copy_from_user(&scan, user_scan, sizeof(dict_scan))) {
+		pr_err("SCAN: cannot get msg from user");
+		return EFAULT;
+	}
+
+	if ((scan.cursor >> DICT_SCAN_SHARD_SHIFT) >= pd->num_shards || (scan.buf == NULL && scan.buf_size != 0)) {
+		pr_err("SCAN: illegal cursor or buffer");
+		return EINVAL;
+	}
+
+	if (dict_scan_batch_init(&batch) != 0) {
+		pr_err("SCAN: kmalloc failed");
+		return ENOMEM;
+	}
+
+	scan.num_records = 0;
+	scan.used = 0;
+
+	for (steps = 0; steps < DICT_SCAN_MAX_STEPS; steps++) {
+		next = dict_scan_step(pd, scan.cursor, &batch);
+
+		if (batch.error != 0) {
+			dict_scan_release(&batch);
+			retval = batch.error;
+			break;
+		}
+
+		for (size = 0, i = 0; i < batch.count; i++) {
+			data_size = batch.entries[i]->key_size;
+			if (scan.flags & DICT_SCAN_VALUES) {
+				data_size += batch.entries[i]->value_size;
+			}
+			size += ALIGN(sizeof(dict_scan_record) + data_size, 8);
+		}
+
+		/* position is returned whole or not at all, so cursor never splits a bucket */
+
+		if (scan.used + size > scan.buf_size
+			|| (scan.max_records != 0 && scan.num_records + batch.count > scan.max_records
+			    && scan.num_records != 0)) {
+			dict_scan_release(&batch);
+
+			if (scan.num_records == 0) {
+				scan.used = size;
+				retval = ERANGE;
+			}
+			break;
+		}
+
+		retval = dict_scan_copy(&batch, &scan);
+
+		if (retval != 0) {
+			break;
+		}
+
+		scan.cursor = next;
+
+		if (next == 0) {
+			break;
+		}
+
+		if (scan.max_records != 0 && scan.num_records >= scan.max_records) {
+			break;
+		}
+
+		cond_resched();
+	}
+
+	kfree(batch.entries);
+
+	if (copy_to_user(user_scan, &scan, sizeof(dict_scan))) {
+		pr_err("SCAN: cannot sent results to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Write records of collected entries to user buffer and unpin them
+ *  @param batch Entries of one cursor position, known to fit into buffer
+ *  @param scan Request, its num_records and used are advanced
+ *  @return 0 on success, EFAULT if buffer cannot be written
+ */
+static long dict_scan_copy(dict_scan_batch *batch, dict_scan *scan)
+{
+	long retval = 0;
+	unsigned int i;
+	size_t data_size;
+	unsigned char __user *pos;
+	dict_entry *entry;
+	dict_scan_record record;
+
+	for (i = 0; i < batch->count; i++) {
+		entry = batch->entries[i];
+		pos = (unsigned char __user *)scan->buf + scan->used;
+
+		record.key_size = entry->key_size;
+		record.value_size = entry->value_size;
+		record.key_type = entry->key_type;
+		record.value_type = entry->value_type;
+		record.expires_ms = dict_expiry_to_real(entry);
+
+		data_size = entry->key_size;
+		if (scan->flags & DICT_SCAN_VALUES) {
+			data_size += entry->value_size;
+		}
+
+		if (retval == 0 && (copy_to_user(pos, &record, sizeof(dict_scan_record))
+				    || copy_to_user(pos + sizeof(dict_scan_record), entry->data, data_size))) {
+			pr_err("SCAN: cannot sent records to user");
+			retval = EFAULT;
+		}
+
+		if (retval == 0) {
+			scan->used += ALIGN(sizeof(dict_scan_record) + data_size, 8);
+			scan->num_records++;
+		}
+
+		dict_entry_put(entry);
+	}
+
+	batch->count = 0;
+	return retval;
+}
+
+
+/** @brief Unpin collected entries without copying them
+ *  @param batch Entries of one cursor position
+ */
+static void dict_scan_release(dict_scan_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->count; i++) {
+		dict_entry_put(batch->entries[i]);
+	}
+
+	batch->count = 0;
+}
+
+/** @brief  Init driver function - get major/minor numbers, create device class,
+ *  mount it and initilize dict structure of every minor that will be used for
+ *  storage, called on using insmod
+ *  @return 0 on success, -1 on others
+ */
+static int __init dict_driver_init(void)
+{
+	unsigned int i;
+	char name[32];
+	struct dentry *dir;
+
+	get_random_bytes(&dict_hash_key, sizeof(dict_hash_key));
+
+	/* Entry caches go first, dict allocates from them */
+
+	if (dict_caches_create()) {
+		pr_err("DICT_INIT: cannot create entry caches\n");
+		return -1;
+	}
+
+	/* Initilizing dicts before devices appear, so no IOCTL can see them unset */
+
+	if (dict_engine_find(engine) == NULL) {
+		pr_err("DICT_INIT: unknown engine %s\n", engine);
+		goto r_caches;
+	}
+
+	if (num_devices == 0 || num_devices > DICT_MAX_DEVICES) {
+		pr_err("DICT_INIT: num_devices must be 1 to %d\n", DICT_MAX_DEVICES);
+		goto r_caches;
+	}
+
+	if (num_shards == 0) {
+		num_shards = num_online_cpus();
+	}
+
+	dict_flush_wq = alloc_workqueue("dict_flush", 0, 0);
+
+	if (dict_flush_wq == NULL) {
+		pr_err("DICT_INIT: cannot allocate flush workqueue\n");
+		goto r_caches;
+	}
+
+	dicts = kcalloc(num_devices, sizeof(dict *), GFP_KERNEL);
+
+	if (dicts == NULL) {
+		pr_err("DICT_INIT: cannot allocate dict array\n");
+		goto r_flush_wq;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		dicts[i] = dict_create(num_shards, dict_engine_find(engine));
+
+		if (dicts[i] == NULL) {
+			pr_err("DICT_INIT: dict %u was not initialized\n", i);
+			goto r_dict;
+		}
+	}
+
+	pr_info("DICT_INIT: %u dicts initialized with %u shards, %s engine\n", num_devices, num_shards, engine);
+
+	if (dict_shrinker_register()) {
+		pr_err("DICT_INIT: cannot register shrinker\n");
+		goto r_dict;
+	}
+
+	if ((alloc_chrdev_region(&dev, 0, num_devices, "dict_Dev")) < 0) {
+		pr_err("DICT_INIT: cannot allocate major number\n");
+		goto r_shrinker;
+	}
+
+	/* Dynamic major and minor number allocation */
+
+	pr_info("DICT_INIT: Major = %d Minor = %d..%u \n", MAJOR(dev), MINOR(dev), MINOR(dev) + num_devices - 1);
+	cdev_init(&dict_cdev, &fops);
+
+	/* Adding device as character device, all minors at once */
+
+	if ((cdev_add(&dict_cdev, dev, num_devices)) < 0) {
+		pr_err("DICT_INIT: cannot add the device to the system\n");
+		goto r_region;
+	}
+
+	/* Creating device class */
+
+	if (IS_ERR(dev_class = class_create(THIS_MODULE, "dict_class"))) {
+		pr_err("DICT_INIT: cannot create the struct class\n");
+		goto r_cdev;
+	}
+
+	/* Creating devices, one node per minor */
+
+	for (i = 0; i < num_devices; i++) {
+		if (IS_ERR(device_create_with_groups(dev_class, NULL, MKDEV(MAJOR(dev), MINOR(dev) + i),
+						     dicts[i], dict_dev_groups, "dict_device%u", i))) {
+			pr_err("DICT_INIT: cannot create the device %u\n", i);
+			goto r_devices;
+		}
+	}
+
+	/* Statistics are optional, debugfs failures are not fatal */
+
+	dict_debugfs = debugfs_create_dir("dict_driver", NULL);
+	debugfs_create_file("slabs", 0444, dict_debugfs, NULL, &dict_slabs_fops);
+
+	for (i = 0; i < num_devices; i++) {
+		snprintf(name, sizeof(name), "dict_device%u", i);
+		dir = debugfs_create_dir(name, dict_debugfs);
+		debugfs_create_file("expiry", 0444, dir, dicts[i], &dict_expiry_fops);
+		debugfs_create_file("cache", 0444, dir, dicts[i], &dict_cache_fops);
+	}
+
+	pr_info("DICT_INIT: device driver inserted\n");
+
+	return 0;
+
+r_devices:
+	while (i-- > 0) {
+		device_destroy(dev_class, MKDEV(MAJOR(dev), MINOR(dev) + i));
+	}
+	class_destroy(dev_class);
+r_cdev:
+	cdev_del(&dict_cdev);
+r_region:
+	unregister_chrdev_region(dev, num_devices);
+r_shrinker:
+	dict_shrinker_unregister();
+r_dict:
+	for (i = 0; i < num_devices; i++) {
+		if (dicts[i] != NULL) {
+			dict_destroy(dicts[i]);
+		}
+	}
+	kfree(dicts);
+	rcu_barrier();
+	flush_work(&dict_free_work);
+r_flush_wq:
+	destroy_workqueue(dict_flush_wq);
+r_caches:
+	dict_caches_destroy();
+	return -1;
+}
+
+
+/** @brief  Exit driver function - destroy all device stuff, call dict destructor
+ *  for every minor, and destroy entry caches as well; called on rmmod'ing driver
+ *  @return 0 on success, -1 on others
+ */
+static void __exit dict_driver_exit(void)
+{
+	unsigned int i;
+
+	debugfs_remove_recursive(dict_debugfs);
+
+	for (i = 0; i < num_devices; i++) {
+		device_destroy(dev_class, MKDEV(MAJOR(dev), MINOR(dev) + i));
+	}
+
+	class_destroy(dev_class);
+	cdev_del(&dict_cdev);
+	unregister_chrdev_region(dev, num_devices);
+	dict_shrinker_unregister();
+
+	for (i = 0; i < num_devices; i++) {
+		dict_destroy(dicts[i]);
+	}
+
+	kfree(dicts);
+
+	/*
+	 * Wait for pending RCU and deferred frees of entries and tables, caches
+	 * must be empty; flushed tables are queued once their grace period ends,
+	 * and entries they release may go through RCU once more
+	 */
+
+	rcu_barrier();
+	destroy_workqueue(dict_flush_wq);
+	rcu_barrier();
+	flush_work(&dict_free_work);
+	dict_caches_destroy();
+	pr_info("DICT_EXIT: device removed\n");
+}
+
+
+/*
+ *
+ *                                  SUBMISSION RINGS
+ *
+ */
+
+
+/** @brief Allocate rings of an open file; single vmalloc area holds header,
+ *  submission entries, completion entries and data area, in this order
+ *  @param df State of open file of the device, ring is kept in it
+ *  @param pd Dictionary ring operations go to
+ *  @param user_params Requested sizes and flags, filled with area layout on success
+ *  @return 0 on success, EINVAL for bad parameters, ENOMEM, EBUSY if file
+ *  already has a ring, EFAULT if parameters cannot be copied
+ */
+static long dict_ring_setup(dict_file *df, dict *pd, dict_ring_params *user_params)
+{
+	dict_ring *ring;
+	dict_ring_params params;
+
+	if (copy_from_user(&params, user_params, sizeof(dict_ring_params))) {
+		pr_err("RING_SETUP: cannot get params from user");
+		return EFAULT;
+	}
+
+	if (params.sq_entries == 0 || params.sq_entries > DICT_RING_MAX_ENTRIES
+		|| !is_power_of_2(params.sq_entries) || params.data_size > DICT_RING_MAX_DATA
+		|| (params.flags & ~DICT_RING_SQPOLL) != 0) {
+		pr_err("RING_SETUP: bad parameters");
+		return EINVAL;
+	}
+
+	/* twice as many completions, so they do not stall submissions often */
+
+	params.cq_entries  = params.sq_entries * 2;
+	params.sq_off      = sizeof(dict_ring_header);
+	params.cq_off      = params.sq_off + params.sq_entries * sizeof(dict_sqe);
+	params.data_off    = ALIGN(params.cq_off + params.cq_entries * sizeof(dict_cqe), SMP_CACHE_BYTES);
+	params.ring_size   = PAGE_ALIGN(params.data_off + params.data_size);
+
+	ring = kzalloc(sizeof(dict_ring), GFP_KERNEL);
+
+	if (ring == NULL) {
+		return ENOMEM;
+	}
+
+	ring->mem = vmalloc_user(params.ring_size);
+
+	if (ring->mem == NULL) {
+		pr_err("RING_SETUP: vmalloc failed");
+		kfree(ring);
+		return ENOMEM;
+	}
+
+	ring->pd            = pd;
+	ring->size          = params.ring_size;
+	ring->hdr           = ring->mem;
+	ring->sqes          = ring->mem + params.sq_off;
+	ring->cqes          = ring->mem + params.cq_off;
+	ring->data          = ring->mem + params.data_off;
+	ring->sq_entries    = params.sq_entries;
+	ring->cq_entries    = params.cq_entries;
+	ring->data_size     = params.data_size;
+	ring->flags         = params.flags;
+
+	ring->hdr->sq_mask  = ring->sq_entries - 1;
+	ring->hdr->cq_mask  = ring->cq_entries - 1;
+
+	/* polling worker is not running yet, first submission has to wake it up */
+
+	if (ring->flags & DICT_RING_SQPOLL) {
+		ring->hdr->flags = DICT_RING_NEED_WAKEUP;
+	}
+
+	mutex_init(&ring->ring_mutex);
+	INIT_WORK(&ring->ring_work, dict_ring_work);
+	init_waitqueue_head(&ring->cq_wait);
+
+	if (copy_to_user(user_params, &params, sizeof(dict_ring_params))) {
+		pr_err("RING_SETUP: cannot sent params to user");
+		dict_ring_destroy(ring);
+		return EFAULT;
+	}
+
+	if (cmpxchg(&df->ring, NULL, ring) != NULL) {
+		dict_ring_destroy(ring);
+		return EBUSY;
+	}
+
+	return 0;
+}
+
+
+/** @brief Free ring once its file is closed; mapping holds file reference,
+ *  so user cannot access the area anymore
+ *  @param ring Ring to free
+ */
+static void dict_ring_destroy(dict_ring *ring)
+{
+	cancel_work_sync(&ring->ring_work);
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+
+/** @brief Run posted submissions in caller's context, or wake up polling worker
+ *  @param ring Ring of the calling file
+ *  @return 0
+ */
+static long dict_ring_enter(dict_ring *ring)
+{
+	if (ring->flags & DICT_RING_SQPOLL) {
+		WRITE_ONCE(ring->hdr->flags, 0);
+		ring->idle_since = jiffies;
+		queue_work(system_unbound_wq, &ring->ring_work);
+		return 0;
+	}
+
+	mutex_lock(&ring->ring_mutex);
+	dict_ring_process(ring);
+	mutex_unlock(&ring->ring_mutex);
+
+	return 0;
+}
+
+
+/** @brief Consume submissions posted up to now, as long as there is room for
+ *  their completions; called with ring_mutex held
+ *  @param ring Ring to process
+ *  @return Number of submissions consumed
+ */
+static unsigned int dict_ring_process(dict_ring *ring)
+{
+	u32 tail;
+	unsigned int done = 0;
+	dict_sqe sqe;
+	dict_cqe cqe;
+
+	tail = smp_load_acquire(&ring->hdr->sq_tail);
+
+	while (ring->sq_head != tail
+		&& ring->cq_tail - smp_load_acquire(&ring->hdr->cq_head) < ring->cq_entries) {
+
+		/* user may rewrite entry any time, work on private copy */
+
+		sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+
+		memset(&cqe, 0, sizeof(cqe));
+		cqe.user_data = sqe.user_data;
+		cqe.status = dict_ring_exec(ring, &sqe, &cqe);
+
+		ring->cqes[ring->cq_tail & (ring->cq_entries - 1)] = cqe;
+		ring->sq_head++;
+		ring->cq_tail++;
+		done++;
+
+		smp_store_release(&ring->hdr->cq_tail, ring->cq_tail);
+		cond_resched();
+	}
+
+	smp_store_release(&ring->hdr->sq_head, ring->sq_head);
+
+	if (done > 0) {
+		wake_up_interruptible(&ring->cq_wait);
+	}
+
+	return done;
+}
+
+
+/** @brief Execute one submission against the dictionary, same as its
+ *  single-pair IOCTL would, but with key and value in the data area
+ *  @param ring Ring submission came from
+ *  @param sqe Private copy of submission entry
+ *  @param cqe Completion to fill with value size and type for GET
+ *  @return 0 on success, otherwise positive error code
+ */
+static int dict_ring_exec(dict_ring *ring, const dict_sqe *sqe, dict_cqe *cqe)
+{
+	int retval;
+	void *key;
+	s64 counter;
+	dict_pair msg_dict = {0};
+	dict_entry *found_pair;
+
+	if (sqe->op != DICT_OP_SET && sqe->op != DICT_OP_GET && sqe->op != DICT_OP_DEL) {
+		return EINVAL;
+	}
+
+	if (sqe->key_size == 0 || sqe->key_off > ring->data_size
+		|| sqe->key_size > ring->data_size - sqe->key_off) {
+		return EINVAL;
+	}
+
+	if (sqe->op != DICT_OP_DEL && (sqe->value_off > ring->data_size
+		|| sqe->value_size > ring->data_size - sqe->value_off)) {
+		return EINVAL;
+	}
+
+	if (sqe->op == DICT_OP_SET && (sqe->value_size == 0 || !dict_pair_size_ok(sqe->key_size, sqe->value_size)
+		|| sqe->key_type < 0 || sqe->value_type < 0)) {
+		return EINVAL;
+	}
+
+	/*
+	 * key is used right from data area: SET hashes its own copy in the
+	 * entry, and if user changes key under lookup or deletion, only that
+	 * request gets odd result
+	 */
+
+	key = ring->data + sqe->key_off;
+
+	msg_dict.key_size   = sqe->key_size;
+	msg_dict.key_type   = sqe->key_type;
+	msg_dict.value_size = sqe->value_size;
+	msg_dict.value_type = sqe->value_type;
+
+	switch (sqe->op) {
+	case DICT_OP_SET:
+		retval = dict_set(ring->pd, key, ring->data + sqe->value_off, &msg_dict);
+		break;
+
+	case DICT_OP_GET:
+		/* memcpy() does not sleep, so entry needs no pin */
+		rcu_read_lock();
+		found_pair = dict_get(ring->pd, key, sqe->key_size);
+
+		if (found_pair == NULL) {
+			retval = ENOENT;
+		} else {
+			cqe->value_size = found_pair->value_size;
+			cqe->value_type = found_pair->value_type;
+
+			if (found_pair->value_size > sqe->value_size) {
+				retval = ERANGE;
+			} else {
+				memcpy(ring->data + sqe->value_off, dict_entry_value_out(found_pair, &counter), found_pair->value_size);
+				retval = 0;
+			}
+		}
+		rcu_read_unlock();
+		break;
+
+	default:
+		dict_del(ring->pd, key, sqe->key_size);
+		retval = 0;
+		break;
+	}
+
+	return retval;
+}
+
+
+/** @brief Polling worker of DICT_RING_SQPOLL ring; requeues itself while there
+ *  are submissions or it has been idle for less than DICT_RING_IDLE_MS, then
+ *  sets DICT_RING_NEED_WAKEUP and waits for RING_ENTER
+ *  @param work ring_work of the ring
+ */
+static void dict_ring_work(struct work_struct *work)
+{
+	unsigned int done;
+	dict_ring *ring = container_of(work, dict_ring, ring_work);
+
+	mutex_lock(&ring->ring_mutex);
+	done = dict_ring_process(ring);
+	mutex_unlock(&ring->ring_mutex);
+
+	if (done > 0) {
+		ring->idle_since = jiffies;
+	} else if (time_after(jiffies, ring->idle_since + msecs_to_jiffies(DICT_RING_IDLE_MS))) {
+		WRITE_ONCE(ring->hdr->flags, DICT_RING_NEED_WAKEUP);
+
+		/* pairs with barrier in user between publishing sq_tail and reading flags */
+		smp_mb();
+
+		if (smp_load_acquire(&ring->hdr->sq_tail) == ring->sq_head) {
+			return;
+		}
+
+		WRITE_ONCE(ring->hdr->flags, 0);
+	}
+
+	queue_work(system_unbound_wq, &ring->ring_work);
+}
+
+
+/** @brief Map ring area of the file to user
+ *  @param file Open file of the device
+ *  @param vma User mapping, must start at offset 0 and fit into ring area
+ *  @return 0 on success, negative error code otherwise
+ */
+static int dict_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	dict_file *df = file->private_data;
+	dict_ring *ring = READ_ONCE(df->ring);
+
+	if (ring == NULL) {
+		return -ENXIO;
+	}
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring->size) {
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, ring->mem, 0);
+}
+
+
+/** @brief Report completions ready to be consumed; file without ring is
+ *  always ready for read() and write() of record streams
+ *  @param file Open file of the device
+ *  @param wait Poll table
+ *  @return EPOLLIN if completion ring is not empty, EPOLLIN and EPOLLOUT if
+ *  file has no ring
+ */
+static __poll_t dict_poll(struct file *file, poll_table *wait)
+{
+	dict_file *df = file->private_data;
+	dict_ring *ring = READ_ONCE(df->ring);
+
+	if (ring == NULL) {
+		return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+	}
+
+	poll_wait(file, &ring->cq_wait, wait);
+
+	if (READ_ONCE(ring->hdr->cq_head) != smp_load_acquire(&ring->hdr->cq_tail)) {
+		return EPOLLIN | EPOLLRDNORM;
+	}
+
+	return 0;
+}
+
+
+/*
+ *
+ *                                  OPEN FILES
+ *
+ */
+
+
+/** @brief Set up state of newly opened file and bind it to dictionary of the
+ *  device minor; file is a stream - read() goes through the dictionary once
+ *  from the beginning, write() takes records
+ *  @param inode Device inode
+ *  @param file Open file of the device
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int dict_open(struct inode *inode, struct file *file)
+{
+	dict_file *df = kzalloc(sizeof(dict_file), GFP_KERNEL);
+
+	if (df == NULL) {
+		return -ENOMEM;
+	}
+
+	if (dict_scan_batch_init(&df->read_batch) != 0) {
+		kfree(df);
+		return -ENOMEM;
+	}
+
+	df->pd = dicts[iminor(inode) - MINOR(dev)];
+	mutex_init(&df->stream_mutex);
+
+	file->private_data = df;
+	return stream_open(inode, file);
+}
+
+
+/** @brief Release open file of the device - its ring if any, entries pinned
+ *  by read() and record write() did not finish
+ *  @param inode Device inode
+ *  @param file Open file of the device
+ *  @return 0
+ */
+static int dict_release(struct inode *inode, struct file *file)
+{
+	dict_file *df = file->private_data;
+
+	if (df->ring != NULL) {
+		dict_ring_destroy(df->ring);
+	}
+
+	if (df->write_entry != NULL) {
+		dict_entry_free(df->write_entry);
+	}
+
+	dict_scan_release(&df->read_batch);
+	kfree(df->read_batch.entries);
+	kfree(df);
+
+	return 0;
+}
+
+
+/** @brief Stream out all pairs as records - struct dict_scan_record followed
+ *  by key and value bytes, as in snapshot; pairs are collected one scan
+ *  position at a time and copied straight from pinned entries, so record can
+ *  be split over any number of reads, and no lock is held while copying
+ *  @param iocb Request, file is taken from it
+ *  @param to User buffers
+ *  @return Number of bytes read, 0 once all pairs were read, negative error
+ *  code if nothing could be read
+ */
+static ssize_t dict_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	long retval = 0;
+	size_t n;
+	size_t done = 0;
+	dict_entry *entry;
+	dict_scan_record record;
+	dict_file *df = iocb->ki_filp->private_data;
+
+	mutex_lock(&df->stream_mutex);
+
+	while (iov_iter_count(to) > 0) {
+		if (df->read_idx == df->read_batch.count) {
+			dict_scan_release(&df->read_batch);
+			df->read_idx = 0;
+
+			if (df->read_done) {
+				break;
+			}
+
+			retval = dict_read_fill(df);
+
+			if (retval != 0) {
+				break;
+			}
+			continue;
+		}
+
+		entry = df->read_batch.entries[df->read_idx];
+
+		if (df->read_off < sizeof(dict_scan_record)) {
+			record.key_size = entry->key_size;
+			record.value_size = entry->value_size;
+			record.key_type = entry->key_type;
+			record.value_type = entry->value_type;
+			record.expires_ms = dict_expiry_to_real(entry);
+
+			n = copy_to_iter((unsigned char *)&record + df->read_off,
+					 sizeof(dict_scan_record) - df->read_off, to);
+		} else {
+			n = copy_to_iter(entry->data + df->read_off - sizeof(dict_scan_record),
+					 sizeof(dict_scan_record) + entry->key_size + entry->value_size - df->read_off, to);
+		}
+
+		if (n == 0) {
+			retval = -EFAULT;
+			break;
+		}
+
+		df->read_off += n;
+		done += n;
+
+		if (df->read_off == sizeof(dict_scan_record) + entry->key_size + entry->value_size) {
+			df->read_off = 0;
+			df->read_idx++;
+		}
+	}
+
+	mutex_unlock(&df->stream_mutex);
+
+	return done > 0 ? done : retval;
+}
+
+
+/** @brief Collect next scan position that has entries, or reach the end
+ *  @param df State of open file, called with its stream_mutex held
+ *  @return 0 on success, -ENOMEM if entries could not be collected
+ */
+static long dict_read_fill(dict_file *df)
+{
+	do {
+		df->read_cursor = dict_scan_step(df->pd, df->read_cursor, &df->read_batch);
+
+		if (df->read_batch.error != 0) {
+			dict_scan_release(&df->read_batch);
+			return -df->read_batch.error;
+		}
+
+		df->read_done = df->read_cursor == 0;
+		cond_resched();
+	} while (df->read_batch.count == 0 && !df->read_done);
+
+	return 0;
+}
+
+
+/** @brief Set pairs from stream of records in the format read() produces;
+ *  record may be split over any number of writes, its key and value are
+ *  copied from user straight into the entry that is then set, so large
+ *  write() sets thousands of pairs with one copy of each
+ *  @param iocb Request, file is taken from it
+ *  @param from User buffers
+ *  @return Number of bytes consumed, short if record was rejected after
+ *  some progress; negative error code if nothing was consumed. Invalid
+ *  record or failed set is dropped and fails every later write of this file,
+ *  since the rest of stream cannot be parsed once a record is lost
+ */
+static ssize_t dict_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	long retval = 0;
+	size_t n;
+	size_t done = 0;
+	size_t data_size;
+	unsigned long count = 0;
+	dict_entry *entry;
+	dict_file *df = iocb->ki_filp->private_data;
+
+	mutex_lock(&df->stream_mutex);
+
+	retval = df->write_error;
+
+	while (retval == 0 && iov_iter_count(from) > 0) {
+		entry = df->write_entry;
+
+		if (entry == NULL) {
+			/* header stays complete after failed allocation, so next write retries it */
+			if (df->write_off < sizeof(dict_scan_record)) {
+				n = copy_from_iter((unsigned char *)&df->write_record + df->write_off,
+						   sizeof(dict_scan_record) - df->write_off, from);
+
+				if (n == 0) {
+					retval = -EFAULT;
+					break;
+				}
+
+				df->write_off += n;
+				done += n;
+
+				if (df->write_off < sizeof(dict_scan_record)) {
+					continue;
+				}
+
+				if (df->write_record.key_size == 0 || df->write_record.value_size == 0
+					|| !dict_pair_size_ok(df->write_record.key_size, df->write_record.value_size)
+					|| df->write_record.key_type < 0 || df->write_record.value_type < 0) {
+					pr_err("WRITE: illegal record");
+					df->write_error = -EINVAL;
+					retval = -EINVAL;
+					break;
+				}
+			}
+
+			df->write_entry = dict_entry_alloc(df->write_record.key_size, df->write_record.value_size);
+
+			if (df->write_entry == NULL) {
+				retval = -ENOMEM;
+				break;
+			}
+
+			df->write_off = 0;
+			continue;
+		}
+
+		data_size = entry->key_size + entry->value_size;
+		n = copy_from_iter(entry->data + df->write_off, data_size - df->write_off, from);
+
+		if (n == 0) {
+			retval = -EFAULT;
+			break;
+		}
+
+		df->write_off += n;
+		done += n;
+
+		if (df->write_off < data_size) {
+			continue;
+		}
+
+		entry->key_hash = dict_hash(dict_entry_key(entry), entry->key_size);
+		entry->key_type = df->write_record.key_type;
+		entry->value_type = df->write_record.value_type;
+
+		df->write_entry = NULL;
+		df->write_off = 0;
+
+		/* pair that expired since it was read is consumed, but not set */
+		if (!dict_expiry_from_real(entry, df->write_record.expires_ms)) {
+			dict_entry_free(entry);
+			continue;
+		}
+
+		retval = -dict_set_entry(df->pd, entry);
+
+		if (retval != 0) {
+			df->write_error = retval;
+			break;
+		}
+
+		if (++count % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+
+	mutex_unlock(&df->stream_mutex);
+
+	return done > 0 ? done : retval;
+}
+
+
+/*
+ *
+ *                                  SNAPSHOTS
+ *
+ */
+
+
+/** @brief Write all pairs to file as snapshot stream; shards are walked with
+ *  the same cursor as SCAN, so pairs present during the whole save are written
+ *  and writers are blocked only while one bucket is collected; records are
+ *  gathered into DICT_SNAPSHOT_CHUNK buffer and written in large sequential
+ *  chunks, values that do not fit into it go straight from the entry
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_snapshot User request with file descriptor to write to
+ *  @return 0 on success, EBADF if descriptor is not open for writing,
+ *  ENOMEM, EFAULT or error of the write otherwise
+ */
+static long dict_snapshot_save(dict *pd, dict_snapshot *user_snapshot)
+{
+	long retval = 0;
+	unsigned int i;
+	unsigned int s;
+	u64 cursor = 0;
+	dict_snapshot snapshot;
+	dict_snapshot_header header;
+	dict_scan_record record;
+	dict_scan_batch batch;
+	dict_stream stream;
+	dict_entry *entry;
+
+	if (copy_from_user(&snapshot, user_snapshot, sizeof(dict_snapshot))) {
+		pr_err("SNAPSHOT_SAVE: cannot get msg from user");
+		return EFAULT;
+	}
+
+	retval = dict_stream_open(&stream, snapshot.fd);
+
+	if (retval != 0) {
+		return retval;
+	}
+
+	if (dict_scan_batch_init(&batch) != 0) {
+		pr_err("SNAPSHOT_SAVE: kmalloc failed");
+		dict_stream_close(&stream);
+		return ENOMEM;
+	}
+
+	header.magic = DICT_SNAPSHOT_MAGIC;
+	header.version = DICT_SNAPSHOT_VERSION;
+	header.num_entries = 0;
+
+	for (s = 0; s < pd->num_shards; s++) {
+		header.num_entries += READ_ONCE(pd->shards[s].num_entries);
+	}
+
+	retval = dict_stream_write(&stream, &header, sizeof(dict_snapshot_header));
+	snapshot.num_entries = 0;
+
+	while (retval == 0) {
+		cursor = dict_scan_step(pd, cursor, &batch);
+		retval = batch.error;
+
+		for (i = 0; i < batch.count && retval == 0; i++) {
+			entry = batch.entries[i];
+
+			record.key_size = entry->key_size;
+			record.value_size = entry->value_size;
+			record.key_type = entry->key_type;
+			record.value_type = entry->value_type;
+			record.expires_ms = dict_expiry_to_real(entry);
+
+			retval = dict_stream_write(&stream, &record, sizeof(dict_scan_record));
+			if (retval == 0) {
+				retval = dict_stream_write(&stream, entry->data, entry->key_size + entry->value_size);
+			}
+			if (retval == 0) {
+				snapshot.num_entries++;
+			}
+		}
+
+		dict_scan_release(&batch);
+
+		if (cursor == 0) {
+			break;
+		}
+
+		cond_resched();
+	}
+
+	/* end of stream is a record with zero key size */
+
+	if (retval == 0) {
+		memset(&record, 0, sizeof(dict_scan_record));
+		retval = dict_stream_write(&stream, &record, sizeof(dict_scan_record));
+	}
+
+	if (retval == 0) {
+		retval = dict_stream_flush(&stream);
+	}
+
+	if (retval != 0) {
+		pr_err("SNAPSHOT_SAVE: failed with %ld", retval);
+		/* drop what was not written, so file position ends after written bytes */
+		stream.len = 0;
+	}
+
+	snapshot.size = stream.size;
+
+	kfree(batch.entries);
+	dict_stream_close(&stream);
+
+	if (copy_to_user(user_snapshot, &snapshot, sizeof(dict_snapshot))) {
+		pr_err("SNAPSHOT_SAVE: cannot sent results to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Read snapshot stream from file and set all its pairs; tables are
+ *  sized for number of pairs in header before the first one is set, so load
+ *  does not rehash; stream is read in DICT_SNAPSHOT_CHUNK pieces and each
+ *  record is copied from the buffer straight into its entry
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_snapshot User request with file descriptor to read from
+ *  @return 0 on success, EINVAL if stream is not a snapshot of this version
+ *  or has invalid record, EIO if it is truncated, EBADF if descriptor is not
+ *  open for reading, ENOMEM, EFAULT or error of the read otherwise; pairs read
+ *  before an error stay in dictionary
+ */
+static long dict_snapshot_load(dict *pd, dict_snapshot *user_snapshot)
+{
+	long retval;
+	dict_snapshot snapshot;
+	dict_snapshot_header header;
+	dict_scan_record record;
+	dict_stream stream;
+	dict_entry *entry;
+
+	if (copy_from_user(&snapshot, user_snapshot, sizeof(dict_snapshot))) {
+		pr_err("SNAPSHOT_LOAD: cannot get msg from user");
+		return EFAULT;
+	}
+
+	retval = dict_stream_open(&stream, snapshot.fd);
+
+	if (retval != 0) {
+		return retval;
+	}
+
+	snapshot.num_entries = 0;
+	retval = dict_stream_read(&stream, &header, sizeof(dict_snapshot_header));
+
+	if (retval == 0 && (header.magic != DICT_SNAPSHOT_MAGIC || header.version != DICT_SNAPSHOT_VERSION)) {
+		pr_err("SNAPSHOT_LOAD: not a snapshot or unsupported version");
+		retval = EINVAL;
+	}
+
+	/* count in header is not trusted, file cannot hold more records than fit in its size */
+	if (retval == 0) {
+		if (S_ISREG(file_inode(stream.file)->i_mode)) {
+			header.num_entries = min_t(u64, header.num_entries,
+						   i_size_read(file_inode(stream.file)) / (sizeof(dict_scan_record) + 2));
+		}
+
+		dict_reserve(pd, header.num_entries);
+	}
+
+	while (retval == 0) {
+		retval = dict_stream_read(&stream, &record, sizeof(dict_scan_record));
+
+		if (retval != 0 || record.key_size == 0) {
+			break;
+		}
+
+		if (record.value_size == 0 || !dict_pair_size_ok(record.key_size, record.value_size)
+			|| record.key_type < 0 || record.value_type < 0) {
+			pr_err("SNAPSHOT_LOAD: illegal record");
+			retval = EINVAL;
+			break;
+		}
+
+		entry = dict_entry_alloc(record.key_size, record.value_size);
+
+		if (entry == NULL) {
+			retval = ENOMEM;
+			break;
+		}
+
+		retval = dict_stream_read(&stream, entry->data, entry->key_size + entry->value_size);
+
+		if (retval != 0) {
+			dict_entry_free(entry);
+			break;
+		}
+
+		entry->key_hash = dict_hash(dict_entry_key(entry), entry->key_size);
+		entry->key_type = record.key_type;
+		entry->value_type = record.value_type;
+
+		/* pair that expired since save is skipped, and is not counted */
+		if (!dict_expiry_from_real(entry, record.expires_ms)) {
+			dict_entry_free(entry);
+			continue;
+		}
+
+		retval = dict_set_entry(pd, entry);
+
+		/* pair refused by quota or allocation is not counted, load stops at it */
+		if (retval == 0 && ++snapshot.num_entries % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+
+	if (retval != 0) {
+		pr_err("SNAPSHOT_LOAD: failed with %ld", retval);
+	}
+
+	snapshot.size = stream.size;
+	dict_stream_close(&stream);
+
+	if (copy_to_user(user_snapshot, &snapshot, sizeof(dict_snapshot))) {
+		pr_err("SNAPSHOT_LOAD: cannot sent results to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Take file by user descriptor and allocate stream buffer
+ *  @param stream Stream to set up
+ *  @param fd User file descriptor
+ *  @return 0 on success, EBADF or ENOMEM otherwise
+ */
+static long dict_stream_open(dict_stream *stream, int fd)
+{
+	stream->file = fget(fd);
+
+	if (stream->file == NULL) {
+		return EBADF;
+	}
+
+	stream->buf = kvmalloc(DICT_SNAPSHOT_CHUNK, GFP_KERNEL);
+
+	if (stream->buf == NULL) {
+		fput(stream->file);
+		return ENOMEM;
+	}
+
+	stream->pos = stream->file->f_pos;
+	stream->len = 0;
+	stream->off = 0;
+	stream->size = 0;
+
+	return 0;
+}
+
+
+/** @brief Move file position past consumed bytes, release file and buffer;
+ *  bytes read ahead but not consumed are given back to seekable files
+ *  @param stream Stream to close
+ */
+static void dict_stream_close(dict_stream *stream)
+{
+	if (!(stream->file->f_mode & FMODE_STREAM)) {
+		stream->file->f_pos = stream->pos - (stream->len - stream->off);
+	}
+
+	fput(stream->file);
+	kvfree(stream->buf);
+}
+
+
+/** @brief Append bytes to stream, writing buffer out whenever it fills up;
+ *  pieces at least as large as buffer are written directly
+ *  @param stream Stream being written
+ *  @param data Bytes to write
+ *  @param len Number of bytes
+ *  @return 0 on success, error of the write otherwise
+ */
+static long dict_stream_write(dict_stream *stream, const void *data, size_t len)
+{
+	long retval;
+
+	if (stream->len + len > DICT_SNAPSHOT_CHUNK) {
+		retval = dict_stream_flush(stream);
+
+		if (retval != 0) {
+			return retval;
+		}
+	}
+
+	if (len >= DICT_SNAPSHOT_CHUNK) {
+		return dict_stream_kernel_write(stream, data, len);
+	}
+
+	memcpy(stream->buf + stream->len, data, len);
+	stream->len += len;
+
+	return 0;
+}
+
+
+/** @brief Write out buffered bytes
+ *  @param stream Stream being written
+ *  @return 0 on success, error of the write otherwise
+ */
+static long dict_stream_flush(dict_stream *stream)
+{
+	long retval = dict_stream_kernel_write(stream, stream->buf, stream->len);
+
+	stream->len = 0;
+	return retval;
+}
+
+
+/** @brief Write all bytes to the file, repeating on short writes
+ *  @param stream Stream being written
+ *  @param data Bytes to write
+ *  @param len Number of bytes
+ *  @return 0 on success, EIO if file takes no more, error of the write otherwise
+ */
+static long dict_stream_kernel_write(dict_stream *stream, const void *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = kernel_write(stream->file, data, len, &stream->pos);
+
+		if (ret <= 0) {
+			return ret < 0 ? -ret : EIO;
+		}
+
+		data += ret;
+		len -= ret;
+		stream->size += ret;
+	}
+
+	return 0;
+}
+
+
+/** @brief Take next bytes of stream, reading file in DICT_SNAPSHOT_CHUNK pieces;
+ *  remainder at least as large as buffer is read directly into destination
+ *  @param stream Stream being read
+ *  @param data Destination
+ *  @param len Number of bytes
+ *  @return 0 on success, EIO if stream ended before len bytes, error of the
+ *  read otherwise
+ */
+static long dict_stream_read(dict_stream *stream, void *data, size_t len)
+{
+	size_t n;
+	ssize_t ret;
+
+	while (len > 0) {
+		if (stream->off == stream->len) {
+			stream->off = 0;
+			stream->len = 0;
+
+			if (len >= DICT_SNAPSHOT_CHUNK) {
+				ret = kernel_read(stream->file, data, len, &stream->pos);
+			} else {
+				ret = kernel_read(stream->file, stream->buf, DICT_SNAPSHOT_CHUNK, &stream->pos);
+			}
+
+			if (ret <= 0) {
+				return ret < 0 ? -ret : EIO;
+			}
+
+			stream->size += ret;
+
+			if (len >= DICT_SNAPSHOT_CHUNK) {
+				data += ret;
+				len -= ret;
+				continue;
+			}
+
+			stream->len = ret;
+		}
+
+		n = min(len, stream->len - stream->off);
+		memcpy(data, stream->buf + stream->off, n);
+
+		stream->off += n;
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+/*
+ *
+ *                                  DICT CORE API
+ *
+ */
+
+
+/** @brief Dictionary constructor; sets up each shard and lets table engine
+ *  allocate its initial table
+ *  @param num_shards Number of independent sub-tables
+ *  @param engine Table engine used by all shards
+ *  @return dict pointer to initilized object
+ */
+static dict *dict_create(unsigned int num_shards, const dict_engine *engine)
+{
+	unsigned int i;
+	dict_shard *shard;
+	dict *pd = kzalloc(struct_size(pd, shards, num_shards), GFP_KERNEL);
+
+	if (pd == NULL) {
+		pr_err("DICT_CREATE: kmalloc for dict failed");
+		return NULL;
+	}
+
+	pd->engine = engine;
+	INIT_DELAYED_WORK(&pd->expire_work, dict_expire_work_fn);
+	pd->stats = alloc_percpu(dict_cache_stats);
+
+	if (pd->stats == NULL) {
+		pr_err("DICT_CREATE: statistics allocation failed");
+		kfree(pd);
+		return NULL;
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		shard = &pd->shards[i];
+		shard->num_entries = 0;
+		shard->bytes = 0;
+		mutex_init(&shard->shard_mutex);
+		seqcount_mutex_init(&shard->dict_seq, &shard->shard_mutex);
+
+		shard->expire_wheel = kcalloc(DICT_EXPIRE_SLOTS, sizeof(struct hlist_head), GFP_KERNEL);
+		shard->expire_tick = div_u64(get_jiffies_64(), DICT_EXPIRE_TICK);
+		INIT_HLIST_HEAD(&shard->expire_pending);
+
+		if (shard->expire_wheel == NULL) {
+			pr_err("DICT_CREATE: expiry wheel allocation failed");
+			dict_destroy(pd);
+			return NULL;
+		}
+
+		if (engine->init(shard)) {
+			pr_err("DICT_CREATE: %s table allocation failed", engine->name);
+			kfree(shard->expire_wheel);
+			dict_destroy(pd);
+			return NULL;
+		}
+
+		/* only fully initialized shards are destroyed on failure */
+
+		pd->num_shards = i + 1;
+	}
+
+	return pd;
+}
+
+
+/** @brief Dictionary descructor; lets engine free every shard's tables and entries;
+ *  called when no readers can be left, so entries are freed immediately
+ *  @param pd Pointer to a shared dictionary object
+ *  @return NULL
+ */
+static void dict_destroy(dict *d)
+{
+	unsigned int s;
+
+	cancel_delayed_work_sync(&d->expire_work);
+
+	for (s = 0; s < d->num_shards; s++) {
+		d->engine->destroy(&d->shards[s]);
+		kfree(d->shards[s].expire_wheel);
+	}
+
+	free_percpu(d->stats);
+	kfree(d);
+}
+
+
+/** @brief Pick shard for the key; uses high bits of the hash, while buckets inside
+ *  shard are picked by low ones, so both stay evenly loaded
+ *  @param pd Pointer to a shared dictionary object
+ *  @param hash Full key hash
+ *  @return Shard that owns the key
+ */
+static dict_shard *dict_shard_of(dict *pd, unsigned long hash)
+{
+	return &pd->shards[reciprocal_scale(upper_32_bits(hash), pd->num_shards)];
+}
+
+
+/** @brief Find table engine by its name
+ *  @param name Value of engine module parameter
+ *  @return Engine, NULL if there is no such
+ */
+static const dict_engine *dict_engine_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(dict_engines); i++) {
+		if (!strcmp(dict_engines[i]->name, name)) {
+			return dict_engines[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @brief Check that entry of pair with given sizes can be allocated
+ *  @param key_size Size of key
+ *  @param value_size Size of value
+ *  @return true if key and value together fit DICT_MAX_PAIR_SIZE
+ */
+static inline bool dict_pair_size_ok(u64 key_size, u64 value_size)
+{
+	return key_size <= DICT_MAX_PAIR_SIZE && value_size <= DICT_MAX_PAIR_SIZE - key_size;
+}
+
+
+/* Key and value bytes are stored right after entry header */
+
+static inline void *dict_entry_key(dict_entry *entry)
+{
+	return entry->data;
+}
+
+static inline void *dict_entry_value(dict_entry *entry)
+{
+	return entry->data + entry->key_size;
+}
+
+
+/** @brief Value bytes to copy out of entry; COUNTER is folded into caller's
+ *  buffer first - base plus every CPU slot, increments that race with it may
+ *  or may not be included
+ *  @param entry Pinned entry or one read under rcu_read_lock()
+ *  @param buf Room for folded COUNTER value
+ *  @return Pointer to value_size bytes of value
+ */
+static const void *dict_entry_value_out(dict_entry *entry, s64 *buf)
+{
+	int cpu;
+
+	if (entry->counter == NULL) {
+		return dict_entry_value(entry);
+	}
+
+	memcpy(buf, dict_entry_value(entry), sizeof(s64));
+
+	for_each_possible_cpu(cpu) {
+		*buf += READ_ONCE(*per_cpu_ptr(entry->counter, cpu));
+	}
+
+	return buf;
+}
+
+
+/** @brief Give COUNTER entry its per-CPU slots, zeroed, so value bytes it was
+ *  set with become the base; done before entry is linked
+ *  @param entry Entry with COUNTER value type, not linked anywhere
+ *  @return 0 on success, EINVAL if value is not 8 bytes, ENOMEM
+ */
+static int dict_counter_init(dict_entry *entry)
+{
+	if (entry->value_size != sizeof(s64)) {
+		return EINVAL;
+	}
+
+	entry->counter = alloc_percpu_gfp(s64, GFP_KERNEL_ACCOUNT);
+
+	return entry->counter != NULL ? 0 : ENOMEM;
+}
+
+
+/** @brief Mark COUNTER entry taken out of the table, so INCR that found it
+ *  before and adds to its slots now retries on whatever pair is current
+ *  @param entry Entry just unlinked, called with shard_mutex held or on table
+ *  detached by FLUSH
+ */
+static void dict_counter_retire(dict_entry *entry)
+{
+	if (entry->counter == NULL) {
+		return;
+	}
+
+	WRITE_ONCE(entry->retired, true);
+	/* pairs with barrier of INCR between its add and check of the flag */
+	smp_mb();
+}
+
+
+/** @brief Check whether entry holds given key; full hash is compared first,
+ *  so key bytes are read only on likely match
+ *  @param entry Entry to check
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return true if keys are equal
+ */
+static inline bool dict_entry_matches(dict_entry *entry, unsigned long hash,
+				      const void *key, size_t key_size)
+{
+	return entry->key_hash == hash && entry->key_size == key_size
+		&& !memcmp(dict_entry_key(entry), key, key_size);
+}
+
+
+/** @brief Allocate entry with room for key and value in the same block, charged
+ *  to memory cgroup of the caller; only sizes and reference are initialized,
+ *  rest is filled in by caller
+ *  @param key_size Size of key, with value_size checked by dict_pair_size_ok()
+ *  @param value_size Size of value
+ *  @return Entry pointer, NULL if allocation failed
+ */
+static dict_entry *dict_entry_alloc(size_t key_size, size_t value_size)
+{
+	int class;
+	size_t size;
+	dict_entry *entry;
+
+	size = struct_size(entry, data, key_size + value_size);
+	class = dict_size_class_of(size);
+
+	if (class < DICT_NUM_SIZE_CLASSES) {
+		entry = kmem_cache_alloc(dict_size_classes[class].cache, GFP_KERNEL);
+	} else {
+		entry = kvmalloc(size, GFP_KERNEL_ACCOUNT | __GFP_NOWARN);
+	}
+
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	if (class < DICT_NUM_SIZE_CLASSES) {
+		atomic_long_inc(&dict_size_classes[class].in_use);
+	} else {
+		atomic_long_inc(&dict_large_entries);
+		atomic_long_add(size, &dict_large_bytes);
+	}
+
+	entry->key_size = key_size;
+	entry->value_size = value_size;
+	entry->counter = NULL;
+	entry->expires = 0;
+	entry->referenced = false;
+	entry->retired = false;
+	refcount_set(&entry->refs, 1);
+
+	return entry;
+}
+
+
+/** @brief Free entry right away, back to the cache of its size class
+ *  @param entry Entry that no one can reach anymore
+ */
+static void dict_entry_free(dict_entry *entry)
+{
+	int class;
+	size_t size;
+
+	size = struct_size(entry, data, (size_t)entry->key_size + entry->value_size);
+	class = dict_size_class_of(size);
+
+	if (entry->counter != NULL) {
+		free_percpu(entry->counter);
+	}
+
+	if (class < DICT_NUM_SIZE_CLASSES) {
+		atomic_long_dec(&dict_size_classes[class].in_use);
+		kmem_cache_free(dict_size_classes[class].cache, entry);
+	} else {
+		atomic_long_dec(&dict_large_entries);
+		atomic_long_sub(size, &dict_large_bytes);
+		kvfree(entry);
+	}
+}
+
+
+/** @brief RCU callback - free entry after all readers that could see it are gone
+ *  @param head rcu_head embedded into the entry
+ */
+static void dict_entry_free_rcu(struct rcu_head *head)
+{
+	size_t size;
+	dict_entry *entry = container_of(head, dict_entry, rcu);
+
+	size = struct_size(entry, data, (size_t)entry->key_size + entry->value_size);
+
+	/* slab objects are cheap to free here, big ones go to process context */
+
+	if (dict_size_class_of(size) < DICT_NUM_SIZE_CLASSES) {
+		dict_entry_free(entry);
+		return;
+	}
+
+	if (llist_add(&entry->free_node, &dict_free_list)) {
+		schedule_work(&dict_free_work);
+	}
+}
+
+
+/** @brief Free large entries queued by dict_entry_free_rcu(), yielding CPU
+ *  between them, so freeing multi-megabyte values stalls neither RCU callbacks
+ *  nor writers
+ *  @param work dict_free_work
+ */
+static void dict_free_work_fn(struct work_struct *work)
+{
+	dict_entry *curr;
+	dict_entry *next;
+	struct llist_node *nodes = llist_del_all(&dict_free_list);
+
+	llist_for_each_entry_safe(curr, next, nodes, free_node) {
+		dict_entry_free(curr);
+		cond_resched();
+	}
+}
+
+
+/** @brief Drop a reference to the entry; the last one frees it after a grace
+ *  period, when all readers that could see it are gone
+ *  @param entry Entry pinned by the table or by a reader
+ */
+static void dict_entry_put(dict_entry *entry)
+{
+	if (refcount_dec_and_test(&entry->refs)) {
+		call_rcu(&entry->rcu, dict_entry_free_rcu);
+	}
+}
+
+
+/** @brief Drop table reference of entry that no reader could reach for a
+ *  grace period already, so the last reference frees it right away
+ *  @param entry Entry of detached table, may still be pinned by a reader
+ */
+static void dict_entry_put_unlinked(dict_entry *entry)
+{
+	if (refcount_dec_and_test(&entry->refs)) {
+		dict_entry_free(entry);
+	}
+}
+
+
+
+/** @brief Set pair from key and value in kernel memory, copying them into new entry
+ *  @param pd  Pointer to a shared dictionary object
+ *  @param key  Pointer to key location in memory
+ *  @param value  Pointer to value location in memory
+ *  @param msg_dict Container from user that contains size/type info
+ *  @return 0 on success, ENOMEM if allocation failed
+ */
+static int dict_set(dict *pd, void *key, void *value, dict_pair *msg_dict)
+{
+	dict_entry *new_entry;
+
+	new_entry = dict_entry_alloc(msg_dict->key_size, msg_dict->value_size);
+
+	if (new_entry == NULL) {
+		return ENOMEM;
+	}
+
+	memcpy(dict_entry_key(new_entry), key, msg_dict->key_size);
+	memcpy(dict_entry_value(new_entry), value, msg_dict->value_size);
+
+	/* hash the copy, key may live in memory user can change */
+
+	new_entry->key_hash         = dict_hash(dict_entry_key(new_entry), new_entry->key_size);
+	new_entry->key_type         = msg_dict->key_type;
+	new_entry->value_type       = msg_dict->value_type;
+
+	return dict_set_entry(pd, new_entry);
+}
+
+
+/** @brief Search for pair with matching key in dict; if exists - replace it with
+ *  the new entry, else - insert new entry; readers can look at the table at any
+ *  point, so entries are only published, never modified; entry is allocated and
+ *  filled by caller, so shard_mutex is held only for table update
+ *  @param pd  Pointer to a shared dictionary object
+ *  @param new_entry Complete entry with hash, not linked anywhere, freed on failure
+ *  @return 0 on success, ENOMEM if table could not grow, EINVAL if COUNTER
+ *  value is not 8 bytes
+ */
+static int dict_set_entry(dict *pd, dict_entry *new_entry)
+{
+	return dict_update_entry(pd, new_entry, NULL, NULL);
+}
+
+
+/** @brief Set entry as dict_set_entry() does, but let prepare() look at the
+ *  current pair first, under the same shard_mutex, and refuse the update or
+ *  finish new entry from it, so read-modify-write of a pair is atomic against
+ *  other writers; new entry gets next version of the shard before that
+ *  @param pd  Pointer to a shared dictionary object
+ *  @param new_entry Entry with hash and key, not linked anywhere, freed on failure
+ *  @param prepare Called with current entry or NULL; NULL sets unconditionally
+ *  @param arg Passed to prepare
+ *  @return 0 on success, error returned by prepare, ENOMEM if table could not
+ *  grow, EINVAL if COUNTER value is not 8 bytes, EDQUOT if pair does not fit
+ *  quotas of the device
+ */
+static int dict_update_entry(dict *pd, dict_entry *new_entry,
+			     int (*prepare)(dict_entry *, dict_entry *, void *), void *arg)
+{
+	int retval;
+	u64 expires;
+	size_t bytes;
+	bool quota;
+	unsigned long budget;
+	dict_shard *shard;
+	dict_entry *old_entry;
+	dict_entry *prev = NULL;
+
+	if (new_entry->value_type == DICT_TYPE_COUNTER && new_entry->counter == NULL) {
+		retval = dict_counter_init(new_entry);
+
+		if (retval != 0) {
+			dict_entry_free(new_entry);
+			return retval;
+		}
+	}
+
+	/* make room before taking shard_mutex, hand may need to take it as well */
+	bytes = dict_entry_bytes(new_entry);
+	budget = READ_ONCE(max_bytes);
+
+	if (budget != 0 && atomic_long_read(&pd->bytes) + bytes > budget) {
+		dict_evict(pd, budget - min(bytes, (size_t)budget));
+	}
+
+	shard = dict_shard_of(pd, new_entry->key_hash);
+	mutex_lock(&shard->shard_mutex);
+
+	new_entry->version = ++shard->version;
+	quota = READ_ONCE(pd->quota_bytes) != 0 || READ_ONCE(pd->quota_entries) != 0;
+
+	if (prepare != NULL || quota) {
+		/* other writers are locked out, so pair found stays current until unlock */
+		rcu_read_lock();
+		prev = pd->engine->lookup(shard, new_entry->key_hash,
+					  dict_entry_key(new_entry), new_entry->key_size);
+		rcu_read_unlock();
+	}
+
+	if (prepare != NULL) {
+		/* expired pair is absent for the update, it is replaced all the same */
+		retval = prepare(prev != NULL && dict_entry_expired(prev) ? NULL : prev, new_entry, arg);
+
+		if (retval != 0) {
+			mutex_unlock(&shard->shard_mutex);
+			dict_entry_free(new_entry);
+			return retval;
+		}
+	}
+
+	/* pair is charged before it is linked, so SETs on other shards cannot pass quota together */
+	if (quota) {
+		retval = dict_quota_charge(pd, shard, new_entry, prev);
+
+		if (retval != 0) {
+			mutex_unlock(&shard->shard_mutex);
+			dict_entry_free(new_entry);
+			return retval;
+		}
+	}
+
+	old_entry = pd->engine->insert(shard, new_entry);
+
+	if (IS_ERR(old_entry)) {
+		if (quota) {
+			dict_account_sub(pd, shard, new_entry);
+
+			if (prev != NULL) {
+				dict_account_add(pd, shard, prev);
+			}
+		}
+
+		mutex_unlock(&shard->shard_mutex);
+		dict_entry_free(new_entry);
+		return ENOMEM;
+	}
+
+	if (old_entry == NULL) {
+		shard->num_entries++;
+	} else {
+		dict_expire_unlink(shard, old_entry);
+		dict_counter_retire(old_entry);
+	}
+
+	if (!quota) {
+		dict_account_add(pd, shard, new_entry);
+
+		if (old_entry != NULL) {
+			dict_account_sub(pd, shard, old_entry);
+		}
+	}
+
+	dict_expire_link(shard, new_entry);
+	expires = new_entry->expires;
+
+	mutex_unlock(&shard->shard_mutex);
+
+	if (old_entry != NULL) {
+		dict_entry_put(old_entry);
+	}
+
+	/* sweep stops once nothing expires, so pair that does restarts it */
+	if (expires != 0 && !delayed_work_pending(&pd->expire_work)) {
+		schedule_delayed_work(&pd->expire_work, DICT_EXPIRE_TICK);
+	}
+
+	return 0;
+}
+
+
+/** @brief Get entry by the provided key with respective size; lockless, must be
+ *  called under rcu_read_lock(), result stays valid until rcu_read_unlock()
+ *  unless pinned via its refs
+ *  @param pd  Pointer to a shared dictionary object
+ *  @param key  Pointer to key location in memory
+ *  @param key_size  size of key, follows sizeof() format with size_t
+ *  @return Entry containing value for matching key; NULL if pair does not exist
+ */
+static dict_entry *dict_get(dict *pd, const void *key, const size_t key_size)
+{
+	unsigned long hash;
+
+	dict_entry *entry;
+
+	hash = dict_hash(key, key_size);
+	entry = pd->engine->lookup(dict_shard_of(pd, hash), hash, key, key_size);
+
+	/* expired pair is gone for readers before expiry work reclaims it */
+	if (entry == NULL || dict_entry_expired(entry)) {
+		this_cpu_inc(pd->stats->misses);
+		return NULL;
+	}
+
+	this_cpu_inc(pd->stats->hits);
+
+	/* hot pairs would keep bouncing the line if the bit was written every time */
+	if (!READ_ONCE(entry->referenced)) {
+		WRITE_ONCE(entry->referenced, true);
+	}
+
+	return entry;
+}
+
+
+/** @brief Pair deletion - unlink pair if it exists, else do nothing; memory is
+ *  released once concurrent readers are done with it
+ *  @param pd Pointer to a shared dictionary object
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ */
+static void dict_del(dict *pd, void *key, size_t key_size)
+{
+	unsigned long hash;
+	dict_shard *shard;
+	dict_entry *curr;
+
+	hash = dict_hash(key, key_size);
+	shard = dict_shard_of(pd, hash);
+	mutex_lock(&shard->shard_mutex);
+
+	curr = pd->engine->remove(shard, hash, key, key_size);
+
+	if (curr != NULL) {
+		shard->num_entries--;
+		dict_expire_unlink(shard, curr);
+		dict_counter_retire(curr);
+		dict_account_sub(pd, shard, curr);
+		pd->engine->shrink(shard);
+	}
+
+	mutex_unlock(&shard->shard_mutex);
+
+	if (curr != NULL) {
+		dict_entry_put(curr);
+	}
+}
+
+
+/** @brief Size tables of all shards for given number of pairs in advance, so
+ *  that many inserts do not resize them on the way; best effort, table that
+ *  cannot be allocated is left as is and grows as usual
+ *  @param pd Pointer to a shared dictionary object
+ *  @param num_entries Expected number of pairs in whole dictionary
+ */
+static void dict_reserve(dict *pd, unsigned long num_entries)
+{
+	unsigned int s;
+	unsigned long per_shard;
+	dict_shard *shard;
+
+	/* keys spread over shards evenly, leave some room for the deviation */
+
+	per_shard = min(num_entries / pd->num_shards, DICT_RESERVE_MAX);
+	per_shard += per_shard / 8;
+
+	for (s = 0; s < pd->num_shards; s++) {
+		shard = &pd->shards[s];
+
+		mutex_lock(&shard->shard_mutex);
+		pd->engine->reserve(shard, per_shard);
+		mutex_unlock(&shard->shard_mutex);
+	}
+}
+
+
+/** @brief Allocate entry array of scan batch, DICT_SCAN_BATCH to start with
+ *  @param batch Batch to set up
+ *  @return 0 on success, ENOMEM otherwise
+ */
+static int dict_scan_batch_init(dict_scan_batch *batch)
+{
+	batch->count = 0;
+	batch->error = 0;
+	batch->raw = false;
+	batch->capacity = DICT_SCAN_BATCH;
+	batch->entries = kmalloc_array(batch->capacity, sizeof(dict_entry *), GFP_KERNEL);
+
+	return batch->entries != NULL ? 0 : ENOMEM;
+}
+
+
+/** @brief Collect entries of one scan position into batch, holding shard
+ *  mutex only for that; batch error is set if collecting failed
+ *  @param pd Pointer to a shared dictionary object
+ *  @param cursor Scan cursor - shard index and bucket cursor in it
+ *  @param batch Batch to fill, emptied first
+ *  @return Cursor of next position, 0 after the last one
+ */
+static u64 dict_scan_step(dict *pd, u64 cursor, dict_scan_batch *batch)
+{
+	unsigned long next;
+	unsigned long shard_id = cursor >> DICT_SCAN_SHARD_SHIFT;
+	dict_shard *shard = &pd->shards[shard_id];
+
+	batch->count = 0;
+	batch->error = 0;
+
+	mutex_lock(&shard->shard_mutex);
+	next = pd->engine->scan(shard, cursor & (BIT_ULL(DICT_SCAN_SHARD_SHIFT) - 1), batch);
+	mutex_unlock(&shard->shard_mutex);
+
+	if (next != 0) {
+		return ((u64)shard_id << DICT_SCAN_SHARD_SHIFT) | next;
+	}
+
+	return shard_id + 1 < pd->num_shards ? (u64)(shard_id + 1) << DICT_SCAN_SHARD_SHIFT : 0;
+}
+
+
+/** @brief Pin entry found by engine scan and add it to the batch, raw batch
+ *  takes it as is; called with shard_mutex held, so entry is linked and has a reference
+ *  @param batch Entries of current cursor position, grown as needed
+ *  @param entry Entry to add
+ */
+static void dict_scan_collect(dict_scan_batch *batch, dict_entry *entry)
+{
+	s64 counter;
+	dict_entry *copy;
+	dict_entry **entries;
+
+	/* eviction looks at linked entries as they are, expired ones first of all */
+	if (batch->raw) {
+		if (batch->count < batch->capacity) {
+			batch->entries[batch->count++] = entry;
+		}
+
+		return;
+	}
+
+	if (batch->error != 0 || dict_entry_expired(entry)) {
+		return;
+	}
+
+	if (batch->count == batch->capacity) {
+		entries = krealloc_array(batch->entries, batch->capacity * 2, sizeof(dict_entry *), GFP_KERNEL);
+
+		if (entries == NULL) {
+			batch->error = ENOMEM;
+			return;
+		}
+
+		batch->entries = entries;
+		batch->capacity *= 2;
+	}
+
+	/* records are copied out of entry data, so counter goes as folded copy */
+	if (entry->counter != NULL) {
+		copy = dict_entry_alloc(entry->key_size, entry->value_size);
+
+		if (copy == NULL) {
+			batch->error = ENOMEM;
+			return;
+		}
+
+		memcpy(dict_entry_key(copy), dict_entry_key(entry), entry->key_size);
+		memcpy(dict_entry_value(copy), dict_entry_value_out(entry, &counter), entry->value_size);
+		copy->key_hash      = entry->key_hash;
+		copy->key_type      = entry->key_type;
+		copy->value_type    = entry->value_type;
+		copy->version       = entry->version;
+
+		batch->entries[batch->count++] = copy;
+		return;
+	}
+
+	refcount_inc(&entry->refs);
+	batch->entries[batch->count++] = entry;
+}
+
+
+/** @brief Reverse bit order of the whole word
+ *  @param v Value to reverse
+ *  @return v with bit 0 swapped with the highest bit and so on
+ */
+static inline unsigned long dict_scan_rev(unsigned long v)
+{
+#if BITS_PER_LONG == 64
+	return ((unsigned long)bitrev32(v) << 32) | bitrev32(v >> 32);
+#else
+	return bitrev32(v);
+#endif
+}
+
+
+/** @brief Advance scan cursor - increment bucket index starting from its high
+ *  bits (reverse binary order); when table doubles, bucket i splits into i and
+ *  i + size, which in this order come right after each other, and when it
+ *  halves they merge back, so positions already visited stay visited and
+ *  no key present during the whole scan is missed by a resize in between
+ *  @param cursor Current bucket cursor
+ *  @param mask Table size minus one
+ *  @return Next cursor, 0 when all buckets were visited
+ */
+static inline unsigned long dict_scan_next(unsigned long cursor, unsigned long mask)
+{
+	/* set bits above mask, so the carry runs through them and clears them */
+	cursor |= ~mask;
+	cursor = dict_scan_rev(cursor);
+	cursor++;
+	cursor = dict_scan_rev(cursor);
+
+	return cursor;
+}
+
+/*
+ *
+ *                                  EXPIRY
+ *
+ */
+
+
+/** @brief Check whether pair of the entry has expired
+ *  @param entry Entry to check
+ *  @return true if it has TTL that ran out
+ */
+static inline bool dict_entry_expired(dict_entry *entry)
+{
+	return entry->expires != 0 && time_after_eq64(get_jiffies_64(), entry->expires);
+}
+
+
+/** @brief Expiry of the entry as wall clock time, for records that outlive
+ *  this boot - SCAN, read() stream and snapshot
+ *  @param entry Pinned entry
+ *  @return CLOCK_REALTIME ms when pair expires, 0 if it never does
+ */
+static u64 dict_expiry_to_real(dict_entry *entry)
+{
+	u64 now = get_jiffies_64();
+	u64 left = 0;
+
+	if (entry->expires == 0) {
+		return 0;
+	}
+
+	/* TTL is at most U32_MAX ms, so remaining jiffies fit unsigned long */
+	if (time_after64(entry->expires, now)) {
+		left = jiffies_to_msecs((unsigned long)(entry->expires - now));
+	}
+
+	return div_u64(ktime_get_real_ns(), NSEC_PER_MSEC) + left + 1;
+}
+
+
+/** @brief Set expiry of entry not linked yet from wall clock time of record
+ *  @param entry New entry, read from write() stream or snapshot
+ *  @param expires_ms CLOCK_REALTIME ms when pair expires, 0 - never
+ *  @return false if that time has passed already, so pair is not to be set
+ */
+static bool dict_expiry_from_real(dict_entry *entry, u64 expires_ms)
+{
+	u64 now_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+
+	entry->expires = 0;
+
+	if (expires_ms == 0) {
+		return true;
+	}
+
+	if (expires_ms <= now_ms) {
+		return false;
+	}
+
+	entry->expires = get_jiffies_64() + msecs_to_jiffies(min_t(u64, expires_ms - now_ms, U32_MAX));
+	return true;
+}
+
+
+/** @brief Add entry that has TTL to the wheel slot of its expiry tick; called
+ *  with shard_mutex held, right after entry was linked into the table
+ *  @param shard Shard entry belongs to
+ *  @param entry Entry just linked
+ */
+static void dict_expire_link(dict_shard *shard, dict_entry *entry)
+{
+	u64 tick;
+
+	if (entry->expires == 0) {
+		return;
+	}
+
+	tick = div_u64(entry->expires, DICT_EXPIRE_TICK);
+	hlist_add_head(&entry->expire_node, &shard->expire_wheel[tick & (DICT_EXPIRE_SLOTS - 1)]);
+	shard->num_expiring++;
+}
+
+
+/** @brief Take entry that has TTL off the wheel; called with shard_mutex held,
+ *  right after entry was unlinked from the table, before its reference is put
+ *  @param shard Shard entry belongs to
+ *  @param entry Entry just unlinked
+ */
+static void dict_expire_unlink(dict_shard *shard, dict_entry *entry)
+{
+	if (entry->expires == 0) {
+		return;
+	}
+
+	hlist_del(&entry->expire_node);
+	shard->num_expiring--;
+}
+
+
+/** @brief Reclaim expired entries from wheel slots of ticks that have come
+ *  since the last sweep (each slot once if that is more than a lap); slot is
+ *  moved to expire_pending and taken off it under shard_mutex in rounds of at
+ *  most DICT_EXPIRE_VISIT entries, expired ones reclaimed and put after the
+ *  mutex is dropped, ones of later laps put back into the slot; every entry
+ *  is visited once per sweep, and writers wait for one round at most
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard to sweep, only expiry work sweeps it
+ *  @return true if shard still has entries that expire later
+ */
+static bool dict_expire_shard(dict *pd, dict_shard *shard)
+{
+	int i;
+	int n;
+	int visited;
+	u64 t;
+	u64 tick = div_u64(get_jiffies_64(), DICT_EXPIRE_TICK);
+	dict_entry *entry;
+	dict_entry *batch[DICT_EXPIRE_BATCH];
+	struct hlist_head *slot;
+
+	t = shard->expire_tick;
+
+	if (tick - t >= DICT_EXPIRE_SLOTS) {
+		t = tick - DICT_EXPIRE_SLOTS + 1;
+	}
+
+	for (; t <= tick; t++) {
+		slot = &shard->expire_wheel[t & (DICT_EXPIRE_SLOTS - 1)];
+
+		mutex_lock(&shard->shard_mutex);
+
+		/* entries linked into the slot from now on are left for the next sweep */
+		hlist_move_list(slot, &shard->expire_pending);
+
+		while (!hlist_empty(&shard->expire_pending)) {
+			n = 0;
+
+			for (visited = 0; visited < DICT_EXPIRE_VISIT && n < DICT_EXPIRE_BATCH
+				     && !hlist_empty(&shard->expire_pending); visited++) {
+				entry = hlist_entry(shard->expire_pending.first, dict_entry, expire_node);
+
+				/* entries of later laps share the slot, they go back */
+				if (!dict_entry_expired(entry)) {
+					hlist_del(&entry->expire_node);
+					hlist_add_head(&entry->expire_node, slot);
+					continue;
+				}
+
+				pd->engine->remove(shard, entry->key_hash, dict_entry_key(entry), entry->key_size);
+				shard->num_entries--;
+				dict_expire_unlink(shard, entry);
+				dict_counter_retire(entry);
+				dict_account_sub(pd, shard, entry);
+				batch[n++] = entry;
+			}
+
+			if (n > 0) {
+				pd->engine->shrink(shard);
+			}
+
+			mutex_unlock(&shard->shard_mutex);
+
+			for (i = 0; i < n; i++) {
+				dict_entry_put(batch[i]);
+			}
+
+			atomic_long_add(n, &dict_expired_entries);
+			cond_resched();
+
+			mutex_lock(&shard->shard_mutex);
+		}
+
+		mutex_unlock(&shard->shard_mutex);
+	}
+
+	/* current tick may still get entries, it is swept again next time */
+	shard->expire_tick = tick;
+
+	return READ_ONCE(shard->num_expiring) != 0;
+}
+
+
+/** @brief Expiry work - sweep shards that have expiring entries, and run again
+ *  next tick while any are left; pair set with TTL starts it again
+ *  @param work expire_work of the dictionary
+ */
+static void dict_expire_work_fn(struct work_struct *work)
+{
+	unsigned int s;
+	bool pending = false;
+	u64 start = ktime_get_ns();
+	dict *pd = container_of(to_delayed_work(work), dict, expire_work);
+
+	for (s = 0; s < pd->num_shards; s++) {
+		if (READ_ONCE(pd->shards[s].num_expiring) != 0) {
+			pending |= dict_expire_shard(pd, &pd->shards[s]);
+		}
+	}
+
+	atomic64_add(ktime_get_ns() - start, &dict_expire_ns);
+
+	if (pending) {
+		schedule_delayed_work(&pd->expire_work, DICT_EXPIRE_TICK);
+	}
+}
+
+/*
+ *
+ *                                  ACCOUNTING
+ *
+ */
+
+
+/** @brief Bytes entry takes against max_bytes and quota - its slab object or
+ *  kvmalloc size, and COUNTER slots of all CPUs
+ *  @param entry Entry to size
+ *  @return Size in bytes
+ */
+static size_t dict_entry_bytes(dict_entry *entry)
+{
+	int class;
+	size_t size;
+
+	size = struct_size(entry, data, (size_t)entry->key_size + entry->value_size);
+	class = dict_size_class_of(size);
+
+	if (class < DICT_NUM_SIZE_CLASSES) {
+		size = dict_size_classes[class].size;
+	}
+
+	if (entry->counter != NULL) {
+		size += num_possible_cpus() * sizeof(s64);
+	}
+
+	return size;
+}
+
+
+/** @brief Count linked entry in bytes and entries of the device; called
+ *  with shard_mutex held, right after entry was linked
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard entry was linked to
+ *  @param entry Entry just linked
+ */
+static void dict_account_add(dict *pd, dict_shard *shard, dict_entry *entry)
+{
+	size_t bytes = dict_entry_bytes(entry);
+
+	shard->bytes += bytes;
+	atomic_long_add(bytes, &pd->bytes);
+	atomic_long_inc(&pd->entries);
+}
+
+
+/** @brief Take unlinked entry off bytes and entries of the device; called
+ *  with shard_mutex held, right after entry was unlinked
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard entry was unlinked from
+ *  @param entry Entry just unlinked
+ */
+static void dict_account_sub(dict *pd, dict_shard *shard, dict_entry *entry)
+{
+	size_t bytes = dict_entry_bytes(entry);
+
+	shard->bytes -= bytes;
+	atomic_long_sub(bytes, &pd->bytes);
+	atomic_long_dec(&pd->entries);
+}
+
+
+/** @brief Account new entry in place of old one if that stays within quotas
+ *  of the device; counters go up first and back if they pass the quota, so
+ *  SETs racing on other shards cannot pass it together; replacing pair with
+ *  a smaller one always fits
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard of the pair, its mutex is held
+ *  @param new_entry Entry about to be linked
+ *  @param old_entry Entry it replaces, NULL for new key
+ *  @return 0 if accounted, EDQUOT if pair does not fit
+ */
+static int dict_quota_charge(dict *pd, dict_shard *shard, dict_entry *new_entry, dict_entry *old_entry)
+{
+	long delta = dict_entry_bytes(new_entry);
+	unsigned long quota_bytes = READ_ONCE(pd->quota_bytes);
+	unsigned long quota_entries = READ_ONCE(pd->quota_entries);
+
+	if (old_entry != NULL) {
+		delta -= dict_entry_bytes(old_entry);
+	} else if (atomic_long_inc_return(&pd->entries) > quota_entries && quota_entries != 0) {
+		atomic_long_dec(&pd->entries);
+		return EDQUOT;
+	}
+
+	if (atomic_long_add_return(delta, &pd->bytes) > quota_bytes && quota_bytes != 0 && delta > 0) {
+		atomic_long_sub(delta, &pd->bytes);
+
+		if (old_entry == NULL) {
+			atomic_long_dec(&pd->entries);
+		}
+
+		return EDQUOT;
+	}
+
+	shard->bytes += delta;
+	return 0;
+}
+
+
+/** @brief sysfs "quota_bytes" of the device - bytes of pairs SET may not go over
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Page to print into
+ *  @return Number of bytes printed
+ */
+static ssize_t quota_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	dict *pd = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(pd->quota_bytes));
+}
+
+
+/** @brief Set quota_bytes of the device, 0 removes it; pairs over the new
+ *  quota stay, only growth is refused
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Written number
+ *  @param count Size of buf
+ *  @return count on success, -EINVAL if it is not a number
+ */
+static ssize_t quota_bytes_store(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	unsigned long value;
+	dict *pd = dev_get_drvdata(dev);
+
+	if (kstrtoul(buf, 0, &value)) {
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(pd->quota_bytes, value);
+	return count;
+}
+
+
+/** @brief sysfs "quota_entries" of the device - pairs SET may not go over
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Page to print into
+ *  @return Number of bytes printed
+ */
+static ssize_t quota_entries_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	dict *pd = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(pd->quota_entries));
+}
+
+
+/** @brief Set quota_entries of the device, 0 removes it
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Written number
+ *  @param count Size of buf
+ *  @return count on success, -EINVAL if it is not a number
+ */
+static ssize_t quota_entries_store(struct device *dev, struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	unsigned long value;
+	dict *pd = dev_get_drvdata(dev);
+
+	if (kstrtoul(buf, 0, &value)) {
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(pd->quota_entries, value);
+	return count;
+}
+
+
+/** @brief sysfs "bytes" of the device - bytes its pairs take now
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Page to print into
+ *  @return Number of bytes printed
+ */
+static ssize_t bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	dict *pd = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&pd->bytes));
+}
+
+
+/** @brief sysfs "entries" of the device - number of its pairs
+ *  @param dev Device node, its driver data is the dictionary
+ *  @param attr Attribute
+ *  @param buf Page to print into
+ *  @return Number of bytes printed
+ */
+static ssize_t entries_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	dict *pd = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&pd->entries));
+}
+
+/*
+ *
+ *                                  EVICTION
+ *
+ */
+
+
+/** @brief Move CLOCK hand of the shard over its scan positions and evict
+ *  entries it finds not referenced since its last pass, or expired; referenced
+ *  ones get the bit cleared and a second chance; two laps at most, so shard
+ *  with any entries always gives some
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard to evict from
+ *  @param nr Number of entries to evict at most
+ *  @param reclaim Called from shrinker - give up instead of waiting for
+ *  shard_mutex (allocation under the same mutex may have got there), and
+ *  leave table size alone, resize would allocate in reclaim; next write
+ *  or delete on the shard shrinks it
+ *  @return Number of entries evicted
+ */
+static unsigned long dict_evict_shard(dict *pd, dict_shard *shard, unsigned long nr, bool reclaim)
+{
+	int i;
+	int n;
+	int steps;
+	int laps = 0;
+	unsigned long evicted = 0;
+	dict_entry *entry;
+	dict_entry *slots[DICT_SCAN_BATCH];
+	dict_entry *victims[DICT_EVICT_BATCH];
+	dict_scan_batch batch = {
+		.entries = slots,
+		.capacity = DICT_SCAN_BATCH,
+		.raw = true,
+	};
+
+	while (evicted < nr && laps < 2) {
+		n = 0;
+
+		if (reclaim) {
+			if (!mutex_trylock(&shard->shard_mutex)) {
+				break;
+			}
+		} else {
+			mutex_lock(&shard->shard_mutex);
+		}
+
+		for (steps = 0; steps < DICT_EVICT_STEPS && laps < 2; steps++) {
+			batch.count = 0;
+			shard->clock_hand = pd->engine->scan(shard, shard->clock_hand, &batch);
+			laps += shard->clock_hand == 0;
+
+			for (i = 0; i < batch.count && n < DICT_EVICT_BATCH && evicted + n < nr; i++) {
+				entry = batch.entries[i];
+
+				if (READ_ONCE(entry->referenced) && !dict_entry_expired(entry)) {
+					WRITE_ONCE(entry->referenced, false);
+					continue;
+				}
+
+				pd->engine->remove(shard, entry->key_hash, dict_entry_key(entry), entry->key_size);
+				shard->num_entries--;
+				dict_expire_unlink(shard, entry);
+				dict_counter_retire(entry);
+				dict_account_sub(pd, shard, entry);
+				victims[n++] = entry;
+			}
+
+			if (n == DICT_EVICT_BATCH || evicted + n == nr) {
+				break;
+			}
+		}
+
+		if (n > 0 && !reclaim) {
+			pd->engine->shrink(shard);
+		}
+
+		mutex_unlock(&shard->shard_mutex);
+
+		for (i = 0; i < n; i++) {
+			dict_entry_put(victims[i]);
+		}
+
+		evicted += n;
+		cond_resched();
+	}
+
+	return evicted;
+}
+
+
+/** @brief Evict by CLOCK until pairs take at most target bytes; shards are
+ *  taken round robin, DICT_EVICT_BATCH entries from each, until a whole round
+ *  evicts nothing; concurrent writers may overshoot the budget for a moment
+ *  @param pd Pointer to a shared dictionary object
+ *  @param target Bytes to get down to
+ */
+static void dict_evict(dict *pd, long target)
+{
+	unsigned int s;
+	unsigned int idle = 0;
+	unsigned long n;
+
+	while (atomic_long_read(&pd->bytes) > target && idle < pd->num_shards) {
+		s = (unsigned int)atomic_inc_return(&pd->clock_shard) % pd->num_shards;
+		n = dict_evict_shard(pd, &pd->shards[s], DICT_EVICT_BATCH, false);
+
+		atomic_long_add(n, &pd->evicted);
+		idle = n != 0 ? 0 : idle + 1;
+	}
+}
+
+
+/** @brief Shrinker count callback - pairs that can be given back; none while
+ *  there is no budget, then pairs are data, not cache
+ *  @param shrinker Driver's shrinker
+ *  @param sc Reclaim context
+ *  @return Number of pairs, SHRINK_EMPTY if none
+ */
+static unsigned long dict_shrink_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	unsigned int d;
+	unsigned int s;
+	unsigned long count = 0;
+
+	if (READ_ONCE(max_bytes) == 0) {
+		return SHRINK_EMPTY;
+	}
+
+	for (d = 0; d < num_devices; d++) {
+		for (s = 0; s < dicts[d]->num_shards; s++) {
+			count += READ_ONCE(dicts[d]->shards[s].num_entries);
+		}
+	}
+
+	return count != 0 ? count : SHRINK_EMPTY;
+}
+
+
+/** @brief Shrinker scan callback - evict up to nr_to_scan pairs by CLOCK,
+ *  one dictionary after another starting from the one after last call, so
+ *  every device gives its share; shards whose mutex is taken are skipped,
+ *  and so is reclaim that may not sleep, eviction reschedules between rounds
+ *  @param shrinker Driver's shrinker
+ *  @param sc Reclaim context
+ *  @return Number of pairs evicted, SHRINK_STOP if none could be
+ */
+static unsigned long dict_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	unsigned int d;
+	unsigned int i;
+	unsigned int s;
+	unsigned int first;
+	unsigned long n;
+	unsigned long freed = 0;
+	dict *pd;
+
+	if (READ_ONCE(max_bytes) == 0 || !gfpflags_allow_blocking(sc->gfp_mask)) {
+		return SHRINK_STOP;
+	}
+
+	first = (unsigned int)atomic_inc_return(&dict_shrink_next);
+
+	for (d = 0; d < num_devices && freed < sc->nr_to_scan; d++) {
+		pd = dicts[(first + d) % num_devices];
+
+		for (i = 0; i < pd->num_shards && freed < sc->nr_to_scan; i++) {
+			s = (unsigned int)atomic_inc_return(&pd->clock_shard) % pd->num_shards;
+			n = dict_evict_shard(pd, &pd->shards[s], sc->nr_to_scan - freed, true);
+
+			atomic_long_add(n, &pd->reclaimed);
+			freed += n;
+		}
+	}
+
+	return freed != 0 ? freed : SHRINK_STOP;
+}
+
+
+/** @brief Register driver's shrinker, API of the running kernel
+ *  @return 0 on success, negative error otherwise
+ */
+static int dict_shrinker_register(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	dict_shrinker = shrinker_alloc(0, "dict_driver");
+
+	if (dict_shrinker == NULL) {
+		return -ENOMEM;
+	}
+
+	dict_shrinker->count_objects = dict_shrink_count;
+	dict_shrinker->scan_objects = dict_shrink_scan;
+	dict_shrinker->seeks = DEFAULT_SEEKS;
+	shrinker_register(dict_shrinker);
+
+	return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&dict_shrinker_s, "dict_driver");
+#else
+	return register_shrinker(&dict_shrinker_s);
+#endif
+}
+
+
+/** @brief Unregister driver's shrinker, waits for its running callbacks
+ */
+static void dict_shrinker_unregister(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_free(dict_shrinker);
+#else
+	unregister_shrinker(&dict_shrinker_s);
+#endif
+}
+
+/*
+ *
+ *                                  FLUSH
+ *
+ */
+
+
+/** @brief FLUSH - empty every shard by swapping in a fresh table; old tables
+ *  are released with their pairs by dict_flush_wq once readers that could
+ *  still walk them are gone; the call itself only walks them once, outside
+ *  shard mutexes, to retire COUNTER entries INCR may be adding to
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_count Set to number of pairs flushed, may be NULL
+ *  @return 0 on success, ENOMEM if a shard could not get a new table (shards
+ *  before it are flushed all the same), EFAULT if count cannot be copied
+ */
+static long dict_flush_run(dict *pd, u64 *user_count)
+{
+	long retval = 0;
+	unsigned int i;
+	unsigned int s;
+	unsigned long flushed = 0;
+	u64 count;
+	dict_flush *flush;
+
+	/* chaining shard may be in the middle of a resize, that is two tables */
+	flush = kmalloc(struct_size(flush, tables, 2 * pd->num_shards), GFP_KERNEL);
+
+	if (flush == NULL) {
+		pr_err("FLUSH: kmalloc failed");
+		return ENOMEM;
+	}
+
+	flush->engine = pd->engine;
+	flush->num_tables = 0;
+	INIT_RCU_WORK(&flush->rwork, dict_flush_work_fn);
+
+	for (s = 0; s < pd->num_shards; s++) {
+		retval = dict_flush_shard(pd, &pd->shards[s], flush, &flushed);
+
+		if (retval != 0) {
+			break;
+		}
+	}
+
+	for (i = 0; i < flush->num_tables; i++) {
+		flush->engine->retire(flush->tables[i]);
+	}
+
+	if (flush->num_tables != 0) {
+		queue_rcu_work(dict_flush_wq, &flush->rwork);
+	} else {
+		kfree(flush);
+	}
+
+	count = flushed;
+
+	if (user_count != NULL && copy_to_user(user_count, &count, sizeof(u64))) {
+		pr_err("FLUSH: cannot sent count to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Detach tables of one shard and leave it empty; readers see either
+ *  all pairs of the shard or none, other shards are flushed one by one
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard to flush
+ *  @param flush Detached tables are added to it
+ *  @param flushed Advanced by number of pairs shard had
+ *  @return 0 on success, ENOMEM if new table cannot be allocated
+ */
+static int dict_flush_shard(dict *pd, dict_shard *shard, dict_flush *flush, unsigned long *flushed)
+{
+	int i;
+	int n;
+
+	mutex_lock(&shard->shard_mutex);
+
+	n = pd->engine->detach(shard, &flush->tables[flush->num_tables]);
+
+	if (n < 0) {
+		mutex_unlock(&shard->shard_mutex);
+		return ENOMEM;
+	}
+
+	flush->num_tables += n;
+
+	/* entries keep their wheel nodes, nothing walks the old lists again */
+	for (i = 0; i < DICT_EXPIRE_SLOTS; i++) {
+		INIT_HLIST_HEAD(&shard->expire_wheel[i]);
+	}
+	INIT_HLIST_HEAD(&shard->expire_pending);
+
+	atomic_long_sub(shard->bytes, &pd->bytes);
+	atomic_long_sub(shard->num_entries, &pd->entries);
+	*flushed += shard->num_entries;
+
+	WRITE_ONCE(shard->num_expiring, 0);
+	shard->num_entries = 0;
+	shard->bytes = 0;
+	shard->clock_hand = 0;
+
+	mutex_unlock(&shard->shard_mutex);
+	return 0;
+}
+
+
+/** @brief Release tables of a FLUSH, a grace period after they were detached
+ *  @param work rwork of the flush
+ */
+static void dict_flush_work_fn(struct work_struct *work)
+{
+	unsigned int i;
+	dict_flush *flush = container_of(to_rcu_work(work), dict_flush, rwork);
+
+	for (i = 0; i < flush->num_tables; i++) {
+		flush->engine->release(flush->tables[i]);
+	}
+
+	kfree(flush);
+}
+
+
+/** @brief DEL_BY_TYPE - delete every pair of given key and value type
+ *  @param pd Pointer to a shared dictionary object
+ *  @param user_req User request with types, deleted is filled by driver
+ *  @return 0 on success, EINVAL if both types are 0, ENOMEM or EFAULT otherwise
+ *  (pairs deleted before the failure are counted)
+ */
+static long dict_del_by_type_run(dict *pd, dict_del_by_type *user_req)
+{
+	long retval = 0;
+	unsigned int s;
+	dict_del_by_type req;
+	dict_scan_batch batch;
+
+	if (copy_from_user(&req, user_req, sizeof(dict_del_by_type))) {
+		pr_err("DEL_BY_TYPE: cannot get msg from user");
+		return EFAULT;
+	}
+
+	if (req.key_type == 0 && req.value_type == 0) {
+		pr_err("DEL_BY_TYPE: no type given, FLUSH deletes everything");
+		return EINVAL;
+	}
+
+	if (dict_scan_batch_init(&batch) != 0) {
+		pr_err("DEL_BY_TYPE: kmalloc failed");
+		return ENOMEM;
+	}
+
+	req.deleted = 0;
+
+	for (s = 0; s < pd->num_shards && batch.error == 0; s++) {
+		req.deleted += dict_del_by_type_shard(pd, &pd->shards[s], &req, &batch);
+	}
+
+	retval = batch.error;
+	kfree(batch.entries);
+
+	if (copy_to_user(user_req, &req, sizeof(dict_del_by_type))) {
+		pr_err("DEL_BY_TYPE: cannot sent count to user");
+		return EFAULT;
+	}
+
+	return retval;
+}
+
+
+/** @brief Walk shard with scan cursor and delete matching pairs; shard_mutex
+ *  is held for DICT_DEL_STEPS positions at a time and dropped in between, so
+ *  writers wait for one round at most; expired pairs are left to expiry
+ *  @param pd Pointer to a shared dictionary object
+ *  @param shard Shard to walk
+ *  @param req Key and value type, 0 for any
+ *  @param batch Scan batch to collect into, its error is set on failure
+ *  @return Number of pairs deleted
+ */
+static unsigned long dict_del_by_type_shard(dict *pd, dict_shard *shard, const dict_del_by_type *req,
+					    dict_scan_batch *batch)
+{
+	int steps;
+	unsigned int i;
+	unsigned long n;
+	unsigned long deleted = 0;
+	unsigned long cursor = 0;
+	dict_entry *entry;
+	dict_entry *curr;
+
+	do {
+		n = 0;
+		batch->count = 0;
+		mutex_lock(&shard->shard_mutex);
+
+		for (steps = 0; steps < DICT_DEL_STEPS; steps++) {
+			cursor = pd->engine->scan(shard, cursor, batch);
+
+			if (cursor == 0 || batch->error != 0) {
+				break;
+			}
+		}
+
+		for (i = 0; i < batch->count; i++) {
+			entry = batch->entries[i];
+
+			if ((req->key_type != 0 && entry->key_type != req->key_type)
+			    || (req->value_type != 0 && entry->value_type != req->value_type)) {
+				continue;
+			}
+
+			/* batch holds a pin or a COUNTER copy, so it is removed by key */
+			curr = pd->engine->remove(shard, entry->key_hash, dict_entry_key(entry), entry->key_size);
+
+			if (curr == NULL) {
+				continue;
+			}
+
+			shard->num_entries--;
+			dict_expire_unlink(shard, curr);
+			dict_counter_retire(curr);
+			dict_account_sub(pd, shard, curr);
+
+			/* last reference only queues RCU callback, nothing is freed under the mutex */
+			dict_entry_put(curr);
+			n++;
+		}
+
+		if (n > 0) {
+			pd->engine->shrink(shard);
+		}
+
+		mutex_unlock(&shard->shard_mutex);
+		dict_scan_release(batch);
+
+		deleted += n;
+		cond_resched();
+	} while (cursor != 0 && batch->error == 0);
+
+	return deleted;
+}
+
+/*
+ *
+ *                                  CHAINING ENGINE
+ *
+ */
+
+
+/** @brief Allocate shard's initial bucket array
+ *  @param shard Shard being created
+ *  @return 0 on success, -ENOMEM if allocation failed
+ */
+static int dict_chain_init(dict_shard *shard)
+{
+	dict_table *table = dict_table_alloc(INITIAL_DICTSIZE);
+
+	if (table == NULL) {
+		return -ENOMEM;
+	}
+
+	shard->rehash_idx = 0;
+	RCU_INIT_POINTER(shard->dict_table, table);
+	RCU_INIT_POINTER(shard->rehash_table, NULL);
+	INIT_WORK(&shard->rehash_work, dict_rehash_work);
+
+	return 0;
+}
+
+
+/** @brief Stop background rehash and free both bucket arrays with all entries
+ *  @param shard Shard being destroyed
+ */
+static void dict_chain_destroy(dict_shard *shard)
+{
+	cancel_work_sync(&shard->rehash_work);
+	dict_table_destroy(rcu_dereference_protected(shard->dict_table, 1));
+	dict_table_destroy(rcu_dereference_protected(shard->rehash_table, 1));
+}
+
+
+/** @brief Swap empty initial bucket array into the shard, resize in progress
+ *  is dropped with it; rehash work finds nothing to move and stops
+ *  @param shard Shard being flushed, called with its shard_mutex held
+ *  @param tables Filled with detached bucket arrays, two at most
+ *  @return Number of detached arrays, -ENOMEM if allocation failed
+ */
+static int dict_chain_detach(dict_shard *shard, void **tables)
+{
+	int n = 0;
+	dict_table *rehash_table;
+	dict_table *table = dict_table_alloc(INITIAL_DICTSIZE);
+
+	if (table == NULL) {
+		return -ENOMEM;
+	}
+
+	tables[n++] = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+	rehash_table = rcu_dereference_protected(shard->rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (rehash_table != NULL) {
+		tables[n++] = rehash_table;
+	}
+
+	write_seqcount_begin(&shard->dict_seq);
+
+	rcu_assign_pointer(shard->dict_table, table);
+	RCU_INIT_POINTER(shard->rehash_table, NULL);
+	shard->rehash_idx = 0;
+
+	write_seqcount_end(&shard->dict_seq);
+
+	return n;
+}
+
+
+/** @brief Retire COUNTER entries of detached bucket array, rescheduling every
+ *  DICT_REHASH_BATCH buckets; array is not changed by writers any more
+ *  @param ptr Bucket array just detached
+ */
+static void dict_chain_retire(void *ptr)
+{
+	unsigned long i;
+	dict_table *table = ptr;
+	dict_entry *curr;
+
+	for (i = 0; i < table->size; i++) {
+		for (curr = rcu_dereference_protected(table->buckets[i], 1); curr != NULL;
+		     curr = rcu_dereference_protected(curr->next, 1)) {
+			dict_counter_retire(curr);
+		}
+
+		if ((i + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+}
+
+
+/** @brief Drop table references of all entries in detached bucket array and
+ *  free it, rescheduling every DICT_REHASH_BATCH buckets
+ *  @param ptr Bucket array detached a grace period ago
+ */
+static void dict_chain_release(void *ptr)
+{
+	unsigned long i;
+	dict_table *table = ptr;
+	dict_entry *curr;
+	dict_entry *next;
+
+	for (i = 0; i < table->size; i++) {
+		for (curr = rcu_dereference_protected(table->buckets[i], 1); curr != NULL; curr = next) {
+			next = rcu_dereference_protected(curr->next, 1);
+			dict_entry_put_unlinked(curr);
+		}
+
+		if ((i + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+
+	kvfree(table);
+}
+
+
+/** @brief Allocate zeroed bucket array of given size, charged to memory
+ *  cgroup of the writer that grows the table
+ *  @param size Number of buckets
+ *  @return dict_table pointer, NULL if allocation failed
+ */
+static dict_table *dict_table_alloc(unsigned long size)
+{
+	dict_table *table;
+
+	table = kvzalloc(struct_size(table, buckets, size), GFP_KERNEL_ACCOUNT);
+
+	if (table != NULL) {
+		table->size = size;
+	}
+
+	return table;
+}
+
+
+/** @brief Free bucket array together with all entries in it right away, in
+ *  chunks of DICT_REHASH_BATCH buckets with rescheduling points in between
+ *  @param table Bucket array no one can reach anymore, may be NULL
+ */
+static void dict_table_destroy(dict_table *table)
+{
+	unsigned long i;
+	dict_entry *curr;
+	dict_entry *next;
+
+	if (table == NULL) {
+		return;
+	}
+
+	for (i = 0; i < table->size; i++) {
+		for (curr = rcu_dereference_protected(table->buckets[i], 1); curr != NULL; curr = next) {
+			next = rcu_dereference_protected(curr->next, 1);
+			dict_entry_free(curr);
+		}
+
+		if ((i + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+
+	kvfree(table);
+}
+
+
+/** @brief Find link that points to the entry with matching key in one bucket array
+ *  @param shard Shard that owns the table, called with its shard_mutex held
+ *  @param table Bucket array to search, may be NULL
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Pointer to the link (bucket head or previous entry's next), NULL if not found
+ */
+static dict_entry __rcu **dict_find_link(dict_shard *shard, dict_table *table, unsigned long hash,
+					  const void *key, size_t key_size)
+{
+	dict_entry *curr;
+	dict_entry __rcu **link;
+
+	if (table == NULL) {
+		return NULL;
+	}
+
+	for (link = &table->buckets[hash % table->size];
+	     (curr = rcu_dereference_protected(*link, lockdep_is_held(&shard->shard_mutex))) != NULL;
+	     link = &curr->next) {
+		if (dict_entry_matches(curr, hash, key, key_size)) {
+			return link;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @brief Replace entry with matching key, or link new one to the head of the
+ *  bucket; while resize is in progress new entries go straight to the new table
+ *  @param shard Shard that owns the key, called with its shard_mutex held
+ *  @param new_entry Fully initialized entry to publish
+ *  @return Replaced entry, NULL if key is new
+ */
+static dict_entry *dict_chain_insert(dict_shard *shard, dict_entry *new_entry)
+{
+	unsigned long bucket_id;
+	unsigned long hash = new_entry->key_hash;
+	dict_table *table;
+	dict_table *rehash_table;
+	dict_entry *curr;
+	dict_entry __rcu **link;
+
+	dict_rehash_step(shard, DICT_REHASH_STEP);
+
+	table = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+	rehash_table = rcu_dereference_protected(shard->rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	link = dict_find_link(shard, table, hash, dict_entry_key(new_entry), new_entry->key_size);
+
+	if (link == NULL) {
+		link = dict_find_link(shard, rehash_table, hash, dict_entry_key(new_entry), new_entry->key_size);
+	}
+
+	if (link != NULL) {
+		curr = rcu_dereference_protected(*link, lockdep_is_held(&shard->shard_mutex));
+		RCU_INIT_POINTER(new_entry->next, rcu_access_pointer(curr->next));
+		rcu_assign_pointer(*link, new_entry);
+		return curr;
+	}
+
+	/*
+	 * refuse new key rather than let chains grow without bound if new table
+	 * cannot be allocated; at DICT_MAX_TABLE_SLOTS chains get longer instead
+	 */
+
+	if (rehash_table == NULL && shard->num_entries + 1 > table->size * DICT_GROW_DENSITY
+	    && table->size < DICT_MAX_TABLE_SLOTS) {
+		if (dict_resize(shard, table->size * DICTSIZE_MULTIPLIER) != 0) {
+			return ERR_PTR(-ENOMEM);
+		}
+		rehash_table = rcu_dereference_protected(shard->rehash_table, lockdep_is_held(&shard->shard_mutex));
+	}
+
+	if (rehash_table != NULL) {
+		table = rehash_table;
+	}
+
+	bucket_id = hash % table->size;
+	RCU_INIT_POINTER(new_entry->next, rcu_access_pointer(table->buckets[bucket_id]));
+	rcu_assign_pointer(table->buckets[bucket_id], new_entry);
+
+	return NULL;
+}
+
+
+/** @brief Search for key in one bucket array; lockless, called under rcu_read_lock()
+ *  @param table Bucket array to search, may be NULL
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Matching entry, NULL if not found
+ */
+static dict_entry *dict_table_lookup(dict_table *table, unsigned long hash,
+				     const void *key, size_t key_size)
+{
+	dict_entry *curr;
+
+	if (table == NULL) {
+		return NULL;
+	}
+
+	for (curr = rcu_dereference(table->buckets[hash % table->size]); curr; curr = rcu_dereference(curr->next)) {
+		if (dict_entry_matches(curr, hash, key, key_size)) {
+			return curr;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @brief Lockless lookup, called under rcu_read_lock(); while shard is being
+ *  resized both tables are checked
+ *  @param shard Shard that owns the key
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Matching entry, NULL if not found
+ */
+static dict_entry *dict_chain_lookup(dict_shard *shard, unsigned long hash,
+				     const void *key, size_t key_size)
+{
+	unsigned int seq;
+	dict_entry *found;
+
+	do {
+		seq = read_seqcount_begin(&shard->dict_seq);
+
+		found = dict_table_lookup(rcu_dereference(shard->dict_table), hash, key, key_size);
+
+		if (found == NULL) {
+			found = dict_table_lookup(rcu_dereference(shard->rehash_table), hash, key, key_size);
+		}
+
+		if (found != NULL) {
+			return found;
+		}
+
+		/* Entry could have been moved under our feet by dict_rehash_step */
+
+	} while (read_seqcount_retry(&shard->dict_seq, seq));
+
+	return NULL;
+}
+
+
+/** @brief Unlink entry with matching key from whichever table holds it
+ *  @param shard Shard that owns the key, called with its shard_mutex held
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Unlinked entry, table reference is passed to caller; NULL if not found
+ */
+static dict_entry *dict_chain_remove(dict_shard *shard, unsigned long hash,
+				     const void *key, size_t key_size)
+{
+	dict_entry *curr;
+	dict_entry __rcu **link;
+
+	dict_rehash_step(shard, DICT_REHASH_STEP);
+
+	link = dict_find_link(shard, rcu_dereference_protected(shard->dict_table,
+			      lockdep_is_held(&shard->shard_mutex)), hash, key, key_size);
+
+	if (link == NULL) {
+		link = dict_find_link(shard, rcu_dereference_protected(shard->rehash_table,
+				      lockdep_is_held(&shard->shard_mutex)), hash, key, key_size);
+	}
+
+	if (link == NULL) {
+		return NULL;
+	}
+
+	curr = rcu_dereference_protected(*link, lockdep_is_held(&shard->shard_mutex));
+	rcu_assign_pointer(*link, rcu_access_pointer(curr->next));
+	return curr;
+}
+
+/** @brief Start shrinking shard if it became mostly empty; new size keeps it
+ *  about half full, far enough from growth threshold to not flip back and forth
+ *  @param shard Shard an entry was just removed from, called with its shard_mutex held
+ */
+static void dict_chain_shrink(dict_shard *shard)
+{
+	unsigned long new_size;
+	dict_table *table;
+
+	table = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (rcu_access_pointer(shard->rehash_table) != NULL || table->size <= INITIAL_DICTSIZE
+		|| shard->num_entries * DICT_SHRINK_DENSITY >= table->size) {
+		return;
+	}
+
+	for (new_size = INITIAL_DICTSIZE; new_size < shard->num_entries * 2; new_size *= DICTSIZE_MULTIPLIER)
+		;
+
+	dict_resize(shard, new_size);
+}
+
+
+/** @brief Collect entries of bucket under cursor; while resize is in progress
+ *  that is its bucket in the smaller table plus all buckets of the larger
+ *  table it expands to, which makes the cursor valid for either size
+ *  @param shard Shard to scan, called with its shard_mutex held
+ *  @param cursor Bucket cursor, bit-reversed index
+ *  @param batch Collected entries
+ *  @return Next cursor, 0 after the last bucket
+ */
+static unsigned long dict_chain_scan(dict_shard *shard, unsigned long cursor, dict_scan_batch *batch)
+{
+	unsigned long small_mask;
+	unsigned long large_mask;
+	dict_table *small;
+	dict_table *large;
+
+	small = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+	large = rcu_dereference_protected(shard->rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (large == NULL) {
+		dict_chain_scan_bucket(shard, small, cursor & (small->size - 1), batch);
+		return dict_scan_next(cursor, small->size - 1);
+	}
+
+	if (small->size > large->size) {
+		swap(small, large);
+	}
+
+	small_mask = small->size - 1;
+	large_mask = large->size - 1;
+
+	dict_chain_scan_bucket(shard, small, cursor & small_mask, batch);
+
+	/* expansions differ only in bits above small_mask, which come first in reverse order */
+
+	do {
+		dict_chain_scan_bucket(shard, large, cursor & large_mask, batch);
+		cursor = dict_scan_next(cursor, large_mask);
+	} while (cursor & (small_mask ^ large_mask));
+
+	return cursor;
+}
+
+
+/** @brief Collect all entries of one bucket
+ *  @param shard Shard that owns the table, called with its shard_mutex held
+ *  @param table Bucket array
+ *  @param bucket_id Bucket index
+ *  @param batch Collected entries
+ */
+static void dict_chain_scan_bucket(dict_shard *shard, dict_table *table, unsigned long bucket_id,
+				   dict_scan_batch *batch)
+{
+	dict_entry *curr;
+
+	for (curr = rcu_dereference_protected(table->buckets[bucket_id], lockdep_is_held(&shard->shard_mutex));
+	     curr != NULL;
+	     curr = rcu_dereference_protected(curr->next, lockdep_is_held(&shard->shard_mutex))) {
+		dict_scan_collect(batch, curr);
+	}
+}
+
+
+/** @brief Size bucket array for num_entries without growing on the way; empty
+ *  shard just swaps in new array, non-empty one starts usual incremental resize
+ *  @param shard Shard to size, called with its shard_mutex held
+ *  @param num_entries Number of entries shard is expected to hold
+ *  @return 0 on success or if table is large enough, -ENOMEM otherwise
+ */
+static int dict_chain_reserve(dict_shard *shard, unsigned long num_entries)
+{
+	unsigned long new_size;
+	dict_table *table;
+	dict_table *new_table;
+
+	table = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (rcu_access_pointer(shard->rehash_table) != NULL) {
+		return 0;
+	}
+
+	for (new_size = table->size; new_size * DICT_GROW_DENSITY < num_entries && new_size < DICT_MAX_TABLE_SLOTS;
+	     new_size *= DICTSIZE_MULTIPLIER)
+		;
+
+	if (new_size == table->size) {
+		return 0;
+	}
+
+	if (shard->num_entries != 0) {
+		return dict_resize(shard, new_size);
+	}
+
+	new_table = dict_table_alloc(new_size);
+
+	if (new_table == NULL) {
+		return -ENOMEM;
+	}
+
+	rcu_assign_pointer(shard->dict_table, new_table);
+	kvfree_rcu(table, rcu);
+	return 0;
+}
+
+
+/** @brief Start resizing shard to fit new number of entires, both up and down;
+ *  only allocates new table, entries are moved over by dict_rehash_step() from
+ *  following writes and from rehash_work, so no single call pays for full rehash
+ *  @param shard Shard to resize, called with its shard_mutex held
+ *  @param new_size Number of buckets in the new table
+ *  @return 0 on success, -ENOMEM if new table could not be allocated
+ */
+static int dict_resize(dict_shard *shard, unsigned long new_size)
+{
+	dict_table *new_table;
+
+	new_table = dict_table_alloc(new_size);
+
+	if (new_table == NULL) {
+		pr_err("DICT_RESIZE: kvzalloc of %lu buckets failed", new_size);
+		return -ENOMEM;
+	}
+
+	shard->rehash_idx = 0;
+	rcu_assign_pointer(shard->rehash_table, new_table);
+	schedule_work(&shard->rehash_work);
+	return 0;
+}
+
+
+/** @brief Move up to budget buckets from old table to the new one; each bucket
+ *  is relinked inside its own seqcount write section, so lockless readers that
+ *  missed during it retry, and wait at most for one bucket to move, not whole
+ *  batch; once all buckets moved, new table replaces old one, which is freed
+ *  after a grace period
+ *  @param shard Shard being resized, called with its shard_mutex held
+ *  @param budget Maximum number of old buckets to move
+ *  @return true if resize is complete (or was not in progress)
+ */
+static bool dict_rehash_step(dict_shard *shard, int budget)
+{
+	unsigned long new_index;
+
+	dict_entry *old_curr;
+	dict_entry *new_curr;
+	dict_table *old_table;
+	dict_table *new_table;
+
+	new_table = rcu_dereference_protected(shard->rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (new_table == NULL) {
+		return true;
+	}
+
+	old_table = rcu_dereference_protected(shard->dict_table, lockdep_is_held(&shard->shard_mutex));
+
+	for (; budget > 0 && shard->rehash_idx < old_table->size; budget--, shard->rehash_idx++) {
+		old_curr = rcu_dereference_protected(old_table->buckets[shard->rehash_idx], 1);
+
+		if (old_curr == NULL) {
+			continue;
+		}
+
+		write_seqcount_begin(&shard->dict_seq);
+
+		while (old_curr) {
+			new_index = old_curr->key_hash % new_table->size;
+			new_curr = old_curr;
+			old_curr = rcu_dereference_protected(old_curr->next, 1);
+			RCU_INIT_POINTER(new_curr->next, rcu_access_pointer(new_table->buckets[new_index]));
+			rcu_assign_pointer(new_table->buckets[new_index], new_curr);
+		}
+		RCU_INIT_POINTER(old_table->buckets[shard->rehash_idx], NULL);
+		write_seqcount_end(&shard->dict_seq);
+	}
+
+	if (shard->rehash_idx < old_table->size) {
+		return false;
+	}
+
+	write_seqcount_begin(&shard->dict_seq);
+
+	rcu_assign_pointer(shard->dict_table, new_table);
+	RCU_INIT_POINTER(shard->rehash_table, NULL);
+
+	write_seqcount_end(&shard->dict_seq);
+
+	kvfree_rcu(old_table, rcu);
+	return true;
+}
+
+
+/** @brief Background part of the resize - keeps moving buckets in small batches,
+ *  dropping shard_mutex in between, so writers are never stalled for long
+ *  @param work rehash_work embedded into the shard
+ */
+static void dict_rehash_work(struct work_struct *work)
+{
+	bool done;
+	dict_shard *shard = container_of(work, dict_shard, rehash_work);
+
+	do {
+		mutex_lock(&shard->shard_mutex);
+		done = dict_rehash_step(shard, DICT_REHASH_BATCH);
+		mutex_unlock(&shard->shard_mutex);
+		cond_resched();
+	} while (!done);
+}
+
+
+/*
+ *
+ *                                  OPEN ADDRESSING ENGINE
+ *
+ */
+
+/*
+ * Table is array of groups, each holding DICT_GROUP_SLOTS entry pointers and
+ * one control byte per slot packed into u64: DICT_CTRL_EMPTY, DICT_CTRL_DELETED,
+ * or 7 bits of key hash (tag) for occupied slot. Lookup starts at group picked
+ * by low bits of the hash, matches tag against all 8 control bytes at once and
+ * compares keys only for matching slots; probing (triangular over groups) stops
+ * at first group that has an empty slot, so miss usually costs one group.
+ *
+ * Writers publish slot pointer before control byte and readers load control
+ * word with acquire, so reader that sees tag also sees the entry. Removal turns
+ * slot into tombstone (or back to empty if group was never full), tombstones
+ * are dropped when table is rebuilt into new array. Rebuild is incremental like
+ * chaining resize: new array is published next to the old one, writes and
+ * rehash_work move groups over a few at a time, and moved slots are left as
+ * tombstones, so probe sequences of entries not moved yet stay intact.
+ */
+
+static inline u8 dict_oa_tag(unsigned long hash)
+{
+	return (hash >> 25) & 0x7f;
+}
+
+/* Bitmask with 0x80 set in every byte of tags equal to tag; may have false
+ * positives next to real match, they are filtered out by key compare */
+static inline u64 dict_group_match(u64 tags, u8 tag)
+{
+	u64 x = tags ^ (DICT_BYTES_LSB * tag);
 
-	pd_ptr = dict_create();
+	return (x - DICT_BYTES_LSB) & ~x & DICT_BYTES_MSB;
+}
+
+static inline u64 dict_group_match_empty(u64 tags)
+{
+	return tags & (~tags << 6) & DICT_BYTES_MSB;
+}
+
+/* empty or deleted - both have high bit set, occupied slots have tag below 0x80 */
+static inline u64 dict_group_match_free(u64 tags)
+{
+	return tags & DICT_BYTES_MSB;
+}
+
+static inline int dict_group_slot(u64 match)
+{
+	return __ffs64(match) / 8;
+}
+
+static inline u64 dict_group_set_ctrl(u64 tags, int slot, u8 ctrl)
+{
+	return (tags & ~(0xffULL << (slot * 8))) | ((u64)ctrl << (slot * 8));
+}
+
+static inline u8 dict_group_ctrl(u64 tags, int slot)
+{
+	return tags >> (slot * 8);
+}
 
-	if (pd_ptr == NULL) {
-		pr_err("DICT_INIT: dict was not initialized\n");
-		goto r_device;
+
+/** @brief Allocate table with all slots empty, charged to memory cgroup of
+ *  the writer that grows the table
+ *  @param num_groups Number of groups, power of two
+ *  @return Table pointer, NULL if allocation failed
+ */
+static dict_oa_table *dict_oa_table_alloc(unsigned long num_groups)
+{
+	unsigned long g;
+	dict_oa_table *table;
+
+	table = kvzalloc(struct_size(table, groups, num_groups), GFP_KERNEL_ACCOUNT);
+
+	if (table == NULL) {
+		return NULL;
 	}
 
-	/* Initilize mutex at runtime */
+	table->num_groups = num_groups;
+	table->tombstones = 0;
 
-	mutex_init(&dict_mutex);
+	for (g = 0; g < num_groups; g++) {
+		table->groups[g].tags = DICT_BYTES_LSB * DICT_CTRL_EMPTY;
+	}
 
-	pr_info("DICT_INIT: dict initialized\n");
+	return table;
+}
 
-	return 0;
 
-r_device:
-	class_destroy(dev_class);
-r_class:
-	unregister_chrdev_region(dev, 1);
-	cdev_del(&dict_cdev);
-	return -1;
+/** @brief Number of occupied plus deleted slots after which table is rebuilt
+ *  @param table Table to check
+ *  @return Slot limit, DICT_OA_MAX_LOAD of capacity
+ */
+static inline unsigned long dict_oa_max_load(dict_oa_table *table)
+{
+	return table->num_groups * DICT_GROUP_SLOTS / 8 * DICT_OA_MAX_LOAD;
 }
 
 
-/** @brief  Exit driver function - destroy all device stuff, call dict destructor,
- *  and destroy mutex as well; called on rmmod'ing driver
- *  @return 0 on success, -1 on others
+/** @brief Allocate shard's initial table, INITIAL_DICTSIZE slots
+ *  @param shard Shard being created
+ *  @return 0 on success, -ENOMEM if allocation failed
  */
-static void __exit dict_driver_exit(void)
+static int dict_oa_init(dict_shard *shard)
 {
-	device_destroy(dev_class, dev);
-	class_destroy(dev_class);
-	cdev_del(&dict_cdev);
-	unregister_chrdev_region(dev, 1);
-	dict_destroy(pd_ptr);
-	pr_info("DICT_EXIT: device removed\n");
+	dict_oa_table *table = dict_oa_table_alloc(INITIAL_DICTSIZE / DICT_GROUP_SLOTS);
+
+	if (table == NULL) {
+		return -ENOMEM;
+	}
+
+	shard->rehash_idx = 0;
+	RCU_INIT_POINTER(shard->oa_table, table);
+	RCU_INIT_POINTER(shard->oa_rehash_table, NULL);
+	INIT_WORK(&shard->rehash_work, dict_oa_rehash_work);
+
+	return 0;
 }
 
-/*
- *
- *                                  DICT CORE API
- *
+
+/** @brief Stop background rebuild and free both tables with all entries
+ *  @param shard Shard being destroyed
  */
+static void dict_oa_destroy(dict_shard *shard)
+{
+	cancel_work_sync(&shard->rehash_work);
+	dict_oa_table_destroy(rcu_dereference_protected(shard->oa_table, 1));
+	dict_oa_table_destroy(rcu_dereference_protected(shard->oa_rehash_table, 1));
+}
 
 
-/** @brief Dictionary constructor; allocates initial hash table with INITIAL_DICTSIZE
- *  @param pd Pointer to a shared dictionary object
- *  @return dict pointer to initilized object
+/** @brief Free table with all entries in it right away, rescheduling every
+ *  DICT_REHASH_BATCH groups
+ *  @param table Table to free, may be NULL
  */
-static dict *dict_create()
+static void dict_oa_table_destroy(dict_oa_table *table)
 {
-	dict *pd = kmalloc(sizeof(dict), GFP_KERNEL);
+	int slot;
+	unsigned long g;
+	dict_entry *curr;
 
-	if (pd == NULL) {
-		pr_err("DICT_CREATE: kmalloc for dict failed");
-		return NULL;
+	if (table == NULL) {
+		return;
 	}
 
-	pd->dict_size   = INITIAL_DICTSIZE;
-	pd->num_entries = 0;
-	pd->dict_table  = kzalloc(INITIAL_DICTSIZE * sizeof(dict_pair), GFP_KERNEL);
+	for (g = 0; g < table->num_groups; g++) {
+		for (slot = 0; slot < DICT_GROUP_SLOTS; slot++) {
+			curr = rcu_dereference_protected(table->groups[g].slots[slot], 1);
+			if (curr != NULL) {
+				dict_entry_free(curr);
+			}
+		}
 
-	if (pd->dict_table == NULL) {
-		pr_err("DICT_CREATE: kzalloc for dict_table failed");
-		kfree(pd);
-		return NULL;
+		if ((g + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
 	}
 
-	return pd;
+	kvfree(table);
 }
 
 
-/** @brief Dictionary descructor; traverses all buckets and linked lists, freeing memory
- *  @param pd Pointer to a shared dictionary object
- *  @return NULL
+/** @brief Swap empty initial table into the shard, rebuild in progress is
+ *  dropped with it; rehash work finds nothing to move and stops
+ *  @param shard Shard being flushed, called with its shard_mutex held
+ *  @param tables Filled with detached tables, two at most
+ *  @return Number of detached tables, -ENOMEM if allocation failed
  */
-static void dict_destroy(dict *d)
+static int dict_oa_detach(dict_shard *shard, void **tables)
 {
-	int i;
-	dict_pair *curr;
-	dict_pair *next;
+	int n = 0;
+	dict_oa_table *rehash_table;
+	dict_oa_table *table = dict_oa_table_alloc(INITIAL_DICTSIZE / DICT_GROUP_SLOTS);
 
-	for (i = 0; i < d->dict_size; i++) {
-		for (curr = d->dict_table[i]; curr != NULL; curr = next) {
-			next = curr->next;
-			kfree(curr->key);
-			kfree(curr->value);
-			kfree(curr);
-		}
+	if (table == NULL) {
+		return -ENOMEM;
 	}
 
-	kfree(d->dict_table);
-	kfree(d);
+	tables[n++] = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+	rehash_table = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (rehash_table != NULL) {
+		tables[n++] = rehash_table;
+	}
+
+	write_seqcount_begin(&shard->dict_seq);
+
+	rcu_assign_pointer(shard->oa_table, table);
+	RCU_INIT_POINTER(shard->oa_rehash_table, NULL);
+	shard->rehash_idx = 0;
+
+	write_seqcount_end(&shard->dict_seq);
+
+	return n;
 }
 
 
-/** @brief Search for pair with matching key in dict; if exists - rewrite value
- *  else - create new entry and link it to the head of the bucket
- *  @param pd  Pointer to a shared dictionary object
- *  @param key  Pointer to key location in memory
- *  @param value  Pointer to value location in memory
- *  @param msg_dict Container from user that contains size/type info
- *  @return 0 on success
+/** @brief Retire COUNTER entries of detached table, rescheduling every
+ *  DICT_REHASH_BATCH groups; table is not changed by writers any more
+ *  @param ptr Table just detached
  */
-static int dict_set(dict *pd, void *key, void *value, dict_pair *msg_dict)
+static void dict_oa_retire(void *ptr)
 {
-	int bucket_id;
-	unsigned long hash;
-	dict_pair *curr;
-	dict_pair *new_entry;
+	int slot;
+	unsigned long g;
+	dict_oa_table *table = ptr;
+	dict_entry *curr;
+
+	for (g = 0; g < table->num_groups; g++) {
+		for (slot = 0; slot < DICT_GROUP_SLOTS; slot++) {
+			curr = rcu_dereference_protected(table->groups[g].slots[slot], 1);
+			if (curr != NULL) {
+				dict_counter_retire(curr);
+			}
+		}
 
-	hash = hash_mem(msg_dict->key, msg_dict->key_size);
-	bucket_id = hash % pd->dict_size;
+		if ((g + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
+	}
+}
 
-	curr = pd->dict_table[bucket_id];
 
-	while (curr != NULL) {
-		if (curr->key_hash == hash && curr->key_size == msg_dict->key_size) {
-			if (!memcmp(curr->key, msg_dict->key, msg_dict->key_size)) {
-				kfree(curr->value);
-				curr->value = kzalloc(msg_dict->value_size, GFP_KERNEL);
-				memcpy(curr->value, value, msg_dict->value_size);
-				curr->value_size = msg_dict->value_size;
-				curr->value_type = msg_dict->value_type;
-				return 0;
+/** @brief Drop table references of all entries in detached table and free
+ *  it, rescheduling every DICT_REHASH_BATCH groups
+ *  @param ptr Table detached a grace period ago
+ */
+static void dict_oa_release(void *ptr)
+{
+	int slot;
+	unsigned long g;
+	dict_oa_table *table = ptr;
+	dict_entry *curr;
+
+	for (g = 0; g < table->num_groups; g++) {
+		for (slot = 0; slot < DICT_GROUP_SLOTS; slot++) {
+			curr = rcu_dereference_protected(table->groups[g].slots[slot], 1);
+			if (curr != NULL) {
+				dict_entry_put_unlinked(curr);
 			}
 		}
-		curr = curr->next;
+
+		if ((g + 1) % DICT_REHASH_BATCH == 0) {
+			cond_resched();
+		}
 	}
 
-	new_entry = kzalloc(sizeof(dict_pair), GFP_KERNEL);
+	kvfree(table);
+}
 
-	if (new_entry == NULL) {
-		return -ENOMEM;
+
+/** @brief Probe table for key; writer side, called with shard_mutex held
+ *  @param table Table to search
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @param group Set to group of the match, or of first free slot on probe path
+ *  @param slot Set to slot of the match, or first free slot; -1 if there is none
+ *  @return true if key was found
+ */
+static bool dict_oa_find(dict_oa_table *table, unsigned long hash, const void *key,
+			 size_t key_size, dict_group **group, int *slot)
+{
+	u64 tags;
+	u64 match;
+	unsigned long i;
+	unsigned long g;
+	unsigned long mask = table->num_groups - 1;
+	u8 tag = dict_oa_tag(hash);
+	dict_entry *curr;
+
+	*slot = -1;
+
+	for (i = 0, g = hash & mask; i < table->num_groups; i++, g = (g + i) & mask) {
+		tags = table->groups[g].tags;
+
+		for (match = dict_group_match(tags, tag); match; match &= match - 1) {
+			curr = rcu_dereference_protected(table->groups[g].slots[dict_group_slot(match)], 1);
+			if (curr != NULL && dict_entry_matches(curr, hash, key, key_size)) {
+				*group = &table->groups[g];
+				*slot = dict_group_slot(match);
+				return true;
+			}
+		}
+
+		if (*slot < 0 && dict_group_match_free(tags)) {
+			*group = &table->groups[g];
+			*slot = dict_group_slot(dict_group_match_free(tags));
+		}
+
+		if (dict_group_match_empty(tags)) {
+			break;
+		}
 	}
 
-	new_entry->key_hash         = hash;
-	new_entry->key_type         = msg_dict->key_type;
-	new_entry->key_size         = msg_dict->key_size;
-	new_entry->value_type       = msg_dict->value_type;
-	new_entry->value_size       = msg_dict->value_size;
-	new_entry->key              = kzalloc(msg_dict->key_size, GFP_KERNEL);
-	new_entry->value            = kzalloc(msg_dict->value_size, GFP_KERNEL);
+	return false;
+}
 
-	if (new_entry-> key == NULL) {
-		kfree(new_entry);
-		return -ENOMEM;
+
+/** @brief Put entry into first free slot of its probe sequence; table may be
+ *  published already, so slot pointer is stored before its tag
+ *  @param table Table being rebuilt into, key must not be in it yet
+ *  @param entry Entry to place
+ */
+static void dict_oa_place(dict_oa_table *table, dict_entry *entry)
+{
+	u64 free;
+	int slot;
+	unsigned long i;
+	unsigned long g;
+	unsigned long mask = table->num_groups - 1;
+	dict_group *group;
+
+	for (i = 0, g = entry->key_hash & mask; ; i++, g = (g + i) & mask) {
+		group = &table->groups[g];
+		free = dict_group_match_free(group->tags);
+
+		if (free) {
+			slot = dict_group_slot(free);
+			if (dict_group_ctrl(group->tags, slot) == DICT_CTRL_DELETED) {
+				table->tombstones--;
+			}
+			rcu_assign_pointer(group->slots[slot], entry);
+			smp_store_release(&group->tags, dict_group_set_ctrl(group->tags, slot,
+									dict_oa_tag(entry->key_hash)));
+			return;
+		}
 	}
-	
-	if (new_entry->value == NULL) {
-		kfree(new_entry->key);
-		kfree(new_entry);
-		return -ENOMEM;
+}
+
+
+/** @brief Start rebuilding table into smaller array if it became mostly empty
+ *  @param shard Shard an entry was just removed from, called with its shard_mutex held
+ */
+static void dict_oa_shrink(dict_shard *shard)
+{
+	dict_oa_table *table;
+
+	table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (rcu_access_pointer(shard->oa_rehash_table) != NULL
+		|| table->num_groups <= INITIAL_DICTSIZE / DICT_GROUP_SLOTS
+		|| shard->num_entries * DICT_SHRINK_DENSITY >= table->num_groups * DICT_GROUP_SLOTS) {
+		return;
 	}
 
-	memcpy(new_entry->key, key, msg_dict->key_size);
-	memcpy(new_entry->value, value, msg_dict->value_size);
+	dict_oa_rebuild(shard, shard->num_entries);
+}
+
+
+/** @brief Rebuild table for num_entries, unless it already has room for them
+ *  or rebuild is in progress already
+ *  @param shard Shard to size, called with its shard_mutex held
+ *  @param num_entries Number of entries shard is expected to hold
+ *  @return 0 on success or if table is large enough, -ENOMEM otherwise
+ */
+static int dict_oa_reserve(dict_shard *shard, unsigned long num_entries)
+{
+	dict_oa_table *table;
 
-	new_entry->next = pd->dict_table[bucket_id];
-	pd->dict_table[bucket_id] = new_entry;
-	pd->num_entries++;
+	table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
 
-	if (pd->num_entries > pd->dict_size * DICT_GROW_DENSITY) {
-		dict_grow(pd);
+	if (rcu_access_pointer(shard->oa_rehash_table) != NULL) {
+		return 0;
 	}
 
-	return 0;
+	if ((num_entries + 1) * 2 <= dict_oa_max_load(table)) {
+		return 0;
+	}
+
+	return dict_oa_rebuild(shard, max(num_entries, shard->num_entries));
 }
 
 
-/** @brief Get pair struct by the provided key with respective size
- *  @param pd  Pointer to a shared dictionary object
- *  @param key  Pointer to key location in memory
- *  @param key_size  size of key, follows sizeof() format with size_t
- *  @return Struct containing value for matching key; NULL if pair does not exist
+/** @brief Collect entries whose home group (first group of probe sequence) is
+ *  the one under cursor; home group is masked hash like chaining bucket, so
+ *  cursor survives rebuild into any power-of-two size, and while rebuild is in
+ *  progress cursor covers its group in the smaller table plus all groups of the
+ *  larger table it expands to, as dict_chain_scan() does
+ *  @param shard Shard to scan, called with its shard_mutex held
+ *  @param cursor Group cursor, bit-reversed index
+ *  @param batch Collected entries
+ *  @return Next cursor, 0 after the last group
  */
-static dict_pair *dict_get(dict *pd, const void *key, const size_t key_size)
+static unsigned long dict_oa_scan(dict_shard *shard, unsigned long cursor, dict_scan_batch *batch)
 {
-	int bucket_id;
-	unsigned long hash;
-	dict_pair *curr;
+	unsigned long small_mask;
+	unsigned long large_mask;
+	dict_oa_table *small;
+	dict_oa_table *large;
 
-	hash = hash_mem(key, key_size);
-	bucket_id = hash % pd->dict_size;
-	curr = pd->dict_table[bucket_id];
+	small = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+	large = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
 
-	if (curr == NULL) {
-		return NULL;
+	if (large == NULL) {
+		dict_oa_scan_group(shard, small, cursor & (small->num_groups - 1), batch);
+		return dict_scan_next(cursor, small->num_groups - 1);
 	}
 
-	while (curr) {
-		if (curr->key_hash == hash && curr->key_size == key_size) {
-			if (!memcmp(curr->key, key, key_size)) {
-				return curr;
+	if (small->num_groups > large->num_groups) {
+		swap(small, large);
+	}
+
+	small_mask = small->num_groups - 1;
+	large_mask = large->num_groups - 1;
+
+	dict_oa_scan_group(shard, small, cursor & small_mask, batch);
+
+	do {
+		dict_oa_scan_group(shard, large, cursor & large_mask, batch);
+		cursor = dict_scan_next(cursor, large_mask);
+	} while (cursor & (small_mask ^ large_mask));
+
+	return cursor;
+}
+
+
+/** @brief Collect entries of one table whose home group is given one; they can
+ *  only sit on its probe path up to the first group with an empty slot, so
+ *  lookup's termination rule bounds the walk
+ *  @param shard Shard that owns the table, called with its shard_mutex held
+ *  @param table Table to walk
+ *  @param home Home group index
+ *  @param batch Collected entries
+ */
+static void dict_oa_scan_group(dict_shard *shard, dict_oa_table *table, unsigned long home,
+			       dict_scan_batch *batch)
+{
+	u64 tags;
+	int slot;
+	unsigned long i;
+	unsigned long g;
+	unsigned long mask = table->num_groups - 1;
+	dict_entry *curr;
+
+	for (i = 0, g = home; i < table->num_groups; i++, g = (g + i) & mask) {
+		tags = table->groups[g].tags;
+
+		for (slot = 0; slot < DICT_GROUP_SLOTS; slot++) {
+			curr = rcu_dereference_protected(table->groups[g].slots[slot],
+							 lockdep_is_held(&shard->shard_mutex));
+			if (curr != NULL && (curr->key_hash & mask) == home) {
+				dict_scan_collect(batch, curr);
 			}
 		}
-		curr = curr->next;
+
+		if (dict_group_match_empty(tags)) {
+			break;
+		}
 	}
-	return NULL;
 }
 
-/** @brief Grow dict by DICTSIZE_MULTIPLIER to fit new entires, rehash all entries
- *  @param pd Pointer to a shared dictionary object
- *  @return NULL
+
+/** @brief Start rebuilding table into new array sized for given number of
+ *  entries, dropping all tombstones; only allocates new array, slots are moved
+ *  over by dict_oa_rehash_step() from following writes and from rehash_work,
+ *  empty shard just swaps new array in
+ *  @param shard Shard to rebuild, called with its shard_mutex held and no
+ *  rebuild in progress
+ *  @param num_entries Number of entries to size for, at least current one
+ *  @return 0 on success, -ENOMEM if allocation failed
  */
-static void dict_grow(dict *pd)
+static int dict_oa_rebuild(dict_shard *shard, unsigned long num_entries)
 {
-	int i;
-	int new_index;
-	int new_size;
+	unsigned long num_groups;
+	dict_oa_table *old_table;
+	dict_oa_table *new_table;
+
+	old_table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
 
-	dict_pair *old_curr;
-	dict_pair *new_curr;
-	dict_pair **new_table;
+	/*
+	 * smallest size that keeps live entries at most at half of maximum load,
+	 * so table both grows and shrinks here
+	 */
+
+	num_groups = INITIAL_DICTSIZE / DICT_GROUP_SLOTS;
+	while ((num_entries + 1) * 2 > num_groups * DICT_GROUP_SLOTS / 8 * DICT_OA_MAX_LOAD
+	       && num_groups < DICT_MAX_TABLE_SLOTS / DICT_GROUP_SLOTS) {
+		num_groups *= DICTSIZE_MULTIPLIER;
+	}
 
-	new_size = pd->dict_size * DICTSIZE_MULTIPLIER;
-	new_table = kzalloc(new_size * sizeof(*new_table), GFP_KERNEL);
+	/* largest table is filled up to maximum load, past it shard cannot grow */
+	if (num_entries + 1 > num_groups * DICT_GROUP_SLOTS / 8 * DICT_OA_MAX_LOAD) {
+		return -ENOMEM;
+	}
+
+	new_table = dict_oa_table_alloc(num_groups);
 
 	if (new_table == NULL) {
-		pr_err("DICT_GROW: kzalloc failed");
-		return;
+		pr_err("DICT_OA_REBUILD: kzalloc failed");
+		return -ENOMEM;
 	}
 
-	for (i = 0; i < pd->dict_size; i++) {
-		old_curr = pd->dict_table[i];
-		while (old_curr) {
-			new_index = old_curr->key_hash % new_size;
-			new_curr = old_curr;
-			old_curr = old_curr->next;
-			new_curr->next = new_table[new_index];
-			new_table[new_index] = new_curr;
+	if (shard->num_entries == 0) {
+		rcu_assign_pointer(shard->oa_table, new_table);
+		kvfree_rcu(old_table, rcu);
+		return 0;
+	}
+
+	shard->rehash_idx = 0;
+	rcu_assign_pointer(shard->oa_rehash_table, new_table);
+	schedule_work(&shard->rehash_work);
+	return 0;
+}
+
+
+/** @brief Move occupied slots of up to budget old groups into the new table;
+ *  each group is moved inside its own seqcount write section, so lockless
+ *  readers that missed during it retry; moved slots become tombstones, not
+ *  empty, so probing for entries still in old table goes past them; once all
+ *  groups moved, new table replaces old one, which is freed after a grace period
+ *  @param shard Shard being rebuilt, called with its shard_mutex held
+ *  @param budget Maximum number of old groups to move
+ *  @return true if rebuild is complete (or was not in progress)
+ */
+static bool dict_oa_rehash_step(dict_shard *shard, int budget)
+{
+	u64 tags;
+	u64 match;
+	u64 occupied;
+	dict_group *group;
+	dict_oa_table *old_table;
+	dict_oa_table *new_table;
+
+	new_table = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (new_table == NULL) {
+		return true;
+	}
+
+	old_table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+
+	for (; budget > 0 && shard->rehash_idx < old_table->num_groups; budget--, shard->rehash_idx++) {
+		group = &old_table->groups[shard->rehash_idx];
+		tags = group->tags;
+		occupied = ~tags & DICT_BYTES_MSB;
+
+		if (occupied == 0) {
+			continue;
+		}
+
+		write_seqcount_begin(&shard->dict_seq);
+
+		for (match = occupied; match; match &= match - 1) {
+			dict_oa_place(new_table, rcu_dereference_protected(group->slots[dict_group_slot(match)], 1));
+			tags = dict_group_set_ctrl(tags, dict_group_slot(match), DICT_CTRL_DELETED);
+		}
+
+		smp_store_release(&group->tags, tags);
+
+		for (match = occupied; match; match &= match - 1) {
+			RCU_INIT_POINTER(group->slots[dict_group_slot(match)], NULL);
 		}
+
+		write_seqcount_end(&shard->dict_seq);
+	}
+
+	if (shard->rehash_idx < old_table->num_groups) {
+		return false;
 	}
-	
-	kfree(pd->dict_table);
-	pd->dict_size = new_size;
-	pd->dict_table = new_table;
-	return;
+
+	write_seqcount_begin(&shard->dict_seq);
+
+	rcu_assign_pointer(shard->oa_table, new_table);
+	RCU_INIT_POINTER(shard->oa_rehash_table, NULL);
+
+	write_seqcount_end(&shard->dict_seq);
+
+	kvfree_rcu(old_table, rcu);
+	return true;
+}
+
+
+/** @brief Background part of the rebuild - keeps moving groups in small
+ *  batches, dropping shard_mutex in between, so writers are never stalled for long
+ *  @param work rehash_work embedded into the shard
+ */
+static void dict_oa_rehash_work(struct work_struct *work)
+{
+	bool done;
+	dict_shard *shard = container_of(work, dict_shard, rehash_work);
+
+	do {
+		mutex_lock(&shard->shard_mutex);
+		done = dict_oa_rehash_step(shard, DICT_REHASH_BATCH);
+		mutex_unlock(&shard->shard_mutex);
+		cond_resched();
+	} while (!done);
 }
 
 
+/** @brief Replace entry with matching key, or put new one into first free slot
+ *  of its probe sequence, starting rebuild first if table is too full; while
+ *  rebuild is in progress new entries go straight to the new table
+ *  @param shard Shard that owns the key, called with its shard_mutex held
+ *  @param new_entry Fully initialized entry to publish
+ *  @return Replaced entry, NULL if key is new, ERR_PTR(-ENOMEM) if rebuild failed
+ */
+static dict_entry *dict_oa_insert(dict_shard *shard, dict_entry *new_entry)
+{
+	int slot;
+	unsigned long hash = new_entry->key_hash;
+	dict_oa_table *table;
+	dict_oa_table *rehash_table;
+	dict_group *group;
+	dict_entry *old_entry;
+
+	dict_oa_rehash_step(shard, DICT_REHASH_STEP);
+
+	table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+	rehash_table = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (dict_oa_find(table, hash, dict_entry_key(new_entry), new_entry->key_size, &group, &slot)
+	    || (rehash_table != NULL
+		&& dict_oa_find(rehash_table, hash, dict_entry_key(new_entry), new_entry->key_size, &group, &slot))) {
+		old_entry = rcu_dereference_protected(group->slots[slot], lockdep_is_held(&shard->shard_mutex));
+		rcu_assign_pointer(group->slots[slot], new_entry);
+		return old_entry;
+	}
+
+	if (rehash_table != NULL) {
+		table = rehash_table;
+	}
+
+	if (slot < 0 || shard->num_entries + table->tombstones + 1 > dict_oa_max_load(table)) {
+		/*
+		 * new table is sized for twice the entries shard had, so it fills up
+		 * before the old one is moved out only if writes double the shard
+		 * faster than they move groups; finish that move here then
+		 */
 
+		while (!dict_oa_rehash_step(shard, DICT_REHASH_BATCH)) {
+			cond_resched();
+		}
 
-/** @brief Pair deletion - delete pair (free its memory) if it exists, else do nothing
- *  @param pd Pointer to a shared dictionary object
+		if (dict_oa_rebuild(shard, shard->num_entries)) {
+			return ERR_PTR(-ENOMEM);
+		}
+
+		table = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+		if (table == NULL) {
+			table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+		}
+
+		dict_oa_find(table, hash, dict_entry_key(new_entry), new_entry->key_size, &group, &slot);
+	}
+
+	if (dict_group_ctrl(group->tags, slot) == DICT_CTRL_DELETED) {
+		table->tombstones--;
+	}
+
+	rcu_assign_pointer(group->slots[slot], new_entry);
+	smp_store_release(&group->tags, dict_group_set_ctrl(group->tags, slot, dict_oa_tag(hash)));
+	return NULL;
+}
+
+
+/** @brief Lockless lookup, called under rcu_read_lock(); while shard is being
+ *  rebuilt both tables are checked
+ *  @param shard Shard that owns the key
+ *  @param hash Full key hash
  *  @param key Pointer to key location in memory
  *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Matching entry, NULL if not found
  */
-static void dict_del(dict *pd, void *key, size_t key_size)
+static dict_entry *dict_oa_lookup(dict_shard *shard, unsigned long hash,
+				  const void *key, size_t key_size)
 {
-	int bucket_id;
-	unsigned long hash;
+	unsigned int seq;
+	dict_entry *found;
+
+	do {
+		seq = read_seqcount_begin(&shard->dict_seq);
 
-	dict_pair *curr;
-	dict_pair *prev;
+		found = dict_oa_table_lookup(rcu_dereference(shard->oa_table), hash, key, key_size);
 
-	hash = hash_mem(key, key_size);
-	bucket_id = hash % pd->dict_size;
+		if (found == NULL) {
+			found = dict_oa_table_lookup(rcu_dereference(shard->oa_rehash_table), hash, key, key_size);
+		}
+
+		if (found != NULL) {
+			return found;
+		}
 
-	curr = pd->dict_table[bucket_id];
+		/* Entry could have been moved under our feet by dict_oa_rehash_step */
 
-	if (curr == NULL) {
-		return;
+	} while (read_seqcount_retry(&shard->dict_seq, seq));
+
+	return NULL;
+}
+
+
+/** @brief Probe one table for key; lockless, called under rcu_read_lock()
+ *  @param table Table to search, may be NULL
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Matching entry, NULL if not found
+ */
+static dict_entry *dict_oa_table_lookup(dict_oa_table *table, unsigned long hash,
+					const void *key, size_t key_size)
+{
+	u64 tags;
+	u64 match;
+	unsigned long i;
+	unsigned long g;
+	unsigned long mask;
+	u8 tag = dict_oa_tag(hash);
+	dict_group *group;
+	dict_entry *curr;
+
+	if (table == NULL) {
+		return NULL;
 	}
 
-	if (curr->key_hash == hash && curr->key_size == key_size) {
-		if (!memcmp(curr->key, key, key_size)) {
-			pd->dict_table[bucket_id] = curr->next;
-			goto deleted;	
+	mask = table->num_groups - 1;
+
+	for (i = 0, g = hash & mask; i < table->num_groups; i++, g = (g + i) & mask) {
+		group = &table->groups[g];
+		tags = smp_load_acquire(&group->tags);
+
+		for (match = dict_group_match(tags, tag); match; match &= match - 1) {
+			curr = rcu_dereference(group->slots[dict_group_slot(match)]);
+			if (curr != NULL && dict_entry_matches(curr, hash, key, key_size)) {
+				return curr;
+			}
+		}
+
+		if (dict_group_match_empty(tags)) {
+			break;
 		}
 	}
 
-	prev = curr;
-	curr = curr->next;
+	return NULL;
+}
+
+
+/** @brief Clear slot of entry with matching key in whichever table holds it;
+ *  slot becomes empty if its group has empty slot anyway (no probe sequence
+ *  goes past it), else tombstone
+ *  @param shard Shard that owns the key, called with its shard_mutex held
+ *  @param hash Full key hash
+ *  @param key Pointer to key location in memory
+ *  @param key_size Size of key, follows sizeof() format with size_t
+ *  @return Removed entry, table reference is passed to caller; NULL if not found
+ */
+static dict_entry *dict_oa_remove(dict_shard *shard, unsigned long hash,
+				  const void *key, size_t key_size)
+{
+	u8 ctrl;
+	int slot;
+	dict_oa_table *table;
+	dict_group *group;
+	dict_entry *curr;
 
-	while(curr) {
-		if (curr->key_hash == hash) {
-			prev->next = curr->next;
-			goto deleted;
+	dict_oa_rehash_step(shard, DICT_REHASH_STEP);
+
+	table = rcu_dereference_protected(shard->oa_table, lockdep_is_held(&shard->shard_mutex));
+
+	if (!dict_oa_find(table, hash, key, key_size, &group, &slot)) {
+		table = rcu_dereference_protected(shard->oa_rehash_table, lockdep_is_held(&shard->shard_mutex));
+
+		if (table == NULL || !dict_oa_find(table, hash, key, key_size, &group, &slot)) {
+			return NULL;
 		}
-		prev = curr;
-		curr = curr->next;
 	}
 
-	return;
-
-deleted:
-	kfree(curr->key);
-	kfree(curr->value);
-	kfree(curr);
-	if (pd->num_entries > 1) {
-		pd->num_entries--;
+	if (dict_group_match_empty(group->tags)) {
+		ctrl = DICT_CTRL_EMPTY;
+	} else {
+		ctrl = DICT_CTRL_DELETED;
+		table->tombstones++;
 	}
-	return;
+
+	curr = rcu_dereference_protected(group->slots[slot], lockdep_is_held(&shard->shard_mutex));
+	smp_store_release(&group->tags, dict_group_set_ctrl(group->tags, slot, ctrl));
+	RCU_INIT_POINTER(group->slots[slot], NULL);
+	return curr;
 }
 
 /*
- * Simple memory hash function, credits to James Aspnes data structures course
- * http://www.cs.yale.edu/homes/aspnes/classes/223/notes.html
+ * Key hash - SipHash-2-4 keyed with dict_hash_key, random per module load;
+ * consumes key 8 bytes at a time, and without the key clients cannot craft
+ * keys that pile up in one bucket or shard
  */
-static unsigned long hash_mem(const unsigned char *s, size_t len)
+static unsigned long dict_hash(const void *key, size_t len)
 {
-	unsigned long h;
-	int i;
-
-	h = 0;
-	for (i = 0; i < len; i++) {
-		h = (h << 13) + (h >> 7) + h + s[i];
-	}
-	return h;
+	return siphash(key, len, &dict_hash_key);
 }
 
 module_init(dict_driver_init);
@@ -1,7 +1,78 @@
 #define NO_PAIR 420
 
+/* Slots per group of open addressing table, one control byte each */
+
+#define DICT_GROUP_SLOTS 8
+
+/* Operations of BATCH request */
+
+#define DICT_OP_SET 1
+#define DICT_OP_GET 2
+#define DICT_OP_DEL 3
+
+/* Ring setup flags, and header flags set by driver */
+
+#define DICT_RING_SQPOLL 1
+#define DICT_RING_NEED_WAKEUP 1
+
+/* SCAN request flags */
+
+#define DICT_SCAN_VALUES 1
+
+/* Snapshot stream identification, version is bumped on any format change */
+
+#define DICT_SNAPSHOT_MAGIC 0x54434944
+#define DICT_SNAPSHOT_VERSION 2
+
+/*
+ * Value types driver knows about, INT of client's data_types is what INCR
+ * works on; COUNTER is 8 byte INT kept in per-CPU slots, see dict_entry
+ */
+
+#define DICT_TYPE_INT 1
+#define DICT_TYPE_COUNTER 3
+
+/* Operations of UPDATE request */
+
+#define DICT_UPDATE_GET 1
+#define DICT_UPDATE_INCR 2
+#define DICT_UPDATE_CAS 3
+#define DICT_UPDATE_SET_IF_ABSENT 4
+#define DICT_UPDATE_APPEND 5
+
 typedef struct dict_pair dict_pair;
+typedef struct dict_pair_ttl dict_pair_ttl;
+typedef struct dict_batch_op dict_batch_op;
+typedef struct dict_batch dict_batch;
+typedef struct dict_batch_ttl dict_batch_ttl;
+typedef struct dict_uring_cmd_payload dict_uring_cmd_payload;
+typedef struct dict_ring_params dict_ring_params;
+typedef struct dict_ring_header dict_ring_header;
+typedef struct dict_sqe dict_sqe;
+typedef struct dict_cqe dict_cqe;
+typedef struct dict_ring dict_ring;
+typedef struct dict_scan dict_scan;
+typedef struct dict_scan_record dict_scan_record;
+typedef struct dict_scan_batch dict_scan_batch;
+typedef struct dict_snapshot dict_snapshot;
+typedef struct dict_snapshot_header dict_snapshot_header;
+typedef struct dict_stream dict_stream;
+typedef struct dict_update dict_update;
+typedef struct dict_update_ctx dict_update_ctx;
+typedef struct dict_del_by_type dict_del_by_type;
+typedef struct dict_flush dict_flush;
+typedef struct dict_file dict_file;
+typedef struct dict_entry dict_entry;
+typedef struct dict_table dict_table;
+typedef struct dict_shard dict_shard;
+typedef struct dict_group dict_group;
+typedef struct dict_oa_table dict_oa_table;
+typedef struct dict_engine dict_engine;
 typedef struct dict dict;
+typedef struct dict_cache_stats dict_cache_stats;
+typedef struct dict_size_class dict_size_class;
+
+/* Message structure of the IOCTL interface, layout shared with userspace */
 
 struct dict_pair
 {
@@ -20,10 +91,539 @@ struct dict_pair
     dict_pair *next;
 };
 
+/*
+ * SET_PAIR_TTL request - pair and time it lives, pair expires this many ms
+ * after it was set, 0 - never; SET_PAIR message stays as it was
+ */
+
+struct dict_pair_ttl
+{
+    dict_pair pair;
+
+    u32 ttl_ms;
+    u32 pad;
+};
+
+/* BATCH request - array of operations, status of each one is filled by driver */
+
+struct dict_batch_op
+{
+    int op;
+    int status;
+
+    dict_pair pair;
+};
+
+struct dict_batch
+{
+    size_t num_ops;
+    dict_batch_op *ops;
+};
+
+/* BATCH_TTL request - BATCH whose SET operations all get the same time to live */
+
+struct dict_batch_ttl
+{
+    dict_batch batch;
+
+    u32 ttl_ms;
+    u32 pad;
+};
+
+/* Payload of IORING_OP_URING_CMD SQE, cmd_op is one of IOCTL commands */
+
+struct dict_uring_cmd_payload
+{
+    u64 pair;
+};
+
+/*
+ * RING_SETUP request - user passes number of submission entries, size of data
+ * area for keys and values and flags, driver fills the rest: layout of the
+ * area to be mapped with mmap() at offset 0
+ */
+struct dict_ring_params
+{
+    u32 sq_entries;
+    u32 data_size;
+    u32 flags;
+
+    u32 cq_entries;
+    u32 sq_off;
+    u32 cq_off;
+    u32 data_off;
+    u32 ring_size;
+};
+
+/*
+ * Start of mapped ring area; user produces submissions at sq_tail and consumes
+ * completions at cq_head, driver does the opposite; both halves sit on their
+ * own cache line
+ */
+struct dict_ring_header
+{
+    u32 sq_head;
+    u32 sq_tail;
+    u32 sq_mask;
+    u32 flags;
+    u32 sq_pad[12];
+
+    u32 cq_head;
+    u32 cq_tail;
+    u32 cq_mask;
+    u32 cq_pad[13];
+};
+
+/* Submission entry - key and value are given as offsets into data area */
+
+struct dict_sqe
+{
+    u32 op;
+    int key_type;
+    int value_type;
+    u32 key_size;
+
+    /* size of value for SET, capacity of value buffer for GET */
+    u32 value_size;
+    u32 pad;
+
+    u64 key_off;
+    u64 value_off;
+    u64 user_data;
+};
+
+/* Completion entry - result of submission with the same user_data */
+
+struct dict_cqe
+{
+    u64 user_data;
+    int status;
+    int value_type;
+    u32 value_size;
+    u32 pad;
+};
+
+/*
+ * SCAN request - cursor is 0 on the first call and the value driver returned
+ * on every next one, driver returns 0 again once the whole dictionary was
+ * visited; records are packed into buf one after another, aligned to 8 bytes
+ */
+struct dict_scan
+{
+    u64 cursor;
+
+    void *buf;
+    size_t buf_size;
+
+    /* record budget, 0 - limited by buf_size only */
+    u32 max_records;
+    u32 flags;
+
+    /* set by driver - records written and bytes of buf they took */
+    u32 num_records;
+    size_t used;
+};
+
+/* Record of SCAN buffer, followed by key and, with DICT_SCAN_VALUES, value bytes */
+
+struct dict_scan_record
+{
+    u32 key_size;
+    u32 value_size;
+
+    int key_type;
+    int value_type;
+
+    /* wall clock ms (CLOCK_REALTIME) when pair expires, 0 - never */
+    u64 expires_ms;
+};
+
+/* SNAPSHOT_SAVE and SNAPSHOT_LOAD request - file descriptor to write or read stream */
+
+struct dict_snapshot
+{
+    int fd;
+    u32 pad;
+
+    /* set by driver - records and bytes written or read */
+    u64 num_entries;
+    u64 size;
+};
+
+/*
+ * Snapshot stream starts with this header; num_entries is number of pairs
+ * when save started, load sizes tables by it; header is followed by records,
+ * each struct dict_scan_record with key and value bytes right after it, with
+ * no padding, and ends with a record of zero key_size; pairs whose
+ * expires_ms has passed are skipped by load
+ */
+struct dict_snapshot_header
+{
+    u32 magic;
+    u32 version;
+    u64 num_entries;
+};
+
+/*
+ * UPDATE request - read-modify-write of one pair, done under its shard lock
+ * so no other writer can come in between; op is one of DICT_UPDATE_*, pair
+ * holds key, and value with its type for CAS, SET_IF_ABSENT and APPEND
+ */
+struct dict_update
+{
+    int op;
+    u32 pad;
+
+    dict_pair pair;
+
+    /* INCR - added to INT value of 4 or 8 bytes; set by driver to the result */
+    s64 delta;
+
+    /* CAS - expected value bytes, NULL to compare version instead */
+    void *expected;
+    size_t expected_size;
+
+    /* CAS - expected version; set by driver to version of the pair */
+    u64 version;
+};
+
+/*
+ * DEL_BY_TYPE request - pairs whose key_type and value_type match are deleted,
+ * 0 matches any type but not both; driver sets deleted to their number
+ */
+
+struct dict_del_by_type
+{
+    int key_type;
+    int value_type;
+
+    u64 deleted;
+};
+
+/*
+ * Table entry, header, key and value bytes live in one allocation; contents
+ * are immutable once linked, readers find it under rcu_read_lock() and pin
+ * it via refs, memory is released after a grace period once the last
+ * reference is dropped
+ */
+struct dict_entry
+{
+    dict_entry __rcu *next;
+    unsigned long key_hash;
+
+    u32 key_size;
+    u32 value_size;
+
+    int key_type;
+    int value_type;
+
+    /* taken from shard on every write, so CAS can tell pair was replaced */
+    u64 version;
+
+    /* COUNTER slots, value bytes hold base they are added to; NULL for other types */
+    s64 __percpu *counter;
+
+    /* jiffies when pair expires, 0 - never */
+    u64 expires;
+
+    refcount_t refs;
+
+    /* set by lookups, cleared by CLOCK hand passing by; evicted if hand finds it clear */
+    bool referenced;
+
+    /* COUNTER replaced by SET or deleted, INCR that got here takes its add back */
+    bool retired;
+
+    /*
+     * expiry wheel slot while linked, if entry expires; once unlinked - grace
+     * period, then large entries wait on deferred free list
+     */
+    union {
+        struct hlist_node expire_node;
+        struct rcu_head rcu;
+        struct llist_node free_node;
+    };
+
+    /* key_size bytes of key followed by value_size bytes of value */
+    unsigned char data[];
+};
+
+/* Bucket array together with its size, so readers always see a matching pair */
+
+struct dict_table
+{
+    unsigned long size;
+    struct rcu_head rcu;
+
+    dict_entry __rcu *buckets[];
+};
+
+/* Group of open addressing table - control byte per slot packed into one word, then slots */
+
+struct dict_group
+{
+    u64 tags;
+
+    dict_entry __rcu *slots[DICT_GROUP_SLOTS];
+};
+
+struct dict_oa_table
+{
+    unsigned long num_groups;
+    unsigned long tombstones;
+    struct rcu_head rcu;
+
+    dict_group groups[];
+};
+
+/* Independent sub-table with its own lock and growth, picked by high bits of key hash */
+
+struct dict_shard
+{
+    unsigned long num_entries;
+
+    /* bytes of its pairs, part of dict bytes; under shard_mutex */
+    unsigned long bytes;
+
+    /* chaining engine */
+    dict_table __rcu *dict_table;
+
+    /* non-NULL while resize is in progress, buckets below rehash_idx are already moved to it */
+    dict_table __rcu *rehash_table;
+    unsigned long rehash_idx;
+    struct work_struct rehash_work;
+
+    /* open addressing engine; rehash_idx and rehash_work are shared with chaining */
+    dict_oa_table __rcu *oa_table;
+
+    /* non-NULL while rebuild is in progress, groups below rehash_idx are already moved to it */
+    dict_oa_table __rcu *oa_rehash_table;
+
+    /* last version given to an entry, under shard_mutex */
+    u64 version;
+
+    /*
+     * expiring entries by tick of their expiry, DICT_EXPIRE_SLOTS lists that
+     * wrap around; expire_tick is the first tick not swept completely yet
+     */
+    struct hlist_head *expire_wheel;
+    unsigned long num_expiring;
+    u64 expire_tick;
+
+    /* entries of slot being swept, not visited yet; sweep drops shard_mutex between rounds */
+    struct hlist_head expire_pending;
+
+    /* scan cursor CLOCK eviction goes on from, under shard_mutex */
+    unsigned long clock_hand;
+
+    /* serializes writers of this shard, readers go lockless under RCU */
+    struct mutex shard_mutex;
+
+    /* bumped around rehashing, so lockless readers can retry a missed lookup */
+    seqcount_mutex_t dict_seq;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Table engine - how shard stores entries; insert and remove are called with
+ * shard_mutex held, lookup - under rcu_read_lock() only
+ */
+
+struct dict_engine
+{
+    const char *name;
+
+    int (*init)(dict_shard *);
+    void (*destroy)(dict_shard *);
+
+    dict_entry *(*insert)(dict_shard *, dict_entry *);
+    dict_entry *(*lookup)(dict_shard *, unsigned long, const void *, size_t);
+    dict_entry *(*remove)(dict_shard *, unsigned long, const void *, size_t);
+
+    /* called after entry was removed, may start shrinking the table */
+    void (*shrink)(dict_shard *);
+
+    /* collects entries of one cursor position, returns next cursor, 0 at the end; under shard_mutex */
+    unsigned long (*scan)(dict_shard *, unsigned long, dict_scan_batch *);
+
+    /* sizes table for given number of entries in advance; under shard_mutex */
+    int (*reserve)(dict_shard *, unsigned long);
+
+    /*
+     * swaps in empty table and stores old ones, returns their number or
+     * negative errno; under shard_mutex
+     */
+    int (*detach)(dict_shard *, void **);
+
+    /* marks COUNTER entries of detached table retired, before the grace period ends */
+    void (*retire)(void *);
+
+    /* drops entries of detached table and frees it, a grace period after detach */
+    void (*release)(void *);
+};
+
 struct dict
 {
-    int dict_size;
-    int num_entries;
+    const dict_engine *engine;
+    unsigned int num_shards;
+
+    /* sweeps expiry wheels every tick while any shard has expiring entries */
+    struct delayed_work expire_work;
+
+    /* key, value and entry header bytes of linked pairs, checked against max_bytes */
+    atomic_long_t bytes;
+
+    /* pairs linked in all shards */
+    atomic_long_t entries;
+
+    /* device quotas, set through sysfs; 0 - none, SET over them fails with EDQUOT */
+    unsigned long quota_bytes;
+    unsigned long quota_entries;
+
+    /* shard CLOCK eviction takes next, round robin */
+    atomic_t clock_shard;
+
+    dict_cache_stats __percpu *stats;
+    atomic_long_t evicted;
+    atomic_long_t reclaimed;
+
+    dict_shard shards[];
+};
+
+/* Lookup outcomes, per CPU so readers do not share a cache line */
+
+struct dict_cache_stats
+{
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/* Tables FLUSH detached from shards, released by workqueue a grace period later */
+
+struct dict_flush
+{
+    const dict_engine *engine;
+    struct rcu_work rwork;
+
+    unsigned int num_tables;
+    void *tables[];
+};
+
+/*
+ * Submission and completion rings of one open file, in vmalloc area mapped to
+ * user; driver keeps its own sq_head and cq_tail, so user writes to the
+ * header cannot make it read or write outside the rings
+ */
+
+struct dict_ring
+{
+    dict *pd;
+
+    void *mem;
+    size_t size;
+
+    dict_ring_header *hdr;
+    dict_sqe *sqes;
+    dict_cqe *cqes;
+    unsigned char *data;
+
+    u32 sq_entries;
+    u32 cq_entries;
+    u32 data_size;
+    u32 flags;
+
+    u32 sq_head;
+    u32 cq_tail;
+
+    /* serializes consumers - RING_ENTER callers and ring_work */
+    struct mutex ring_mutex;
+
+    /* polls submissions with DICT_RING_SQPOLL, until idle for DICT_RING_IDLE_MS */
+    struct work_struct ring_work;
+    unsigned long idle_since;
+
+    wait_queue_head_t cq_wait;
+};
+
+/* Entries of one SCAN step, pinned until they are copied to user */
+
+struct dict_scan_batch
+{
+    dict_entry **entries;
+    unsigned int count;
+    unsigned int capacity;
+
+    int error;
+
+    /* for eviction under shard_mutex - entries are not pinned, copied or grown past capacity */
+    bool raw;
+};
+
+/*
+ * State of one open file of the device, kept in its private_data: ring, set
+ * up at most once, and positions of read() and write() record streams
+ */
+
+struct dict_file
+{
+    dict *pd;
+    dict_ring *ring;
+
+    /* serializes read() and write() callers of this file */
+    struct mutex stream_mutex;
+
+    /* read() - pinned entries of current scan position, and bytes of current record already read */
+    u64 read_cursor;
+    bool read_done;
+    dict_scan_batch read_batch;
+    unsigned int read_idx;
+    size_t read_off;
+
+    /* write() - header of current record, then entry its key and value are copied into */
+    dict_scan_record write_record;
+    dict_entry *write_entry;
+    size_t write_off;
+
+    /* write() - negative error of rejected record, stream is not parsed past it */
+    long write_error;
+};
+
+/* Buffered snapshot stream over a file, buffer holds DICT_SNAPSHOT_CHUNK bytes */
+
+struct dict_stream
+{
+    struct file *file;
+    loff_t pos;
+
+    unsigned char *buf;
+    size_t len;
+    size_t off;
+
+    /* bytes moved to or from the file */
+    u64 size;
+};
+
+/*
+ * UPDATE request in kernel - key and expected bytes are copied in, value
+ * size of the pair new entry was built for is checked again under lock
+ */
+struct dict_update_ctx
+{
+    dict_update req;
 
-    dict_pair **dict_table;
-};
\ No newline at end of file
+    void *key;
+    void *expected;
+
+    unsigned long key_hash;
+    u32 old_size;
+};
+
+/* Slab cache for entries of one size class, with number of objects handed out */
+
+struct dict_size_class
+{
+    unsigned int size;
+    char name[24];
+
+    struct kmem_cache *cache;
+    atomic_long_t in_use;
+};
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Compares ops per second of single-pair calls (set_pair/get_value/del_pair,
+ * one syscall each) with BATCH_SIZE pairs per set_pairs/get_values/del_pairs
+ * call on the same NUM_OF_PAIRS pairs; needs loaded driver
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      1000000
+#define BATCH_SIZE        256
+
+static char (*keys)[KEY_LEN];
+static char (*vals)[VAL_LEN];
+static dict_pair *pairs;
+static int *status;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double single, double batched)
+{
+	printf("%s: single %10.0f ops/s, batched %10.0f ops/s, x%.1f\n", name,
+	       NUM_OF_PAIRS / single, NUM_OF_PAIRS / batched, single / batched);
+}
+
+/* fill pairs for keys [from, from + n) with value buffers of VAL_LEN */
+static void fill_pairs(int from, int n)
+{
+	memset(pairs, 0, n * sizeof(dict_pair));
+
+	for (int i = 0; i < n; i++) {
+		pairs[i].key        = keys[from + i];
+		pairs[i].key_size   = KEY_LEN;
+		pairs[i].key_type   = CHAR;
+		pairs[i].value      = vals[from + i];
+		pairs[i].value_size = VAL_LEN;
+		pairs[i].value_type = CHAR;
+	}
+}
+
+static double run_batched(int fd, int (*fn)(int, dict_pair *, size_t, int *))
+{
+	int n;
+	double start = now_s();
+
+	for (int i = 0; i < NUM_OF_PAIRS; i += n) {
+		n = NUM_OF_PAIRS - i < BATCH_SIZE ? NUM_OF_PAIRS - i : BATCH_SIZE;
+		fill_pairs(i, n);
+		assert(fn(fd, pairs, n, status) == 0);
+
+		for (int j = 0; j < n; j++) {
+			assert(status[j] == 0);
+		}
+	}
+
+	return now_s() - start;
+}
+
+int main()
+{
+	int fd;
+	double start;
+	double single;
+	double batched;
+	dict_pair *recieve;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	vals = calloc(NUM_OF_PAIRS, VAL_LEN);
+	pairs = calloc(BATCH_SIZE, sizeof(dict_pair));
+	status = calloc(BATCH_SIZE, sizeof(int));
+	assert(keys != NULL && vals != NULL && pairs != NULL && status != NULL);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "bk%d", i);
+		memset(vals[i], 'v', VAL_LEN);
+	}
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(set_pair(fd, keys[i], KEY_LEN, CHAR, vals[i], VAL_LEN, CHAR) == 0);
+	}
+	single = now_s() - start;
+	batched = run_batched(fd, set_pairs);
+	report("SET", single, batched);
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		recieve = get_value(fd, keys[i], KEY_LEN, CHAR);
+		assert(recieve != NULL);
+		free(recieve->value);
+		free(recieve);
+	}
+	single = now_s() - start;
+	batched = run_batched(fd, get_values);
+	report("GET", single, batched);
+
+	/* delete batched first, then put pairs back to time single deletes */
+	batched = run_batched(fd, del_pairs);
+	run_batched(fd, set_pairs);
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+	single = now_s() - start;
+	report("DEL", single, batched);
+
+	free(keys);
+	free(vals);
+	free(pairs);
+	free(status);
+	return 0;
+}
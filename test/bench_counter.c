@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Threads pinned one per CPU increment one shared key with incr_value(), once
+ * stored as INT and once as COUNTER; prints increments per second and speedup
+ * over one thread for 1 to all online CPUs, and checks folded COUNTER value
+ * has every increment; needs loaded driver
+ */
+
+#define OPS_PER_THREAD    200000
+#define KEY               "bench_counter"
+
+static int fd;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET((long)arg, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		assert(incr_value(fd, KEY, sizeof(KEY), CHAR, 1, NULL) == 0);
+	}
+
+	return NULL;
+}
+
+/* run num_threads workers on key set to 0 of value_type, returns incr/s */
+static double run(int value_type, int num_threads)
+{
+	int64_t value = 0;
+	double elapsed;
+	dict_pair *pair;
+	pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+
+	assert(threads != NULL);
+	assert(set_pair(fd, KEY, sizeof(KEY), CHAR, &value, sizeof(value), value_type) == 0);
+
+	elapsed = now_s();
+	for (long i = 0; i < num_threads; i++) {
+		assert(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	elapsed = now_s() - elapsed;
+
+	pair = get_value(fd, KEY, sizeof(KEY), CHAR);
+	assert(pair != NULL && pair->value_size == sizeof(value) && pair->value_type == value_type);
+	memcpy(&value, pair->value, sizeof(value));
+	assert(value == (int64_t)num_threads * OPS_PER_THREAD);
+
+	free(pair->value);
+	free(pair);
+	free(threads);
+	return num_threads * OPS_PER_THREAD / elapsed;
+}
+
+int main()
+{
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double base_int = 0;
+	double base_counter = 0;
+	double rate_int;
+	double rate_counter;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	/* powers of two, then all online CPUs */
+	for (int num_threads = 1; ; num_threads *= 2) {
+		if (num_threads > num_cpus) {
+			num_threads = num_cpus;
+		}
+
+		rate_int = run(INT, num_threads);
+		rate_counter = run(COUNTER, num_threads);
+
+		if (num_threads == 1) {
+			base_int = rate_int;
+			base_counter = rate_counter;
+		}
+
+		printf("%3d threads: INT %10.0f incr/s (x%.1f), COUNTER %10.0f incr/s (x%.1f)\n",
+		       num_threads, rate_int, rate_int / base_int, rate_counter, rate_counter / base_counter);
+
+		if (num_threads == num_cpus) {
+			break;
+		}
+	}
+
+	assert(del_pair(fd, KEY, sizeof(KEY), CHAR) == 0);
+
+	close(fd);
+	return 0;
+}
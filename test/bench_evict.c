@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Cache-aside pattern under a byte budget: sets max_bytes to BUDGET, fills
+ * NUM_OF_PAIRS pairs, several times more than fits, then reads keys where
+ * HOT_PERCENT of reads go to HOT_PAIRS keys and every miss sets the pair
+ * again; prints bytes held, evictions, hit ratio of hot and all reads and
+ * reads per second, and asserts budget holds and CLOCK keeps hot pairs;
+ * restores max_bytes after; needs loaded driver with empty dictionary and
+ * debugfs
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           128
+#define NUM_OF_PAIRS      1048576
+#define HOT_PAIRS         32768
+#define HOT_PERCENT       90
+#define NUM_OF_READS      4194304
+#define BATCH_SIZE        256
+#define BUDGET            (32L << 20)
+#define MIN_HOT_RATIO     0.9
+#define PARAM_PATH        "/sys/module/dict_driver/parameters/max_bytes"
+#define CACHE_PATH        "/sys/kernel/debug/dict_driver/dict_device0/cache"
+
+static char (*keys)[KEY_LEN];
+static char val[VAL_LEN];
+static unsigned long long rng = 88172645463325252ULL;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long next_rand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+/* max_bytes module parameter */
+static long get_budget(void)
+{
+	long budget;
+	FILE *f = fopen(PARAM_PATH, "r");
+
+	assert(f != NULL);
+	assert(fscanf(f, "%ld", &budget) == 1);
+	fclose(f);
+	return budget;
+}
+
+static void set_budget(long budget)
+{
+	FILE *f = fopen(PARAM_PATH, "w");
+
+	assert(f != NULL);
+	fprintf(f, "%ld\n", budget);
+	fclose(f);
+}
+
+/* one counter of cache file */
+static long cache_stat(const char *stat)
+{
+	long value = -1;
+	long v;
+	char name[64];
+	FILE *f = fopen(CACHE_PATH, "r");
+
+	assert(f != NULL);
+
+	while (fscanf(f, "%63s %ld%*[^\n]", name, &v) == 2) {
+		if (strcmp(name, stat) == 0) {
+			value = v;
+		}
+	}
+
+	fclose(f);
+	return value;
+}
+
+static void fill_pairs(dict_pair *pairs, int *ids, int count, char (*buf)[VAL_LEN])
+{
+	memset(pairs, 0, count * sizeof(dict_pair));
+
+	for (int i = 0; i < count; i++) {
+		pairs[i].key        = keys[ids[i]];
+		pairs[i].key_size   = KEY_LEN;
+		pairs[i].key_type   = CHAR;
+		pairs[i].value      = buf != NULL ? buf[i] : val;
+		pairs[i].value_size = VAL_LEN;
+		pairs[i].value_type = CHAR;
+	}
+}
+
+int main()
+{
+	int fd;
+	int count;
+	int ids[BATCH_SIZE];
+	int missed[BATCH_SIZE];
+	int status[BATCH_SIZE];
+	long old_budget;
+	long evicted;
+	long hot_reads = 0;
+	long hot_hits = 0;
+	long hits = 0;
+	double elapsed;
+	dict_pair pairs[BATCH_SIZE];
+	static char buf[BATCH_SIZE][VAL_LEN];
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	assert(keys != NULL);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "cache%d", i);
+	}
+
+	memset(val, 'v', VAL_LEN);
+	old_budget = get_budget();
+	set_budget(BUDGET);
+
+	/* fill - everything past the budget pushes older pairs out */
+	evicted = cache_stat("evicted");
+
+	for (int done = 0; done < NUM_OF_PAIRS; done += BATCH_SIZE) {
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			ids[i] = done + i;
+		}
+
+		fill_pairs(pairs, ids, BATCH_SIZE, NULL);
+		assert(set_pairs(fd, pairs, BATCH_SIZE, status) == 0);
+	}
+
+	printf("fill: %d pairs, %ld bytes held of %ld, %ld evicted\n",
+	       NUM_OF_PAIRS, cache_stat("bytes"), BUDGET, cache_stat("evicted") - evicted);
+	assert(cache_stat("bytes") <= BUDGET);
+
+	/* skewed reads, misses set the pair back; second half is counted */
+	elapsed = now_s();
+
+	for (long done = 0; done < NUM_OF_READS; done += BATCH_SIZE) {
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			if ((long)(next_rand() % 100) < HOT_PERCENT) {
+				ids[i] = next_rand() % HOT_PAIRS;
+			} else {
+				ids[i] = HOT_PAIRS + next_rand() % (NUM_OF_PAIRS - HOT_PAIRS);
+			}
+		}
+
+		fill_pairs(pairs, ids, BATCH_SIZE, buf);
+		assert(get_values(fd, pairs, BATCH_SIZE, status) == 0);
+
+		count = 0;
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			assert(status[i] == 0 || status[i] == ENOENT);
+
+			if (status[i] != 0) {
+				missed[count++] = ids[i];
+			}
+
+			if (done >= NUM_OF_READS / 2) {
+				hits += status[i] == 0;
+				hot_reads += ids[i] < HOT_PAIRS;
+				hot_hits += ids[i] < HOT_PAIRS && status[i] == 0;
+			}
+		}
+
+		if (count > 0) {
+			fill_pairs(pairs, missed, count, NULL);
+			assert(set_pairs(fd, pairs, count, status) == 0);
+		}
+	}
+
+	elapsed = now_s() - elapsed;
+
+	printf("reads: %.0f reads/s, hit ratio %.3f hot, %.3f all\n",
+	       NUM_OF_READS / elapsed, (double)hot_hits / hot_reads, (double)hits / (NUM_OF_READS / 2));
+	printf("budget: %ld bytes held of %ld, %ld evicted in total\n",
+	       cache_stat("bytes"), BUDGET, cache_stat("evicted") - evicted);
+
+	assert(cache_stat("bytes") <= BUDGET);
+	assert((double)hot_hits / hot_reads >= MIN_HOT_RATIO);
+
+	/* clean up, most pairs are gone already */
+	set_budget(old_budget);
+
+	for (int done = 0; done < NUM_OF_PAIRS; done += BATCH_SIZE) {
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			ids[i] = done + i;
+		}
+
+		fill_pairs(pairs, ids, BATCH_SIZE, NULL);
+		assert(del_pairs(fd, pairs, BATCH_SIZE, status) == 0);
+	}
+
+	free(keys);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Compares previous driver hash (hash_mem) with SipHash-2-4 that driver uses
+ * now: speed in ns and cycles per byte on 64-256 byte keys, and distribution of
+ * chain lengths when NUM_KEYS keys are put into NUM_KEYS power-of-two buckets,
+ * like driver's table does. Runs in userspace, no device needed.
+ */
+
+#define NUM_KEYS      (1 << 20)
+#define MAX_CHAIN     8
+#define ROUNDS        8
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+typedef unsigned long (*hash_fn)(const unsigned char *, size_t);
+
+static uint64_t sip_key[2];
+
+/* previous driver hash, one byte per iteration */
+static unsigned long hash_mem(const unsigned char *s, size_t len)
+{
+	unsigned long h = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h << 13) + (h >> 7) + h + s[i];
+	}
+	return h;
+}
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+	} while (0)
+
+/* SipHash-2-4, same construction as kernel siphash() */
+static unsigned long siphash(const unsigned char *s, size_t len)
+{
+	uint64_t v0 = 0x736f6d6570736575ULL ^ sip_key[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ sip_key[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ sip_key[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ sip_key[1];
+	uint64_t b = (uint64_t)len << 56;
+	uint64_t m;
+	size_t left = len & 7;
+	const unsigned char *end = s + len - left;
+
+	for (; s != end; s += 8) {
+		memcpy(&m, s, 8);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	for (size_t i = 0; i < left; i++) {
+		b |= (uint64_t)s[i] << (8 * i);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return (v0 ^ v1) ^ (v2 ^ v3);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_speed(const char *name, hash_fn fn, unsigned char *buf, size_t key_len)
+{
+	volatile unsigned long sink = 0;
+	size_t num = NUM_KEYS / 4;
+	long long start;
+	long long ns;
+	unsigned long long cycles = 0;
+
+	start = now_ns();
+#if HAVE_TSC
+	cycles = __rdtsc();
+#endif
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < num; i++) {
+			sink += fn(buf + (i & 1023), key_len);
+		}
+	}
+#if HAVE_TSC
+	cycles = __rdtsc() - cycles;
+#endif
+	ns = now_ns() - start;
+	(void)sink;
+
+	printf("%-10s key %3zu B: %6.3f ns/B", name, key_len, (double)ns / ((double)num * ROUNDS * key_len));
+	if (HAVE_TSC) {
+		printf(", %6.3f cycles/B", (double)cycles / ((double)num * ROUNDS * key_len));
+	}
+	printf("\n");
+}
+
+/* keys like "user:000123" - short common prefix, few changing bytes */
+static void bench_chains(const char *name, hash_fn fn, const char *set, int sequential)
+{
+	unsigned char key[64];
+	unsigned int *chains;
+	unsigned int max = 0;
+	size_t hist[MAX_CHAIN + 1] = {0};
+	size_t key_len;
+
+	chains = calloc(NUM_KEYS, sizeof(unsigned int));
+
+	for (size_t i = 0; i < NUM_KEYS; i++) {
+		if (sequential) {
+			key_len = snprintf((char *)key, sizeof(key), "user:%08zu", i);
+		} else {
+			key_len = 64;
+			for (size_t j = 0; j < key_len; j++) {
+				key[j] = rand();
+			}
+		}
+		chains[fn(key, key_len) & (NUM_KEYS - 1)]++;
+	}
+
+	for (size_t i = 0; i < NUM_KEYS; i++) {
+		hist[chains[i] < MAX_CHAIN ? chains[i] : MAX_CHAIN]++;
+		max = chains[i] > max ? chains[i] : max;
+	}
+
+	printf("%-10s %-10s chains:", name, set);
+	for (int i = 0; i <= MAX_CHAIN; i++) {
+		printf(" %s%d:%5.2f%%", i == MAX_CHAIN ? ">=" : "", i, 100.0 * hist[i] / NUM_KEYS);
+	}
+	printf("  max %u\n", max);
+
+	free(chains);
+}
+
+int main()
+{
+	unsigned char *buf;
+	size_t key_lens[] = {8, 64, 128, 256};
+
+	srand(time(NULL));
+	sip_key[0] = ((uint64_t)rand() << 32) ^ rand();
+	sip_key[1] = ((uint64_t)rand() << 32) ^ rand();
+
+	buf = malloc(1024 + 256);
+	for (int i = 0; i < 1024 + 256; i++) {
+		buf[i] = rand();
+	}
+
+	for (size_t i = 0; i < sizeof(key_lens) / sizeof(key_lens[0]); i++) {
+		bench_speed("hash_mem", hash_mem, buf, key_lens[i]);
+		bench_speed("siphash", siphash, buf, key_lens[i]);
+	}
+
+	/* ideal (Poisson) distribution: 0: 36.79%, 1: 36.79%, 2: 18.39%, 3: 6.13% */
+	bench_chains("hash_mem", hash_mem, "random", 0);
+	bench_chains("siphash", siphash, "random", 0);
+	bench_chains("hash_mem", hash_mem, "sequential", 1);
+	bench_chains("siphash", siphash, "sequential", 1);
+
+	free(buf);
+	return 0;
+}
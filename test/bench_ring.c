@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Compares ops per second of single-pair calls with submission rings: run by
+ * RING_ENTER once per filled ring, and polled by driver worker (SQPOLL), where
+ * steady stream of submissions needs no syscalls at all; needs loaded driver
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      1000000
+#define SQ_ENTRIES        1024
+#define SLOT_LEN          (KEY_LEN + VAL_LEN)
+
+static char (*keys)[KEY_LEN];
+static char val[VAL_LEN];
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * every submission entry owns slot of data area with the same index, slot is
+ * free again once ring_get_sqe() returns its entry
+ */
+static double run_ring(dict_ring *ring, int op)
+{
+	int submitted = 0;
+	int completed = 0;
+	uint32_t idx;
+	unsigned char *slot;
+	dict_sqe *sqe;
+	dict_cqe *cqe;
+	double start = now_s();
+
+	while (completed < NUM_OF_PAIRS) {
+		while (submitted < NUM_OF_PAIRS && (sqe = ring_get_sqe(ring)) != NULL) {
+			idx = sqe - ring->sqes;
+			slot = ring->data + idx * SLOT_LEN;
+
+			memcpy(slot, keys[submitted], KEY_LEN);
+			memcpy(slot + KEY_LEN, val, VAL_LEN);
+
+			sqe->op         = op;
+			sqe->key_type   = CHAR;
+			sqe->value_type = CHAR;
+			sqe->key_size   = KEY_LEN;
+			sqe->value_size = VAL_LEN;
+			sqe->key_off    = idx * SLOT_LEN;
+			sqe->value_off  = idx * SLOT_LEN + KEY_LEN;
+			sqe->user_data  = submitted;
+
+			submitted++;
+		}
+
+		assert(ring_submit(ring) == 0);
+
+		while ((cqe = ring_peek_cqe(ring)) != NULL) {
+			assert(cqe->status == 0);
+			ring_cqe_seen(ring);
+			completed++;
+		}
+	}
+
+	return now_s() - start;
+}
+
+static void bench_ring(const char *name, uint32_t flags)
+{
+	int fd;
+	double set;
+	double get;
+	double del;
+	dict_ring *ring;
+
+	/* ring belongs to file descriptor, so each mode opens its own */
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	ring = ring_setup(fd, SQ_ENTRIES, SQ_ENTRIES * SLOT_LEN, flags);
+	assert(ring != NULL);
+
+	set = run_ring(ring, DICT_OP_SET);
+	get = run_ring(ring, DICT_OP_GET);
+	del = run_ring(ring, DICT_OP_DEL);
+
+	printf("%-8s SET %10.0f ops/s, GET %10.0f ops/s, DEL %10.0f ops/s\n", name,
+	       NUM_OF_PAIRS / set, NUM_OF_PAIRS / get, NUM_OF_PAIRS / del);
+
+	ring_destroy(ring);
+	close(fd);
+}
+
+int main()
+{
+	int fd;
+	double start;
+	double set;
+	double get;
+	double del;
+	dict_pair *recieve;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	assert(keys != NULL);
+
+	memset(val, 'v', sizeof(val));
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "rg%d", i);
+	}
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(set_pair(fd, keys[i], KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	}
+	set = now_s() - start;
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		recieve = get_value(fd, keys[i], KEY_LEN, CHAR);
+		assert(recieve != NULL);
+		free(recieve->value);
+		free(recieve);
+	}
+	get = now_s() - start;
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+	del = now_s() - start;
+
+	printf("%-8s SET %10.0f ops/s, GET %10.0f ops/s, DEL %10.0f ops/s\n", "single",
+	       NUM_OF_PAIRS / set, NUM_OF_PAIRS / get, NUM_OF_PAIRS / del);
+
+	bench_ring("enter", 0);
+	bench_ring("sqpoll", DICT_RING_SQPOLL);
+
+	close(fd);
+	free(keys);
+	return 0;
+}
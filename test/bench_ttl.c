@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Session cache pattern: sets NUM_OF_PAIRS pairs with TTL_MS time to live,
+ * and compares reclaiming them with DEL from userspace sweeper against expiry
+ * in driver; prints CPU time of both, memory held by entries before, after
+ * set and after expiry (from debugfs), and how long reclaim took; asserts
+ * expired pairs are absent right away and all of them are reclaimed within
+ * RECLAIM_LIMIT_S; needs loaded driver with empty dictionary and debugfs
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           64
+#define NUM_OF_PAIRS      1048576
+#define BATCH_SIZE        1024
+#define TTL_MS            3000
+#define RECLAIM_LIMIT_S   5
+#define SLABS_PATH        "/sys/kernel/debug/dict_driver/slabs"
+#define EXPIRY_PATH       "/sys/kernel/debug/dict_driver/dict_device0/expiry"
+
+static char (*keys)[KEY_LEN];
+static char val[VAL_LEN];
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* user and system CPU time of this process */
+static double cpu_s(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* bytes held by entries, sum of the last column of slabs file */
+static long entry_bytes(void)
+{
+	long objects;
+	long bytes;
+	long total = 0;
+	char name[64];
+	char line[256];
+	FILE *f = fopen(SLABS_PATH, "r");
+
+	assert(f != NULL);
+	assert(fgets(line, sizeof(line), f) != NULL);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%63s %ld %ld", name, &objects, &bytes) == 3) {
+			total += bytes;
+		}
+	}
+
+	fclose(f);
+	return total;
+}
+
+/* one counter of expiry file */
+static long expiry_stat(const char *stat)
+{
+	long value = -1;
+	long v;
+	char name[64];
+	FILE *f = fopen(EXPIRY_PATH, "r");
+
+	assert(f != NULL);
+
+	while (fscanf(f, "%63s %ld", name, &v) == 2) {
+		if (strcmp(name, stat) == 0) {
+			value = v;
+		}
+	}
+
+	fclose(f);
+	return value;
+}
+
+/* run op on all pairs in batches, returns number of failed ops */
+static int for_all(int fd, int op, uint32_t ttl_ms)
+{
+	int failed = 0;
+	int status[BATCH_SIZE];
+	char buf[BATCH_SIZE][VAL_LEN];
+	dict_pair pairs[BATCH_SIZE];
+
+	for (int done = 0; done < NUM_OF_PAIRS; done += BATCH_SIZE) {
+		memset(pairs, 0, sizeof(pairs));
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			pairs[i].key        = keys[done + i];
+			pairs[i].key_size   = KEY_LEN;
+			pairs[i].key_type   = CHAR;
+			pairs[i].value      = op == DICT_OP_GET ? buf[i] : val;
+			pairs[i].value_size = VAL_LEN;
+			pairs[i].value_type = CHAR;
+		}
+
+		if (op == DICT_OP_SET) {
+			assert(set_pairs_ttl(fd, pairs, BATCH_SIZE, status, ttl_ms) == 0);
+		} else if (op == DICT_OP_GET) {
+			assert(get_values(fd, pairs, BATCH_SIZE, status) == 0);
+		} else {
+			assert(del_pairs(fd, pairs, BATCH_SIZE, status) == 0);
+		}
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			failed += status[i] != 0;
+		}
+	}
+
+	return failed;
+}
+
+int main()
+{
+	int fd;
+	long base_bytes;
+	long set_bytes;
+	long expired;
+	long sweep_ns;
+	double start;
+	double cpu;
+	double set_cpu;
+	double del_cpu;
+	double reclaim;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	assert(keys != NULL);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "session%d", i);
+	}
+
+	memset(val, 'v', VAL_LEN);
+	base_bytes = entry_bytes();
+
+	/* userspace sweeper - pairs without TTL, deleted by DEL */
+	cpu = cpu_s();
+	assert(for_all(fd, DICT_OP_SET, 0) == 0);
+	set_cpu = cpu_s() - cpu;
+
+	cpu = cpu_s();
+	assert(for_all(fd, DICT_OP_DEL, 0) == 0);
+	del_cpu = cpu_s() - cpu;
+
+	/* the same pairs with TTL, reclaimed by driver */
+	expired = expiry_stat("expired");
+	sweep_ns = expiry_stat("sweep_ns");
+
+	cpu = cpu_s();
+	assert(for_all(fd, DICT_OP_SET, TTL_MS) == 0);
+	printf("set: %.3f s CPU without TTL, %.3f s CPU with TTL\n", set_cpu, cpu_s() - cpu);
+
+	set_bytes = entry_bytes();
+	assert(expiry_stat("expiring") == NUM_OF_PAIRS);
+	assert(for_all(fd, DICT_OP_GET, 0) == 0);
+
+	usleep(TTL_MS * 1000);
+
+	/* absent right away, whether reclaimed or not */
+	start = now_s();
+	assert(for_all(fd, DICT_OP_GET, 0) == NUM_OF_PAIRS);
+
+	while (expiry_stat("expiring") != 0 && now_s() - start < RECLAIM_LIMIT_S) {
+		usleep(10000);
+	}
+
+	reclaim = now_s() - start;
+	expired = expiry_stat("expired") - expired;
+	sweep_ns = expiry_stat("sweep_ns") - sweep_ns;
+
+	/* entries are freed after RCU grace period */
+	usleep(100000);
+
+	printf("reclaim: %.3f s CPU by DEL from userspace, %.3f s CPU by expiry work\n", del_cpu, sweep_ns / 1e9);
+	printf("expired %ld pairs within %.2f s after TTL\n", expired, reclaim);
+	printf("entry memory: %ld bytes before, %ld after set, %ld after expiry\n", base_bytes, set_bytes, entry_bytes());
+
+	assert(expiry_stat("expiring") == 0 && expired == NUM_OF_PAIRS);
+
+	free(keys);
+	close(fd);
+	return 0;
+}
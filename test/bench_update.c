@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Threads increment one shared counter, comparing get_value() with set_pair(),
+ * which loses updates of other threads, a get_value() and cas_value() retry
+ * loop, and single INCR request; prints increments per second, lost updates
+ * and CAS retries for 1 to MAX_THREADS threads; needs loaded driver
+ */
+
+#define MAX_THREADS       8
+#define OPS_PER_THREAD    100000
+#define KEY               "bench_update"
+
+enum mode {
+	GET_SET,
+	CAS_LOOP,
+	INCR
+};
+
+static const char *mode_names[] = { "get+set", "cas loop", "incr" };
+
+static int fd;
+static enum mode run_mode;
+static long retries[MAX_THREADS];
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int64_t read_counter(void)
+{
+	int64_t value;
+	dict_pair *pair = get_value(fd, KEY, sizeof(KEY), CHAR);
+
+	assert(pair != NULL && pair->value_size == sizeof(value));
+	memcpy(&value, pair->value, sizeof(value));
+	free(pair->value);
+	free(pair);
+	return value;
+}
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	int64_t old;
+	int64_t new;
+	int retval;
+
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		switch (run_mode) {
+		case GET_SET:
+			new = read_counter() + 1;
+			assert(set_pair(fd, KEY, sizeof(KEY), CHAR, &new, sizeof(new), INT) == 0);
+			break;
+
+		case CAS_LOOP:
+			do {
+				old = read_counter();
+				new = old + 1;
+				retval = cas_value(fd, KEY, sizeof(KEY), CHAR, &old, sizeof(old), &new, sizeof(new), INT);
+				retries[id] += retval == ECANCELED;
+			} while (retval == ECANCELED);
+
+			assert(retval == 0);
+			break;
+
+		case INCR:
+			assert(incr_value(fd, KEY, sizeof(KEY), CHAR, 1, NULL) == 0);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void run(enum mode mode, int num_threads)
+{
+	long total_retries = 0;
+	int64_t zero = 0;
+	int64_t expected = (int64_t)num_threads * OPS_PER_THREAD;
+	int64_t counter;
+	double elapsed;
+	pthread_t threads[MAX_THREADS];
+
+	assert(set_pair(fd, KEY, sizeof(KEY), CHAR, &zero, sizeof(zero), INT) == 0);
+	memset(retries, 0, sizeof(retries));
+	run_mode = mode;
+
+	elapsed = now_s();
+	for (long i = 0; i < num_threads; i++) {
+		assert(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	elapsed = now_s() - elapsed;
+
+	for (int i = 0; i < num_threads; i++) {
+		total_retries += retries[i];
+	}
+
+	counter = read_counter();
+
+	printf("%-9s %d threads: %10.0f incr/s, %8ld lost, %8ld retries\n",
+	       mode_names[mode], num_threads, expected / elapsed, (long)(expected - counter), total_retries);
+
+	if (mode != GET_SET) {
+		assert(counter == expected);
+	}
+}
+
+int main()
+{
+	int64_t result = 0;
+	uint64_t version;
+	size_t new_size;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	for (int num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+		for (int mode = GET_SET; mode <= INCR; mode++) {
+			run(mode, num_threads);
+		}
+	}
+
+	/* the other operations once, on the same key */
+	assert(set_if_absent(fd, KEY, sizeof(KEY), CHAR, &result, sizeof(result), INT) == EEXIST);
+	assert(decr_value(fd, KEY, sizeof(KEY), CHAR, read_counter(), &result) == 0 && result == 0);
+	assert(get_version(fd, KEY, sizeof(KEY), CHAR, &version) == 0);
+	assert(cas_version(fd, KEY, sizeof(KEY), CHAR, &version, &result, sizeof(result), INT) == 0);
+	version--;
+	assert(cas_version(fd, KEY, sizeof(KEY), CHAR, &version, &result, sizeof(result), INT) == ECANCELED);
+	assert(append_value(fd, KEY, sizeof(KEY), CHAR, "tail", 4, CHAR, &new_size) == 0 && new_size == sizeof(result) + 4);
+	assert(incr_value(fd, KEY, sizeof(KEY), CHAR, 1, &result) == EINVAL);
+
+	assert(del_pair(fd, KEY, sizeof(KEY), CHAR) == 0);
+	assert(set_if_absent(fd, KEY, sizeof(KEY), CHAR, &result, sizeof(result), INT) == 0);
+	assert(del_pair(fd, KEY, sizeof(KEY), CHAR) == 0);
+
+	close(fd);
+	return 0;
+}
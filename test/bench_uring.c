@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/uring_client.h"
+
+/*
+ * Compares throughput and latency of ioctl client with io_uring passthrough
+ * keeping QUEUE_DEPTH commands in flight, on SET, GET and DEL of NUM_OF_PAIRS
+ * pairs; needs loaded driver on kernel with .uring_cmd (5.19+) and liburing
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      1000000
+#define QUEUE_DEPTH       64
+
+static char (*keys)[KEY_LEN];
+static char (*vals)[VAL_LEN];
+static dict_pair *msgs;
+static long long *start_ns;
+static long long *lat;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, long long total)
+{
+	qsort(lat, NUM_OF_PAIRS, sizeof(long long), cmp_ll);
+
+	printf("%-12s %10.0f ops/s, p50 %lld ns, p99 %lld ns\n", name,
+	       NUM_OF_PAIRS / (total / 1e9), lat[NUM_OF_PAIRS / 2], lat[NUM_OF_PAIRS / 100 * 99]);
+}
+
+static void run_ioctl(int fd, int op, const char *name)
+{
+	long long total = now_ns();
+	dict_pair *recieve;
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		start_ns[i] = now_ns();
+
+		if (op == DICT_OP_SET) {
+			assert(set_pair(fd, keys[i], KEY_LEN, CHAR, vals[i], VAL_LEN, CHAR) == 0);
+		} else if (op == DICT_OP_GET) {
+			recieve = get_value(fd, keys[i], KEY_LEN, CHAR);
+			assert(recieve != NULL);
+			free(recieve->value);
+			free(recieve);
+		} else {
+			assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+		}
+
+		lat[i] = now_ns() - start_ns[i];
+	}
+
+	report(name, now_ns() - total);
+}
+
+static void run_uring(struct io_uring *ring, int fd, int op, const char *name)
+{
+	int idx;
+	int submitted = 0;
+	int completed = 0;
+	int in_flight = 0;
+	long long total = now_ns();
+	struct io_uring_cqe *cqe;
+
+	while (completed < NUM_OF_PAIRS) {
+		while (submitted < NUM_OF_PAIRS && in_flight < QUEUE_DEPTH) {
+			dict_pair *message = &msgs[submitted];
+
+			memset(message, 0, sizeof(dict_pair));
+			message->key        = keys[submitted];
+			message->key_size   = KEY_LEN;
+			message->key_type   = CHAR;
+			message->value      = vals[submitted];
+			message->value_size = VAL_LEN;
+			message->value_type = CHAR;
+
+			if (op == DICT_OP_SET) {
+				assert(uring_prep_set_pair(ring, fd, message) == 0);
+			} else if (op == DICT_OP_GET) {
+				assert(uring_prep_get_pair(ring, fd, message) == 0);
+			} else {
+				assert(uring_prep_del_pair(ring, fd, message) == 0);
+			}
+
+			start_ns[submitted++] = now_ns();
+			in_flight++;
+		}
+
+		assert(io_uring_submit_and_wait(ring, 1) >= 0);
+
+		while (io_uring_peek_cqe(ring, &cqe) == 0) {
+			assert(cqe->res == 0);
+			idx = (dict_pair *)io_uring_cqe_get_data(cqe) - msgs;
+			lat[idx] = now_ns() - start_ns[idx];
+			io_uring_cqe_seen(ring, cqe);
+			completed++;
+			in_flight--;
+		}
+	}
+
+	report(name, now_ns() - total);
+}
+
+int main()
+{
+	int fd;
+	struct io_uring ring;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+	assert(io_uring_queue_init(QUEUE_DEPTH, &ring, 0) == 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	vals = calloc(NUM_OF_PAIRS, VAL_LEN);
+	msgs = calloc(NUM_OF_PAIRS, sizeof(dict_pair));
+	start_ns = calloc(NUM_OF_PAIRS, sizeof(long long));
+	lat = calloc(NUM_OF_PAIRS, sizeof(long long));
+	assert(keys != NULL && vals != NULL && msgs != NULL && start_ns != NULL && lat != NULL);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "ur%d", i);
+		memset(vals[i], 'v', VAL_LEN);
+	}
+
+	run_ioctl(fd, DICT_OP_SET, "ioctl SET");
+	run_ioctl(fd, DICT_OP_GET, "ioctl GET");
+	run_ioctl(fd, DICT_OP_DEL, "ioctl DEL");
+
+	run_uring(&ring, fd, DICT_OP_SET, "uring SET");
+	run_uring(&ring, fd, DICT_OP_GET, "uring GET");
+	run_uring(&ring, fd, DICT_OP_DEL, "uring DEL");
+
+	io_uring_queue_exit(&ring);
+	free(keys);
+	free(vals);
+	free(msgs);
+	free(start_ns);
+	free(lat);
+	return 0;
+}
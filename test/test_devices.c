@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Checks that device minors hold isolated dictionaries: the same key set on
+ * NUM_OF_DEVICES devices keeps its own value on each, DEL and record stream
+ * of one device do not see the others; then one thread fills the last
+ * device with NUM_OF_PAIRS pairs, so its tables keep growing, while reads
+ * on the first one are timed, and prints their p99 with and without that
+ * neighbour; load driver with num_devices=4
+ */
+
+#define NUM_OF_DEVICES    4
+#define KEY               "tenant_key"
+#define KEY_LEN           16
+#define VAL_LEN           64
+#define NUM_OF_PAIRS      1000000
+#define NUM_OF_READS      200000
+#define READ_KEYS         1000
+
+static int fds[NUM_OF_DEVICES];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void make_key(char *key, const char *prefix, int i)
+{
+	memset(key, 0, KEY_LEN);
+	snprintf(key, KEY_LEN, "%s%d", prefix, i);
+}
+
+/* fills last device and deletes everything again */
+static void *noisy(void *arg)
+{
+	char key[KEY_LEN];
+	char val[VAL_LEN] = "noisy";
+	int fd = fds[NUM_OF_DEVICES - 1];
+
+	(void)arg;
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, "noisy", i);
+		assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	}
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, "noisy", i);
+		assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	}
+
+	return NULL;
+}
+
+/* p99 of GET latency on the first device, in ns */
+static double read_p99(void)
+{
+	char key[KEY_LEN];
+	double start;
+	double *lat = malloc(NUM_OF_READS * sizeof(double));
+	dict_pair *pair;
+
+	assert(lat != NULL);
+
+	for (int i = 0; i < NUM_OF_READS; i++) {
+		make_key(key, "quiet", i % READ_KEYS);
+
+		start = now_ns();
+		pair = get_value(fds[0], key, KEY_LEN, CHAR);
+		lat[i] = now_ns() - start;
+
+		assert(pair != NULL);
+		free(pair->value);
+		free(pair);
+	}
+
+	qsort(lat, NUM_OF_READS, sizeof(double), cmp_double);
+	start = lat[NUM_OF_READS * 99 / 100];
+	free(lat);
+	return start;
+}
+
+static void test_isolation(void)
+{
+	char path[64];
+	char value[VAL_LEN];
+	char buf[256];
+	dict_pair *pair;
+
+	for (int d = 0; d < NUM_OF_DEVICES; d++) {
+		snprintf(path, sizeof(path), DEVICE_PATH_FMT, d);
+		fds[d] = open(path, O_RDWR);
+		assert(fds[d] >= 0);
+
+		snprintf(value, sizeof(value), "value of device %d", d);
+		assert(set_pair(fds[d], KEY, sizeof(KEY), CHAR, value, strlen(value) + 1, CHAR) == 0);
+	}
+
+	for (int d = 0; d < NUM_OF_DEVICES; d++) {
+		snprintf(value, sizeof(value), "value of device %d", d);
+		pair = get_value(fds[d], KEY, sizeof(KEY), CHAR);
+
+		assert(pair != NULL && strcmp(pair->value, value) == 0);
+		free(pair->value);
+		free(pair);
+	}
+
+	/* deletion on one device leaves the key on the others */
+	assert(del_pair(fds[0], KEY, sizeof(KEY), CHAR) == 0);
+	assert(get_value(fds[0], KEY, sizeof(KEY), CHAR) == NULL);
+
+	for (int d = 1; d < NUM_OF_DEVICES; d++) {
+		pair = get_value(fds[d], KEY, sizeof(KEY), CHAR);
+
+		assert(pair != NULL);
+		free(pair->value);
+		free(pair);
+	}
+
+	/* record stream of empty device has nothing of the others */
+	assert(read(fds[0], buf, sizeof(buf)) == 0);
+
+	for (int d = 1; d < NUM_OF_DEVICES; d++) {
+		assert(del_pair(fds[d], KEY, sizeof(KEY), CHAR) == 0);
+	}
+}
+
+int main()
+{
+	char key[KEY_LEN];
+	char val[VAL_LEN] = "quiet";
+	double alone;
+	double shared;
+	pthread_t thread;
+
+	test_isolation();
+
+	for (int i = 0; i < READ_KEYS; i++) {
+		make_key(key, "quiet", i);
+		assert(set_pair(fds[0], key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	}
+
+	alone = read_p99();
+
+	assert(pthread_create(&thread, NULL, noisy, NULL) == 0);
+	shared = read_p99();
+	pthread_join(thread, NULL);
+
+	printf("GET p99 on device 0: %.0f ns alone, %.0f ns while device %d grows\n",
+	       alone, shared, NUM_OF_DEVICES - 1);
+
+	for (int i = 0; i < READ_KEYS; i++) {
+		make_key(key, "quiet", i);
+		assert(del_pair(fds[0], key, KEY_LEN, CHAR) == 0);
+	}
+
+	for (int d = 0; d < NUM_OF_DEVICES; d++) {
+		close(fds[d]);
+	}
+
+	return 0;
+}
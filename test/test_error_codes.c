@@ -77,6 +77,40 @@ void test_overwrite(int fd)
     assert(del_pair(fd, key, sizeof(key), CHAR) == 0);
 }
 
+void test_get_small_buffer(int fd)
+{
+    char big_value[GET_VALUE_CAPACITY * 4];
+    char small_buffer[1];
+    dict_pair message = {0};
+    dict_pair *recieved;
+
+    memset(big_value, 'b', sizeof(big_value));
+    assert(set_pair(fd, key, sizeof(key), CHAR, big_value, sizeof(big_value), CHAR) == 0);
+
+    /* too small buffer fails, but reports required size and type */
+    message.key         = key;
+    message.key_size    = sizeof(key);
+    message.key_type    = CHAR;
+    message.value       = small_buffer;
+    message.value_size  = sizeof(small_buffer);
+
+    assert(ioctl(fd, GET_PAIR, &message) == ERANGE);
+    assert(message.value_size == sizeof(big_value));
+    assert(message.value_type == CHAR);
+
+    /* get_value grows its buffer and retries */
+    recieved = get_value(fd, key, sizeof(key), CHAR);
+
+    assert(recieved != NULL);
+    assert(recieved->value_size == sizeof(big_value));
+    assert(memcmp(recieved->value, big_value, recieved->value_size) == 0);
+
+    free(recieved->value);
+    free(recieved);
+
+    assert(del_pair(fd, key, sizeof(key), CHAR) == 0);
+}
+
 
 int main() {
 	int fd;
@@ -86,6 +120,7 @@ int main() {
 	test_get_wrong_input(fd);
 	test_del_wrong_input(fd);
 	test_overwrite(fd);
+	test_get_small_buffer(fd);
 	
 	return 0;
 }
\ No newline at end of file
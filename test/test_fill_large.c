@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Bucket array used to come from kzalloc, which could not grow one shard past
+ * about half a million buckets; load driver with num_shards=1 so that single
+ * table is pushed well past that, and check lookups cost about the same on
+ * every size
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           8
+#define NUM_OF_PAIRS      (1 << 23)
+#define FIRST_CHECKPOINT  (1 << 17)
+#define NUM_OF_LOOKUPS    200000
+#define MAX_SLOWDOWN      3
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void make_key(char *key, int i)
+{
+	memset(key, 0, KEY_LEN);
+	snprintf(key, KEY_LEN, "fk%d", i);
+}
+
+/* mean latency of NUM_OF_LOOKUPS gets of random keys out of first n */
+static long long mean_get_ns(int fd, int n)
+{
+	long long start;
+	char key[KEY_LEN];
+	dict_pair *recieve;
+
+	start = now_ns();
+
+	for (int i = 0; i < NUM_OF_LOOKUPS; i++) {
+		make_key(key, rand() % n);
+		recieve = get_value(fd, key, KEY_LEN, CHAR);
+		assert(recieve != NULL);
+		free(recieve->value);
+		free(recieve);
+	}
+
+	return (now_ns() - start) / NUM_OF_LOOKUPS;
+}
+
+int main()
+{
+	int fd;
+	long long mean;
+	long long base = 0;
+	char key[KEY_LEN];
+	char val[VAL_LEN];
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	memset(val, 'v', sizeof(val));
+	srand(1);
+
+	/* lookups are sampled every time number of pairs doubles */
+	for (int i = 0, checkpoint = FIRST_CHECKPOINT; i < NUM_OF_PAIRS; i++) {
+		make_key(key, i);
+		assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+
+		if (i + 1 == checkpoint) {
+			mean = mean_get_ns(fd, i + 1);
+			printf("%10d pairs: GET mean %lld ns\n", i + 1, mean);
+
+			if (base == 0) {
+				base = mean;
+			}
+
+			assert(mean <= base * MAX_SLOWDOWN);
+			checkpoint *= 2;
+		}
+	}
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, i);
+		assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	}
+
+	printf("Large fill test passed!\n");
+	return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Fills NUM_OF_PAIRS pairs with mixed key and value types, COUNTERs among
+ * them, and checks DEL_BY_TYPE deletes exactly the pairs of given types and
+ * leaves the rest, refusing request without any type; then fills
+ * NUM_OF_FLUSHED pairs, times FLUSH, and checks dictionary and its sysfs
+ * usage counters are empty and take new pairs right away; needs loaded
+ * driver with empty dictionary
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           64
+#define NUM_OF_PAIRS      100000
+#define NUM_OF_FLUSHED    1048576
+#define BATCH_SIZE        256
+#define SYSFS_PATH        "/sys/class/dict_class/dict_device0/"
+
+static char val[VAL_LEN];
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long read_attr(const char *name)
+{
+	long value;
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), SYSFS_PATH "%s", name);
+	f = fopen(path, "r");
+
+	assert(f != NULL);
+	assert(fscanf(f, "%ld", &value) == 1);
+	fclose(f);
+	return value;
+}
+
+static void make_key(char *key, int i)
+{
+	memset(key, 0, KEY_LEN);
+	snprintf(key, KEY_LEN, "flush%d", i);
+}
+
+/* odd pairs have INT keys, every fifth one is COUNTER */
+static int key_type_of(int i)
+{
+	return i % 2 ? INT : CHAR;
+}
+
+static int value_type_of(int i)
+{
+	return i % 5 == 0 ? COUNTER : CHAR;
+}
+
+static int exists(int fd, int i)
+{
+	char key[KEY_LEN];
+	dict_pair *pair;
+
+	make_key(key, i);
+	pair = get_value(fd, key, KEY_LEN, key_type_of(i));
+
+	if (pair == NULL) {
+		return 0;
+	}
+
+	free(pair->value);
+	free(pair);
+	return 1;
+}
+
+static void test_del_by_type(int fd)
+{
+	char key[KEY_LEN];
+	int64_t counter = 0;
+	uint64_t deleted;
+	long left = NUM_OF_PAIRS;
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, i);
+
+		if (value_type_of(i) == COUNTER) {
+			assert(set_pair(fd, key, KEY_LEN, key_type_of(i), &counter, sizeof(counter), COUNTER) == 0);
+		} else {
+			assert(set_pair(fd, key, KEY_LEN, key_type_of(i), val, VAL_LEN, CHAR) == 0);
+		}
+	}
+
+	assert(read_attr("entries") == NUM_OF_PAIRS);
+	assert(del_by_type(fd, 0, 0, NULL) == EINVAL);
+
+	/* all COUNTERs, whatever key type */
+	assert(del_by_type(fd, 0, COUNTER, &deleted) == 0);
+	assert(deleted == NUM_OF_PAIRS / 5);
+	left -= deleted;
+
+	/* INT keys with CHAR values, COUNTERs among them are gone already */
+	assert(del_by_type(fd, INT, CHAR, &deleted) == 0);
+	assert(deleted == NUM_OF_PAIRS / 2 - NUM_OF_PAIRS / 10);
+	left -= deleted;
+
+	assert(del_by_type(fd, INT, 0, &deleted) == 0 && deleted == 0);
+	assert(read_attr("entries") == left);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(exists(fd, i) == (key_type_of(i) == CHAR && value_type_of(i) == CHAR));
+	}
+
+	assert(del_by_type(fd, CHAR, 0, &deleted) == 0);
+	assert((long)deleted == left);
+	assert(read_attr("entries") == 0 && read_attr("bytes") == 0);
+}
+
+static void test_flush(int fd)
+{
+	char key[KEY_LEN];
+	char (*keys)[KEY_LEN];
+	int status[BATCH_SIZE];
+	uint64_t flushed;
+	double elapsed;
+	dict_pair pairs[BATCH_SIZE];
+
+	keys = calloc(NUM_OF_FLUSHED, KEY_LEN);
+	assert(keys != NULL);
+
+	for (int done = 0; done < NUM_OF_FLUSHED; done += BATCH_SIZE) {
+		memset(pairs, 0, sizeof(pairs));
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			make_key(keys[done + i], done + i);
+			pairs[i].key        = keys[done + i];
+			pairs[i].key_size   = KEY_LEN;
+			pairs[i].key_type   = CHAR;
+			pairs[i].value      = val;
+			pairs[i].value_size = VAL_LEN;
+			pairs[i].value_type = CHAR;
+		}
+
+		assert(set_pairs(fd, pairs, BATCH_SIZE, status) == 0);
+	}
+
+	assert(read_attr("entries") == NUM_OF_FLUSHED);
+
+	elapsed = now_ms();
+	assert(flush_dict(fd, &flushed) == 0);
+	elapsed = now_ms() - elapsed;
+
+	printf("FLUSH of %d pairs: %.3f ms\n", NUM_OF_FLUSHED, elapsed);
+
+	assert(flushed == NUM_OF_FLUSHED);
+	assert(read_attr("entries") == 0 && read_attr("bytes") == 0);
+
+	for (int i = 0; i < NUM_OF_FLUSHED; i += NUM_OF_FLUSHED / 1024) {
+		assert(get_value(fd, keys[i], KEY_LEN, CHAR) == NULL);
+	}
+
+	/* empty dictionary flushes fine, and takes pairs right after */
+	assert(flush_dict(fd, &flushed) == 0 && flushed == 0);
+	assert(flush_dict(fd, NULL) == 0);
+
+	make_key(key, 0);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	assert(exists(fd, 0));
+	assert(read_attr("entries") == 1);
+	assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+
+	free(keys);
+}
+
+int main()
+{
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	memset(val, 'v', VAL_LEN);
+	assert(read_attr("entries") == 0);
+
+	test_del_by_type(fd);
+	test_flush(fd);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Sets quotas of the first device through sysfs and checks SET enforces
+ * them: NUM_OF_PAIRS pairs fit entry quota and one more is refused with
+ * EDQUOT, while overwrite of existing pair and SET after DEL still work;
+ * then byte quota a bit over what pairs take refuses a value that grows
+ * too much and takes smaller one; checks sysfs usage counters along the
+ * way and removes quotas after; needs loaded driver with empty dictionary
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           64
+#define BIG_LEN           65536
+#define NUM_OF_PAIRS      1000
+#define SYSFS_PATH        "/sys/class/dict_class/dict_device0/"
+
+static char val[VAL_LEN];
+static char big[BIG_LEN];
+
+static long read_attr(const char *name)
+{
+	long value;
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), SYSFS_PATH "%s", name);
+	f = fopen(path, "r");
+
+	assert(f != NULL);
+	assert(fscanf(f, "%ld", &value) == 1);
+	fclose(f);
+	return value;
+}
+
+static void write_attr(const char *name, long value)
+{
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), SYSFS_PATH "%s", name);
+	f = fopen(path, "w");
+
+	assert(f != NULL);
+	fprintf(f, "%ld\n", value);
+	assert(fclose(f) == 0);
+}
+
+static void make_key(char *key, int i)
+{
+	memset(key, 0, KEY_LEN);
+	snprintf(key, KEY_LEN, "quota%d", i);
+}
+
+static void test_entries(int fd)
+{
+	char key[KEY_LEN];
+
+	write_attr("quota_entries", NUM_OF_PAIRS);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, i);
+		assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	}
+
+	assert(read_attr("entries") == NUM_OF_PAIRS);
+
+	/* new key does not fit, existing one can still change */
+	make_key(key, NUM_OF_PAIRS);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == EDQUOT);
+	assert(get_value(fd, key, KEY_LEN, CHAR) == NULL);
+
+	make_key(key, 0);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN / 2, CHAR) == 0);
+
+	/* deletion makes room again */
+	assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	make_key(key, NUM_OF_PAIRS);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+
+	write_attr("quota_entries", 0);
+	make_key(key, 0);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+	assert(read_attr("entries") == NUM_OF_PAIRS + 1);
+}
+
+static void test_bytes(int fd)
+{
+	char key[KEY_LEN];
+	long bytes = read_attr("bytes");
+	dict_pair *pair;
+
+	assert(bytes > (long)NUM_OF_PAIRS * VAL_LEN);
+	write_attr("quota_bytes", bytes + BIG_LEN / 2);
+
+	/* value that grows pair past the quota is refused, old one stays */
+	make_key(key, 1);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, big, BIG_LEN, CHAR) == EDQUOT);
+	assert(read_attr("bytes") == bytes);
+	pair = get_value(fd, key, KEY_LEN, CHAR);
+	assert(pair != NULL && pair->value_size == VAL_LEN);
+	free(pair->value);
+	free(pair);
+
+	/* smaller value and pair that fits in what is left are fine */
+	assert(set_pair(fd, key, KEY_LEN, CHAR, val, VAL_LEN / 2, CHAR) == 0);
+	assert(set_pair(fd, "small", sizeof("small"), CHAR, big, BIG_LEN / 4, CHAR) == 0);
+	assert(read_attr("bytes") <= bytes + BIG_LEN / 2);
+
+	write_attr("quota_bytes", 0);
+	assert(set_pair(fd, key, KEY_LEN, CHAR, big, BIG_LEN, CHAR) == 0);
+	assert(del_pair(fd, "small", sizeof("small"), CHAR) == 0);
+}
+
+int main()
+{
+	int fd;
+	char key[KEY_LEN];
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	memset(val, 'v', VAL_LEN);
+	memset(big, 'b', BIG_LEN);
+	assert(read_attr("entries") == 0);
+
+	test_entries(fd);
+	test_bytes(fd);
+
+	for (int i = 0; i <= NUM_OF_PAIRS; i++) {
+		make_key(key, i);
+		assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	}
+
+	assert(read_attr("entries") == 0 && read_attr("bytes") == 0);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Table grows every time number of pairs in shard doubles; sets NUM_OF_PAIRS
+ * new pairs interleaved with gets, so every set may hit a resize, then sets
+ * the same keys again at constant size as a baseline, and checks p99 of the
+ * growing pass is within MAX_SLOWDOWN of the baseline one; needs driver loaded
+ * with num_shards=1 to make those resizes as large as possible
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      2000000
+#define MAX_SLOWDOWN      4
+#define NUM_SHARDS_PATH   "/sys/module/dict_driver/parameters/num_shards"
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned int read_num_shards(void)
+{
+	unsigned int value = 0;
+	FILE *f = fopen(NUM_SHARDS_PATH, "r");
+
+	if (f != NULL) {
+		if (fscanf(f, "%u", &value) != 1) {
+			value = 0;
+		}
+		fclose(f);
+	}
+
+	return value;
+}
+
+/* every set may hit a resize if keys are new, interleaved get checks readers do not stall */
+static void run_pass(int fd, char (*keys)[KEY_LEN], char *val, long long *set_lat, long long *get_lat)
+{
+	long long start;
+	dict_pair *recieve;
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		start = now_ns();
+		assert(set_pair(fd, keys[i], KEY_LEN, CHAR, val, VAL_LEN, CHAR) == 0);
+		set_lat[i] = now_ns() - start;
+
+		start = now_ns();
+		recieve = get_value(fd, keys[i / 2], KEY_LEN, CHAR);
+		get_lat[i] = now_ns() - start;
+
+		assert(recieve != NULL);
+		free(recieve->value);
+		free(recieve);
+	}
+}
+
+/* sort latencies, print percentiles and return p99 */
+static long long report(const char *name, long long *lat, size_t n)
+{
+	qsort(lat, n, sizeof(long long), cmp_ll);
+
+	printf("%s: p50 %lld ns, p99 %lld ns, p99.9 %lld ns, max %lld ns\n", name,
+	       lat[n / 2], lat[n / 100 * 99], lat[n / 1000 * 999], lat[n - 1]);
+
+	return lat[n / 100 * 99];
+}
+
+int main()
+{
+	int fd;
+	long long set_p99;
+	long long get_p99;
+	long long base_set_p99;
+	long long base_get_p99;
+	long long *set_lat;
+	long long *get_lat;
+	char (*keys)[KEY_LEN];
+	char val[VAL_LEN];
+	unsigned int shards;
+
+	shards = read_num_shards();
+
+	if (shards != 1) {
+		fprintf(stderr, "driver has %u shards, load it with num_shards=1\n", shards);
+		return 1;
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	set_lat = calloc(NUM_OF_PAIRS, sizeof(long long));
+	get_lat = calloc(NUM_OF_PAIRS, sizeof(long long));
+	assert(keys != NULL && set_lat != NULL && get_lat != NULL);
+
+	memset(val, 'v', sizeof(val));
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "rk%d", i);
+	}
+
+	run_pass(fd, keys, val, set_lat, get_lat);
+	set_p99 = report("SET growing", set_lat, NUM_OF_PAIRS);
+	get_p99 = report("GET growing", get_lat, NUM_OF_PAIRS);
+
+	/* same keys again overwrite pairs, table keeps its size */
+	run_pass(fd, keys, val, set_lat, get_lat);
+	base_set_p99 = report("SET baseline", set_lat, NUM_OF_PAIRS);
+	base_get_p99 = report("GET baseline", get_lat, NUM_OF_PAIRS);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+
+	assert(set_p99 <= base_set_p99 * MAX_SLOWDOWN);
+	assert(get_p99 <= base_get_p99 * MAX_SLOWDOWN);
+
+	free(keys);
+	free(set_lat);
+	free(get_lat);
+
+	printf("Resize latency test passed!\n");
+	return 0;
+}
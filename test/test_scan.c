@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Scans dictionary in small steps while growing it with new pairs between
+ * calls, then while deleting them again so it shrinks, and checks that every
+ * pair present during the whole scan was returned with its value; load driver
+ * with num_shards=1 to make those resizes as large as possible
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      100000
+#define EXTRA_PER_CALL    2000
+#define BUF_SIZE          4096
+#define MAX_RECORDS       100
+
+static char *seen;
+static int num_extra;
+
+static void make_key(char *key, const char *prefix, int i)
+{
+	memset(key, 0, KEY_LEN);
+	snprintf(key, KEY_LEN, "%s%d", prefix, i);
+}
+
+/* mark base pairs from one SCAN response, checking that value matches key */
+static void check_records(dict_scan *request)
+{
+	int i;
+	char *key;
+	dict_scan_record *record = NULL;
+
+	while ((record = scan_next_record(request, record)) != NULL) {
+		assert(record->key_type == CHAR && record->value_type == CHAR);
+		assert(record->key_size == KEY_LEN && record->value_size == VAL_LEN);
+
+		key = (char *)(record + 1);
+
+		if (strncmp(key, "scan", 4) != 0) {
+			continue;
+		}
+
+		i = atoi(key + 4);
+		assert(i >= 0 && i < NUM_OF_PAIRS);
+		assert(memcmp(key, key + KEY_LEN, KEY_LEN) == 0);
+		seen[i] = 1;
+	}
+}
+
+/* full scan that calls change() after every step */
+static void scan_all(int fd, const char *name, void (*change)(int))
+{
+	int calls = 0;
+	int missing = 0;
+	char buf[BUF_SIZE];
+	dict_scan request;
+
+	memset(seen, 0, NUM_OF_PAIRS);
+	memset(&request, 0, sizeof(request));
+
+	do {
+		request.buf         = buf;
+		request.buf_size    = sizeof(buf);
+		request.max_records = MAX_RECORDS;
+		request.flags       = DICT_SCAN_VALUES;
+
+		assert(scan_pairs(fd, &request) == 0);
+		assert(request.used <= sizeof(buf));
+		check_records(&request);
+
+		change(fd);
+		calls++;
+	} while (request.cursor != 0);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		missing += !seen[i];
+	}
+
+	printf("%s: %d calls, %d of %d pairs missing\n", name, calls, missing, NUM_OF_PAIRS);
+	assert(missing == 0);
+}
+
+static void add_extra(int fd)
+{
+	char key[KEY_LEN];
+
+	for (int i = 0; i < EXTRA_PER_CALL; i++) {
+		make_key(key, "extra", num_extra++);
+		assert(set_pair(fd, key, KEY_LEN, CHAR, key, VAL_LEN, CHAR) == 0);
+	}
+}
+
+static void del_extra(int fd)
+{
+	char key[KEY_LEN];
+
+	for (int i = 0; i < EXTRA_PER_CALL && num_extra > 0; i++) {
+		make_key(key, "extra", --num_extra);
+		assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	}
+}
+
+static void no_change(int fd)
+{
+	(void)fd;
+}
+
+int main()
+{
+	int fd;
+	char key[KEY_LEN];
+	char small_buf[8];
+	dict_scan request;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	seen = calloc(NUM_OF_PAIRS, 1);
+	assert(seen != NULL);
+
+	/* value is a copy of the key, so records can be checked on their own */
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, "scan", i);
+		assert(set_pair(fd, key, KEY_LEN, CHAR, key, VAL_LEN, CHAR) == 0);
+	}
+
+	/* buffer too small for any record reports size it needs */
+	memset(&request, 0, sizeof(request));
+	request.buf      = small_buf;
+	request.buf_size = sizeof(small_buf);
+	while (scan_pairs(fd, &request) == 0 && request.cursor != 0)
+		;
+	assert(request.used > sizeof(small_buf));
+
+	scan_all(fd, "steady", no_change);
+	scan_all(fd, "growing", add_extra);
+	scan_all(fd, "shrinking", del_extra);
+
+	while (num_extra > 0) {
+		del_extra(fd);
+	}
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		make_key(key, "scan", i);
+		assert(del_pair(fd, key, KEY_LEN, CHAR) == 0);
+	}
+
+	free(seen);
+	close(fd);
+	return 0;
+}
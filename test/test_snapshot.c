@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Sets NUM_OF_PAIRS pairs one by one, saves snapshot to SNAPSHOT_PATH, deletes
+ * all pairs and loads snapshot back; checks that every pair came back with its
+ * value and type, and that load is at least MIN_SPEEDUP times faster than
+ * setting the same pairs one by one; also checks that stream with wrong magic
+ * is refused, that pairs keep their TTL over save and load, and those
+ * that expired in between are skipped, and that load into device with entry
+ * quota below snapshot size stops with EDQUOT and counts only pairs it set;
+ * needs loaded driver with empty dictionary
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           32
+#define NUM_OF_PAIRS      2097152
+#define BATCH_SIZE        1024
+#define MIN_SPEEDUP       4
+#define SNAPSHOT_PATH     "/tmp/dict_snapshot.bin"
+#define SHORT_TTL_MS      200
+#define QUOTA_PAIRS       100
+#define SYSFS_PATH        "/sys/class/dict_class/dict_device0/"
+
+static char (*keys)[KEY_LEN];
+static char (*vals)[VAL_LEN];
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run BATCH of op on all pairs, GET checks values, returns number of failed ops */
+static int for_all(int fd, int op)
+{
+	int failed = 0;
+	int status[BATCH_SIZE];
+	char buf[BATCH_SIZE][VAL_LEN];
+	dict_pair pairs[BATCH_SIZE];
+
+	for (int done = 0; done < NUM_OF_PAIRS; done += BATCH_SIZE) {
+		memset(pairs, 0, sizeof(pairs));
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			pairs[i].key        = keys[done + i];
+			pairs[i].key_size   = KEY_LEN;
+			pairs[i].key_type   = CHAR;
+			pairs[i].value      = buf[i];
+			pairs[i].value_size = VAL_LEN;
+		}
+
+		if (op == DICT_OP_GET) {
+			assert(get_values(fd, pairs, BATCH_SIZE, status) == 0);
+		} else {
+			assert(del_pairs(fd, pairs, BATCH_SIZE, status) == 0);
+		}
+
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			if (status[i] != 0) {
+				failed++;
+			} else if (op == DICT_OP_GET) {
+				assert(pairs[i].value_size == VAL_LEN && pairs[i].value_type == INT);
+				assert(memcmp(buf[i], vals[done + i], VAL_LEN) == 0);
+			}
+		}
+	}
+
+	return failed;
+}
+
+static void write_attr(const char *name, long value)
+{
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), SYSFS_PATH "%s", name);
+	f = fopen(path, "w");
+
+	assert(f != NULL);
+	fprintf(f, "%ld\n", value);
+	assert(fclose(f) == 0);
+}
+
+/* short TTL pair expires between save and load, long TTL and permanent ones are loaded */
+static void test_ttl(int fd, int snap_fd)
+{
+	dict_pair *pair;
+	uint64_t num_entries;
+
+	assert(set_pair_ttl(fd, keys[0], KEY_LEN, CHAR, vals[0], VAL_LEN, INT, SHORT_TTL_MS) == 0);
+	assert(set_pair_ttl(fd, keys[1], KEY_LEN, CHAR, vals[1], VAL_LEN, INT, 60000) == 0);
+	assert(set_pair(fd, keys[2], KEY_LEN, CHAR, vals[2], VAL_LEN, INT) == 0);
+
+	assert(ftruncate(snap_fd, 0) == 0 && lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(save_snapshot(fd, snap_fd, &num_entries) == 0 && num_entries == 3);
+
+	for (int i = 0; i < 3; i++) {
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+
+	usleep(2 * SHORT_TTL_MS * 1000);
+
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(load_snapshot(fd, snap_fd, &num_entries) == 0 && num_entries == 2);
+	assert(get_value(fd, keys[0], KEY_LEN, CHAR) == NULL);
+
+	for (int i = 1; i < 3; i++) {
+		pair = get_value(fd, keys[i], KEY_LEN, CHAR);
+		assert(pair != NULL && memcmp(pair->value, vals[i], VAL_LEN) == 0);
+		free(pair->value);
+		free(pair);
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+}
+
+/* snapshot of twice QUOTA_PAIRS pairs loads up to the quota, count matches pairs set */
+static void test_quota(int fd, int snap_fd)
+{
+	int found = 0;
+	dict_pair *pair;
+	uint64_t num_entries;
+
+	for (int i = 0; i < 2 * QUOTA_PAIRS; i++) {
+		assert(set_pair(fd, keys[i], KEY_LEN, CHAR, vals[i], VAL_LEN, INT) == 0);
+	}
+
+	assert(ftruncate(snap_fd, 0) == 0 && lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(save_snapshot(fd, snap_fd, &num_entries) == 0 && num_entries == 2 * QUOTA_PAIRS);
+
+	for (int i = 0; i < 2 * QUOTA_PAIRS; i++) {
+		assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+	}
+
+	write_attr("quota_entries", QUOTA_PAIRS);
+
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(load_snapshot(fd, snap_fd, &num_entries) == EDQUOT);
+	assert(num_entries == QUOTA_PAIRS);
+
+	write_attr("quota_entries", 0);
+
+	for (int i = 0; i < 2 * QUOTA_PAIRS; i++) {
+		pair = get_value(fd, keys[i], KEY_LEN, CHAR);
+
+		if (pair != NULL) {
+			found++;
+			free(pair->value);
+			free(pair);
+			assert(del_pair(fd, keys[i], KEY_LEN, CHAR) == 0);
+		}
+	}
+
+	assert(found == QUOTA_PAIRS);
+}
+
+int main()
+{
+	int fd;
+	int snap_fd;
+	double start;
+	double set;
+	double save;
+	double load;
+	uint64_t num_entries;
+	dict_snapshot_header header;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	keys = calloc(NUM_OF_PAIRS, KEY_LEN);
+	vals = calloc(NUM_OF_PAIRS, VAL_LEN);
+	assert(keys != NULL && vals != NULL);
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		snprintf(keys[i], KEY_LEN, "sn%d", i);
+		snprintf(vals[i], VAL_LEN, "value of %d", i);
+	}
+
+	start = now_s();
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		assert(set_pair(fd, keys[i], KEY_LEN, CHAR, vals[i], VAL_LEN, INT) == 0);
+	}
+	set = now_s() - start;
+
+	snap_fd = open(SNAPSHOT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	assert(snap_fd >= 0);
+
+	start = now_s();
+	assert(save_snapshot(fd, snap_fd, &num_entries) == 0);
+	save = now_s() - start;
+	assert(num_entries == NUM_OF_PAIRS);
+
+	assert(for_all(fd, DICT_OP_DEL) == 0);
+	assert(for_all(fd, DICT_OP_GET) == NUM_OF_PAIRS);
+
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+
+	start = now_s();
+	assert(load_snapshot(fd, snap_fd, &num_entries) == 0);
+	load = now_s() - start;
+	assert(num_entries == NUM_OF_PAIRS);
+
+	assert(for_all(fd, DICT_OP_GET) == 0);
+
+	printf("set one by one %.2f s, save %.2f s, load %.2f s (%.0f pairs/s), snapshot %ld bytes\n",
+	       set, save, load, NUM_OF_PAIRS / load, (long)lseek(snap_fd, 0, SEEK_END));
+	assert(load * MIN_SPEEDUP < set);
+
+	/* stream that is not a snapshot is refused before anything is set */
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(read(snap_fd, &header, sizeof(header)) == sizeof(header));
+	header.magic++;
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(write(snap_fd, &header, sizeof(header)) == sizeof(header));
+	assert(lseek(snap_fd, 0, SEEK_SET) == 0);
+	assert(load_snapshot(fd, snap_fd, &num_entries) == EINVAL);
+	assert(num_entries == 0);
+
+	assert(for_all(fd, DICT_OP_DEL) == 0);
+
+	test_ttl(fd, snap_fd);
+	test_quota(fd, snap_fd);
+
+	close(snap_fd);
+	unlink(SNAPSHOT_PATH);
+	close(fd);
+	free(keys);
+	free(vals);
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "../src/client/client.h"
+
+/*
+ * Sets NUM_OF_PAIRS pairs with one write() of record stream, then again with
+ * writes of odd CHUNK_LEN size that split records, and reads stream back with
+ * read() of READ_LEN, checking every pair came back once per pass with its
+ * value and type; also checks write() with a rejected record returns short
+ * count and fails the rest of the stream; needs loaded driver with empty dictionary
+ */
+
+#define KEY_LEN           16
+#define VAL_LEN           16
+#define NUM_OF_PAIRS      200000
+#define RECORD_LEN        (sizeof(dict_scan_record) + KEY_LEN + VAL_LEN)
+#define CHUNK_LEN         4097
+#define READ_LEN          65536
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read whole stream, count records of our pairs, assert each one at most once */
+static int read_all(int fd, char *seen)
+{
+	int i;
+	int found = 0;
+	ssize_t len;
+	size_t have = 0;
+	size_t pos;
+	size_t cap = READ_LEN * 2;
+	char *buf = malloc(cap);
+	dict_scan_record *record;
+
+	assert(buf != NULL);
+	memset(seen, 0, NUM_OF_PAIRS);
+
+	while ((len = read(fd, buf + have, READ_LEN)) > 0) {
+		have += len;
+
+		if (have + READ_LEN > cap) {
+			cap *= 2;
+			buf = realloc(buf, cap);
+			assert(buf != NULL);
+		}
+
+		for (pos = 0; pos + sizeof(dict_scan_record) <= have; pos += sizeof(dict_scan_record) + record->key_size + record->value_size) {
+			record = (dict_scan_record *)(buf + pos);
+
+			if (pos + sizeof(dict_scan_record) + record->key_size + record->value_size > have) {
+				break;
+			}
+
+			if (record->key_size != KEY_LEN || strncmp((char *)(record + 1), "st", 2) != 0) {
+				continue;
+			}
+
+			i = atoi((char *)(record + 1) + 2);
+			assert(i >= 0 && i < NUM_OF_PAIRS && !seen[i]);
+			assert(record->key_type == CHAR && record->value_type == INT && record->value_size == VAL_LEN);
+			assert(memcmp((char *)(record + 1), (char *)(record + 1) + KEY_LEN, KEY_LEN) == 0);
+			seen[i] = 1;
+			found++;
+		}
+
+		/* keep split record for the next read */
+		memmove(buf, buf + pos, have - pos);
+		have -= pos;
+	}
+
+	assert(len == 0 && have == 0);
+	free(buf);
+	return found;
+}
+
+int main()
+{
+	int fd;
+	size_t off;
+	size_t len;
+	double start;
+	double write_time;
+	double read_time;
+	char *stream;
+	char *seen;
+	char tail[16];
+	dict_scan_record *record;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	stream = calloc(NUM_OF_PAIRS, RECORD_LEN);
+	seen = calloc(NUM_OF_PAIRS, 1);
+	assert(stream != NULL && seen != NULL);
+
+	/* value is a copy of the key, so records can be checked on their own */
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		record = (dict_scan_record *)(stream + i * RECORD_LEN);
+		record->key_size   = KEY_LEN;
+		record->value_size = VAL_LEN;
+		record->key_type   = CHAR;
+		record->value_type = INT;
+		snprintf((char *)(record + 1), KEY_LEN, "st%d", i);
+		memcpy((char *)(record + 1) + KEY_LEN, record + 1, VAL_LEN);
+	}
+
+	start = now_s();
+	assert(write(fd, stream, NUM_OF_PAIRS * RECORD_LEN) == (ssize_t)(NUM_OF_PAIRS * RECORD_LEN));
+	write_time = now_s() - start;
+
+	start = now_s();
+	assert(read_all(fd, seen) == NUM_OF_PAIRS);
+	read_time = now_s() - start;
+
+	printf("write %.0f pairs/s, read %.0f pairs/s\n", NUM_OF_PAIRS / write_time, NUM_OF_PAIRS / read_time);
+
+	/* read position belongs to open file, so reading again needs new one */
+	assert(read(fd, tail, sizeof(tail)) == 0);
+	close(fd);
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	for (off = 0; off < NUM_OF_PAIRS * RECORD_LEN; off += len) {
+		len = NUM_OF_PAIRS * RECORD_LEN - off < CHUNK_LEN ? NUM_OF_PAIRS * RECORD_LEN - off : CHUNK_LEN;
+		assert(write(fd, stream + off, len) == (ssize_t)len);
+	}
+
+	assert(read_all(fd, seen) == NUM_OF_PAIRS);
+	close(fd);
+
+	/* second of three records is illegal: short count up to its header, then stream fails */
+	fd = open(DEVICE_PATH, O_RDWR);
+	assert(fd >= 0);
+
+	record = (dict_scan_record *)(stream + RECORD_LEN);
+	record->value_size = 0;
+	assert(write(fd, stream, 3 * RECORD_LEN) == (ssize_t)(RECORD_LEN + sizeof(dict_scan_record)));
+	assert(write(fd, stream + RECORD_LEN + sizeof(dict_scan_record), KEY_LEN) == -1 && errno == EINVAL);
+	assert(write(fd, stream + 2 * RECORD_LEN, RECORD_LEN) == -1 && errno == EINVAL);
+	record->value_size = VAL_LEN;
+
+	for (int i = 0; i < NUM_OF_PAIRS; i++) {
+		record = (dict_scan_record *)(stream + i * RECORD_LEN);
+		assert(del_pair(fd, record + 1, KEY_LEN, CHAR) == 0);
+	}
+
+	close(fd);
+	free(stream);
+	free(seen);
+	return 0;
+}